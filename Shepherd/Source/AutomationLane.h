@@ -0,0 +1,155 @@
+/*
+  ==============================================================================
+
+    AutomationLane.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+/** Automation of a MIDI controller (or of the pitch wheel) of a clip stored as a curve of breakpoints instead of as
+ individual MIDI events. Each breakpoint has a position (in beats), a normalized value (0.0-1.0) and the curvature of the
+ segment that goes to the next breakpoint (0.0 = linear, positive/negative values = exponential segments that change
+ slower/faster at the start, limited to +/-maxCurve). Before the first breakpoint and after the last one the value of the
+ curve is constant.
+ Automation lanes are stored in the clip state as AUTOMATION_LANE children (breakpoints are serialized in a compact
+ string, see serializeBreakpoints) and compiled with the clip sequence so they can be sampled from the RT thread while
+ rendering each slice (see Clip::renderAutomationLanesInSlice).
+ */
+struct AutomationLane
+{
+    struct Breakpoint
+    {
+        double beats;
+        float value;
+        float curve;
+    };
+
+    static constexpr float maxCurve = 20.0f;  // Steeper curves are indistinguishable from steps and exp() would overflow for huge ones
+
+    int controllerNumber = -1;  // -1 = pitch wheel
+    std::vector<Breakpoint> breakpoints;
+
+    int getMaxValue() const
+    {
+        return controllerNumber < 0 ? 16383 : 127;
+    }
+
+    float getValueAt(double beats) const
+    {
+        // NOTE: this is called from the RT thread
+        if (breakpoints.size() == 0){
+            return 0.0f;
+        }
+        if (beats <= breakpoints.front().beats){
+            return breakpoints.front().value;
+        }
+        if (beats >= breakpoints.back().beats){
+            return breakpoints.back().value;
+        }
+        auto next = std::upper_bound(breakpoints.begin(), breakpoints.end(), beats, [](double b, const Breakpoint& breakpoint){ return b < breakpoint.beats; });
+        const Breakpoint& segmentEnd = *next;
+        const Breakpoint& segmentStart = *(next - 1);
+        double segmentLength = segmentEnd.beats - segmentStart.beats;
+        double position = segmentLength > 0.0 ? (beats - segmentStart.beats) / segmentLength : 1.0;
+        if (std::abs(segmentStart.curve) > 0.001f){
+            position = (std::exp(segmentStart.curve * position) - 1.0) / (std::exp((double)segmentStart.curve) - 1.0);
+        }
+        return segmentStart.value + (float)position * (segmentEnd.value - segmentStart.value);
+    }
+
+    int getQuantizedValueAt(double beats) const
+    {
+        return juce::jlimit(0, getMaxValue(), (int)std::round(getValueAt(beats) * getMaxValue()));
+    }
+
+    juce::MidiMessage createMidiMessage(int quantizedValue) const
+    {
+        // NOTE: MIDI channel will be re-written when rendering
+        if (controllerNumber < 0){
+            return juce::MidiMessage::pitchWheel(1, quantizedValue);
+        }
+        return juce::MidiMessage::controllerEvent(1, controllerNumber, quantizedValue);
+    }
+
+    static AutomationLane fromValueTree(const juce::ValueTree& automationLane)
+    {
+        AutomationLane lane;
+        lane.controllerNumber = juce::jlimit(-1, 127, (int)automationLane.getProperty(ShepherdIDs::controllerNumber, -1));
+        lane.breakpoints = parseBreakpoints(automationLane.getProperty(ShepherdIDs::breakpoints).toString());
+        return lane;
+    }
+
+    static std::vector<AutomationLane> allFromClipState(const juce::ValueTree& clipState)
+    {
+        std::vector<AutomationLane> lanes;
+        for (auto child: clipState){
+            if (child.hasType(ShepherdIDs::AUTOMATION_LANE) && (int)lanes.size() < MAX_NUM_AUTOMATION_LANES){
+                lanes.push_back(fromValueTree(child));
+            }
+        }
+        return lanes;
+    }
+
+    static std::vector<Breakpoint> parseBreakpoints(const juce::String& breakpointsString)
+    {
+        // Breakpoints are serialized as "beats,value,curve" triplets separated by ";" (e.g. "0,0,0;2,1,-3;4,0.5,0")
+        std::vector<Breakpoint> breakpoints;
+        juce::StringArray tokens;
+        tokens.addTokens(breakpointsString, ";", "");
+        for (auto& token: tokens){
+            juce::StringArray fields;
+            fields.addTokens(token, ",", "");
+            if (fields.size() >= 2){
+                breakpoints.push_back(createBreakpoint(fields[0].getDoubleValue(), fields[1].getFloatValue(), fields.size() > 2 ? fields[2].getFloatValue() : 0.0f));
+            }
+        }
+        sortBreakpoints(breakpoints);
+        return breakpoints;
+    }
+
+    static std::vector<Breakpoint> breakpointsFromJson(const juce::var& breakpointsData)
+    {
+        // Breakpoints are passed as a list of [beats, value, curve] lists (curve is optional)
+        std::vector<Breakpoint> breakpoints;
+        if (auto* breakpointsArray = breakpointsData.getArray()){
+            for (auto& breakpointData: *breakpointsArray){
+                auto* fields = breakpointData.getArray();
+                if (fields != nullptr && fields->size() >= 2){
+                    breakpoints.push_back(createBreakpoint((double)(*fields)[0], (float)(*fields)[1], fields->size() > 2 ? (float)(*fields)[2] : 0.0f));
+                }
+            }
+        }
+        sortBreakpoints(breakpoints);
+        return breakpoints;
+    }
+
+    static juce::String serializeBreakpoints(const std::vector<Breakpoint>& breakpoints)
+    {
+        juce::StringArray tokens;
+        for (auto& breakpoint: breakpoints){
+            tokens.add(juce::String(breakpoint.beats) + "," + juce::String(breakpoint.value) + "," + juce::String(breakpoint.curve));
+        }
+        return tokens.joinIntoString(";");
+    }
+
+private:
+    static Breakpoint createBreakpoint(double beats, float value, float curve)
+    {
+        Breakpoint breakpoint;
+        breakpoint.beats = juce::jmax(0.0, beats);
+        breakpoint.value = juce::jlimit(0.0f, 1.0f, value);
+        breakpoint.curve = std::isfinite(curve) ? juce::jlimit(-maxCurve, maxCurve, curve) : 0.0f;
+        return breakpoint;
+    }
+
+    static void sortBreakpoints(std::vector<Breakpoint>& breakpoints)
+    {
+        std::stable_sort(breakpoints.begin(), breakpoints.end(), [](const Breakpoint& a, const Breakpoint& b){ return a.beats < b.beats; });
+    }
+};
@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+    AutomationThinner.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SequenceEventStore.h"
+
+
+/** Removes redundant points of recorded automation (controller, pitch wheel, channel pressure and polyphonic aftertouch
+ messages) before these are added to the sequence of a clip. Each "lane" (message type, channel and controller/note
+ number) is thinned independently. A point is only kept if its value differs from the last kept point by more than
+ valueTolerance (in 7-bit MIDI units, pitch wheel values are scaled accordingly) or if it comes timeTolerance beats or
+ more after it. Points which are not kept are held as "pending" (also between batches of recorded messages) and the last
+ pending point of a lane is always kept once a gap longer than timeTolerance follows it (see flushEndedGestures) or when
+ recording stops (see flush), so the final value of every gesture is preserved. Therefore the thinned automation never
+ differs from the recorded one by more than valueTolerance and value changes are never delayed by more than timeTolerance.
+ NOTE: this should NOT be used from RT thread
+ */
+class AutomationThinner
+{
+public:
+    AutomationThinner()
+    {
+    }
+
+    void setTolerances(int newValueTolerance, double newTimeToleranceInBeats)
+    {
+        valueTolerance = juce::jmax(0, newValueTolerance);
+        timeToleranceInBeats = juce::jmax(0.0, newTimeToleranceInBeats);
+    }
+
+    bool isEnabled() const
+    {
+        // Both tolerances are needed, otherwise every point would differ from the previous one by more than one of them
+        return valueTolerance > 0 && timeToleranceInBeats > 0.0;
+    }
+
+    void addPoint(const juce::uint8* data, int numBytes, double positionInBeats, double clipLengthInBeats, std::vector<SequenceEventRecord>& recordsToAdd)
+    {
+        // Adds the records of the points that should be kept (if any) to recordsToAdd
+        if (!isEnabled()){
+            recordsToAdd.push_back(createRecord(data, numBytes, positionInBeats));
+            return;
+        }
+        Point point;
+        std::memcpy(point.data, data, (size_t)numBytes);
+        point.numBytes = numBytes;
+        point.positionInBeats = positionInBeats;
+        point.value = getPointValue(data, numBytes);
+
+        Lane& lane = lanes[getLaneKey(data)];
+        if (!lane.hasKeptPoint){
+            keepPoint(lane, point, recordsToAdd);
+            return;
+        }
+        const Point& currentPoint = lane.hasPendingPoint ? lane.pendingPoint : lane.keptPoint;
+        if (point.value == currentPoint.value){
+            // Point does not change the value of the lane
+            numThinnedPoints += 1;
+            return;
+        }
+        if (std::abs(point.value - lane.keptPoint.value) > (double)valueTolerance || getBeatsBetween(lane.keptPoint, point, clipLengthInBeats) >= timeToleranceInBeats){
+            if (lane.hasPendingPoint && getBeatsBetween(lane.pendingPoint, point, clipLengthInBeats) > timeToleranceInBeats){
+                // Pending point is the end of a previous gesture, keep it as well
+                keepPoint(lane, lane.pendingPoint, recordsToAdd);
+            } else if (lane.hasPendingPoint){
+                numThinnedPoints += 1;
+            }
+            keepPoint(lane, point, recordsToAdd);
+        } else {
+            if (lane.hasPendingPoint){
+                numThinnedPoints += 1;
+            }
+            lane.pendingPoint = point;
+            lane.hasPendingPoint = true;
+        }
+    }
+
+    void flushEndedGestures(double positionInBeats, double clipLengthInBeats, std::vector<SequenceEventRecord>& recordsToAdd)
+    {
+        // Keeps the pending points of the lanes which have not changed for longer than timeTolerance before positionInBeats
+        // (the position of the last recorded message). These would be kept anyway by the next point of the lane (see addPoint),
+        // but keeping them now adds the end of the gestures to the sequence while recording continues.
+        for (auto& it: lanes){
+            if (it.second.hasPendingPoint && getBeatsBetween(it.second.pendingPoint, positionInBeats, clipLengthInBeats) > timeToleranceInBeats){
+                keepPoint(it.second, it.second.pendingPoint, recordsToAdd);
+            }
+        }
+    }
+
+    void flush(std::vector<SequenceEventRecord>& recordsToAdd)
+    {
+        // Keeps the pending points of all lanes (called when recording stops)
+        for (auto& it: lanes){
+            if (it.second.hasPendingPoint){
+                keepPoint(it.second, it.second.pendingPoint, recordsToAdd);
+            }
+        }
+    }
+
+    void reset()
+    {
+        // Forget the points of previous recordings (pending points should have been flushed before)
+        lanes.clear();
+    }
+
+    juce::int64 getNumThinnedPoints() const
+    {
+        // NOTE: this can be called from any thread (e.g. when collecting stats)
+        return numThinnedPoints.load();
+    }
+
+private:
+    struct Point
+    {
+        juce::uint8 data[3];
+        int numBytes;
+        double positionInBeats;
+        double value;
+    };
+
+    struct Lane
+    {
+        Point keptPoint;
+        Point pendingPoint;
+        bool hasKeptPoint = false;
+        bool hasPendingPoint = false;
+    };
+
+    int valueTolerance = 0;
+    double timeToleranceInBeats = 0.0;
+    std::unordered_map<int, Lane> lanes;
+    std::atomic<juce::int64> numThinnedPoints { 0 };
+
+    static int getLaneKey(const juce::uint8* data)
+    {
+        // Status byte (type and channel) plus controller/note number for controllers and polyphonic aftertouch
+        juce::uint8 messageType = data[0] & 0xF0;
+        if (messageType == 0xA0 || messageType == 0xB0){
+            return (data[0] << 7) | (data[1] & 0x7F);
+        }
+        return data[0] << 7;
+    }
+
+    static double getPointValue(const juce::uint8* data, int numBytes)
+    {
+        juce::uint8 messageType = data[0] & 0xF0;
+        if (messageType == 0xE0 && numBytes > 2){
+            // Scale 14-bit pitch wheel values to 7-bit units
+            return (double)((data[2] << 7) | data[1]) / 128.0;
+        } else if (messageType == 0xD0 || numBytes < 3){
+            return (double)data[1];
+        }
+        return (double)data[2];
+    }
+
+    static double getBeatsBetween(const Point& a, const Point& b, double clipLengthInBeats)
+    {
+        return getBeatsBetween(a, b.positionInBeats, clipLengthInBeats);
+    }
+
+    static double getBeatsBetween(const Point& a, double positionInBeats, double clipLengthInBeats)
+    {
+        double beats = positionInBeats - a.positionInBeats;
+        if (beats < 0.0){
+            // If negative, playhead has wrapped (or clip has no length yet), consider it a gap
+            beats = clipLengthInBeats > 0.0 ? beats + clipLengthInBeats : std::numeric_limits<double>::max();
+        }
+        return beats;
+    }
+
+    static SequenceEventRecord createRecord(const juce::uint8* data, int numBytes, double positionInBeats)
+    {
+        return SequenceEventStore::createMidiRecord(juce::MidiMessage(data, numBytes, positionInBeats));
+    }
+
+    void keepPoint(Lane& lane, const Point& point, std::vector<SequenceEventRecord>& recordsToAdd)
+    {
+        recordsToAdd.push_back(createRecord(point.data, point.numBytes, point.positionInBeats));
+        lane.keptPoint = point;
+        lane.hasKeptPoint = true;
+        lane.hasPendingPoint = false;
+    }
+};
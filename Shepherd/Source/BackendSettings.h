@@ -0,0 +1,199 @@
+/*
+  ==============================================================================
+
+    BackendSettings.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+#if JUCE_LINUX
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+struct BackendSettingsStruct {
+    juce::String metronomeMidiDevice = "";
+    int metronomeMidiChannel = -1;
+    std::vector<juce::String> midiDevicesToSendClockTo = {};
+    std::vector<double> midiClockOffsetsMs = {};  // Offset of the clock sent to each of midiDevicesToSendClockTo (positive = later)
+    int midiClockPPQN = ShepherdDefaults::midiClockPPQN;
+    int sliceSizeInSamples = ShepherdDefaults::sliceSizeInSamples;
+    double lookaheadRenderingBeats = ShepherdDefaults::lookaheadRenderingBeats;
+    int trackProcessingThreads = ShepherdDefaults::trackProcessingThreads;
+    bool directMidiThru = ShepherdDefaults::directMidiThru;
+    int automationThinningValueTolerance = ShepherdDefaults::automationThinningValueTolerance;
+    double automationThinningTimeTolerance = ShepherdDefaults::automationThinningTimeTolerance;
+    int automationPointsPerSlice = ShepherdDefaults::automationPointsPerSlice;
+    juce::String pushClockDeviceName = "";
+    int clipUndoLevels = ShepherdDefaults::clipUndoLevels;
+    int clipUndoMemoryBudgetBytes = ShepherdDefaults::clipUndoMemoryBudgetBytes;
+    juce::var parsedJson;  // Full parsed contents of the file, for settings that have no typed member
+};
+
+
+/** Loads the contents of backendSettings.json only once and keeps them in a BackendSettingsStruct. The file
+ is then watched for changes (using inotify on Linux, or checking the modification time in other platforms)
+ and, if it changes, it is re-loaded and the onChange callback is called in the message thread.
+ */
+class BackendSettings: private juce::Thread,
+                       private juce::AsyncUpdater
+{
+public:
+    BackendSettings(): juce::Thread ("BackendSettingsWatcher")
+    {
+    }
+
+    ~BackendSettings()
+    {
+        stopWatching();
+        cancelPendingUpdate();
+    }
+
+    void setSettingsFile(const juce::File& file)
+    {
+        settingsFile = file;
+        reloadIfChanged();
+    }
+
+    void startWatching()
+    {
+        startThread(0);
+    }
+
+    void stopWatching()
+    {
+        stopThread(2000);
+    }
+
+    BackendSettingsStruct getSettings()
+    {
+        const juce::ScopedLock sl (settingsLock);
+        return settings;
+    }
+
+    std::function<void()> onChange;
+
+private:
+    juce::File settingsFile;
+    juce::String lastLoadedContents = "";
+    BackendSettingsStruct settings;
+    juce::CriticalSection settingsLock;
+
+    bool reloadIfChanged()
+    {
+        // Re-parses the settings file if its contents are different from the last loaded contents, returns true if settings changed
+        juce::String contents = settingsFile.existsAsFile() ? settingsFile.loadFileAsString() : "";
+        if (contents == lastLoadedContents){
+            return false;
+        }
+        lastLoadedContents = contents;
+
+        BackendSettingsStruct newSettings;
+        juce::var parsedJson;
+        auto result = juce::JSON::parse(contents, parsedJson);
+        if (result.wasOk() && parsedJson.isObject()){
+            newSettings.parsedJson = parsedJson;
+            newSettings.metronomeMidiDevice = parsedJson.getProperty("metronomeMidiDevice", "").toString();
+            if (parsedJson.hasProperty("metronomeMidiChannel")){
+                newSettings.metronomeMidiChannel = (int)parsedJson.getProperty("metronomeMidiChannel", -1);
+            }
+            newSettings.pushClockDeviceName = parsedJson.getProperty("pushClockDeviceName", "").toString();
+            newSettings.clipUndoLevels = (int)parsedJson.getProperty("clipUndoLevels", ShepherdDefaults::clipUndoLevels);
+            newSettings.clipUndoMemoryBudgetBytes = (int)parsedJson.getProperty("clipUndoMemoryBudgetBytes", ShepherdDefaults::clipUndoMemoryBudgetBytes);
+            newSettings.sliceSizeInSamples = juce::jmax(0, (int)parsedJson.getProperty("sliceSizeInSamples", ShepherdDefaults::sliceSizeInSamples));
+            newSettings.lookaheadRenderingBeats = juce::jmax(0.0, (double)parsedJson.getProperty("lookaheadRenderingBeats", ShepherdDefaults::lookaheadRenderingBeats));
+            newSettings.trackProcessingThreads = juce::jlimit(0, juce::SystemStats::getNumCpus(), (int)parsedJson.getProperty("trackProcessingThreads", ShepherdDefaults::trackProcessingThreads));
+            newSettings.directMidiThru = (bool)parsedJson.getProperty("directMidiThru", ShepherdDefaults::directMidiThru);
+            newSettings.automationThinningValueTolerance = juce::jlimit(0, 127, (int)parsedJson.getProperty("automationThinningValueTolerance", ShepherdDefaults::automationThinningValueTolerance));
+            newSettings.automationThinningTimeTolerance = juce::jmax(0.0, (double)parsedJson.getProperty("automationThinningTimeTolerance", ShepherdDefaults::automationThinningTimeTolerance));
+            newSettings.automationPointsPerSlice = juce::jlimit(1, 64, (int)parsedJson.getProperty("automationPointsPerSlice", ShepherdDefaults::automationPointsPerSlice));
+            juce::var rawElement = parsedJson.getProperty("midiDevicesToSendClockTo", juce::var());
+            if (rawElement.isArray()){
+                for (juce::var element: *rawElement.getArray()){
+                    newSettings.midiDevicesToSendClockTo.push_back(element.toString());
+                }
+            }
+            juce::var rawOffsets = parsedJson.getProperty("midiClockOffsetsMs", juce::var());
+            for (auto deviceName: newSettings.midiDevicesToSendClockTo){
+                newSettings.midiClockOffsetsMs.push_back(rawOffsets.isObject() ? (double)rawOffsets.getProperty(deviceName, 0.0) : 0.0);
+            }
+            int midiClockPPQN = (int)parsedJson.getProperty("midiClockPPQN", ShepherdDefaults::midiClockPPQN);
+            if (midiClockPPQN == 24 || midiClockPPQN == 48 || midiClockPPQN == 96){
+                newSettings.midiClockPPQN = midiClockPPQN;
+            } else {
+                DBG("Unsupported MIDI clock PPQN " << midiClockPPQN << ", using " << ShepherdDefaults::midiClockPPQN);
+            }
+        } else if (contents != "") {
+            DBG("Error parsing backend settings file: " << result.getErrorMessage());
+        }
+
+        const juce::ScopedLock sl (settingsLock);
+        settings = newSettings;
+        return true;
+    }
+
+    void run() override
+    {
+        #if JUCE_LINUX
+        // Watch the parent directory instead of the file itself so that we also get notified when editors replace the file
+        int inotifyFd = inotify_init1(IN_NONBLOCK);
+        if (inotifyFd >= 0){
+            int watchDescriptor = inotify_add_watch(inotifyFd, settingsFile.getParentDirectory().getFullPathName().toRawUTF8(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+            if (watchDescriptor >= 0){
+                alignas(inotify_event) char eventsBuffer[4096];
+                while (!threadShouldExit()){
+                    pollfd pfd = {inotifyFd, POLLIN, 0};
+                    if (poll(&pfd, 1, 500) <= 0){
+                        continue;  // Timed out, check if thread should exit and poll again
+                    }
+                    bool settingsFileAffected = false;
+                    ssize_t length;
+                    while ((length = read(inotifyFd, eventsBuffer, sizeof(eventsBuffer))) > 0){
+                        for (char* ptr = eventsBuffer; ptr < eventsBuffer + length; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len){
+                            auto* event = reinterpret_cast<inotify_event*>(ptr);
+                            if (event->len > 0 && settingsFile.getFileName() == juce::String(event->name)){
+                                settingsFileAffected = true;
+                            }
+                        }
+                    }
+                    if (settingsFileAffected && reloadIfChanged()){
+                        triggerAsyncUpdate();
+                    }
+                }
+                inotify_rm_watch(inotifyFd, watchDescriptor);
+                close(inotifyFd);
+                return;
+            }
+            close(inotifyFd);
+        }
+        // If inotify could not be set up, fall back to checking the modification time
+        #endif
+
+        juce::Time lastModificationTime = settingsFile.getLastModificationTime();
+        while (!threadShouldExit()){
+            wait(1000);
+            juce::Time modificationTime = settingsFile.getLastModificationTime();
+            if (modificationTime != lastModificationTime){
+                lastModificationTime = modificationTime;
+                if (reloadIfChanged()){
+                    triggerAsyncUpdate();
+                }
+            }
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        if (onChange){
+            onChange();
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BackendSettings)
+};
@@ -9,43 +9,91 @@
 */
 
 #include "Clip.h"
+#include "LookaheadRenderer.h"
 
 
 Clip::Clip(const juce::ValueTree& _state,
            std::function<juce::Range<double>()> playheadParentSliceGetter,
            std::function<GlobalSettingsStruct()> globalSettingsGetter,
            std::function<TrackSettingsStruct()> trackSettingsGetter,
-           std::function<MusicalContext*()> musicalContextGetter)
+           std::function<MusicalContext*()> musicalContextGetter,
+           std::function<void()> needsProcessingNotifier)
 : state(_state)
 {
     getGlobalSettings = globalSettingsGetter;
     getTrackSettings = trackSettingsGetter;
     getMusicalContext = musicalContextGetter;
+    notifyNeedsProcessing = [this, needsProcessingNotifier]{
+        // Changes that might require processing in the RT thread usually also require updating the state
+        shouldUpdateInMessageThread = true;
+        needsProcessingNotifier();
+    };
     
-    bindState();
+    // Keep track of all changes in the sequence events so these can be undone
+    sequenceEvents.onRecordChanged = [this](const SequenceEventRecord* before, const SequenceEventRecord* after){
+        undoHistory.recordChange(before, after);
+    };
+    
+    lastRenderedAutomationValues.fill(-1);
     
-    playhead = std::make_unique<Playhead>(state, playheadParentSliceGetter, [this]{ return getLocalSliceLength(); });
+    bindState();
     
-    startTimer(50); // Check if sequence should be updated and do it!
+    playhead = std::make_unique<Playhead>(state, playheadParentSliceGetter, [this]{ return bpmMultiplier.get(); });
+}
+
+Clip::~Clip()
+{
+    releaseLookaheadSlot();
 }
 
 void Clip::loadStateFromOtherClipState(const juce::ValueTree& otherClipState, bool replaceSequenceEventUUIDs)
 {
     if (otherClipState.hasType(ShepherdIDs::CLIP)){
+        undoHistory.clear();  // Undo history refers to the previous contents of the clip
         currentQuantizationStep = otherClipState.getProperty(ShepherdIDs::currentQuantizationStep);
+        std::vector<SequenceEventRecord> newSequenceEvents = SequenceEventStore::recordsFromClipState(otherClipState);
         if (replaceSequenceEventUUIDs == true){
-            // Note that otherClipState should be a copy of the other clip's state so modifying it here won't modify the original
-            for (auto child: otherClipState){
-                ShepherdHelpers::updateUuidProperty(child);
+            for (auto& record: newSequenceEvents){
+                record.uuid = UuidKey::createNew();
             }
         }
         bpmMultiplier = otherClipState.getProperty(ShepherdIDs::bpmMultiplier, ShepherdDefaults::bpmMultiplier);
         wrapEventsAcrossClipLoop = otherClipState.getProperty(ShepherdIDs::wrapEventsAcrossClipLoop, ShepherdDefaults::wrapEventsAcrossClipLoop);
-        replaceSequence(otherClipState, otherClipState.getProperty(ShepherdIDs::clipLengthInBeats));
+        replaceSequenceEvents(newSequenceEvents, otherClipState.getProperty(ShepherdIDs::clipLengthInBeats));
+        replaceAutomationLanesWithOnesFrom(otherClipState);
         updateStateMemberVersions();
     }
 }
 
+void Clip::loadContentsFromOtherClip(Clip& otherClip, bool replaceSequenceEventUUIDs)
+{
+    // NOTE: this should NOT be called from RT thread
+    
+    // Same as loadStateFromOtherClipState but reading from the other clip object directly. Sequence events are shared
+    // with the other clip (copy-on-write) instead of being parsed from the state, and if the other clip's sequence
+    // is up to date, the already rendered ClipSequence is re-used as well so it does not need to be re-created
+    const juce::ScopedLock sl (sequenceEditsLock);
+    const juce::ScopedLock slOther (otherClip.sequenceEditsLock);
+    undoHistory.clear();  // Undo history refers to the previous contents of the clip
+    currentQuantizationStep = otherClip.currentQuantizationStep;
+    bpmMultiplier = otherClip.bpmMultiplier.get();
+    wrapEventsAcrossClipLoop = otherClip.wrapEventsAcrossClipLoop.get();
+    sequenceEvents.replaceAllWithContentsOf(otherClip.sequenceEvents, replaceSequenceEventUUIDs);
+    shouldSendRemainingNotesOff = true;
+    notifyNeedsProcessing();
+    setClipLength(otherClip.clipLengthInBeats);
+    replaceAutomationLanesWithOnesFrom(otherClip.state);
+    updateStateMemberVersions();
+    
+    // NOTE: this is done after updating the state as property changes set sequenceNeedsUpdate
+    if (!otherClip.sequenceNeedsUpdate && otherClip.lastCreatedClipSequence != nullptr){
+        addClipSequenceToFifo(otherClip.lastCreatedClipSequence);
+        sequenceNeedsUpdate = false;
+    } else {
+        sequenceNeedsUpdate = true;
+    }
+}
+
 void Clip::bindState()
 {
     uuid.referTo(state, ShepherdIDs::uuid, nullptr, ShepherdDefaults::emptyString);
@@ -63,6 +111,14 @@ void Clip::bindState()
     willStopRecordingAt = stateWillStopRecordingAt;
     stateRecording.referTo(state, ShepherdIDs::recording, nullptr, ShepherdDefaults::recording);
     recording = stateRecording;
+    if (recording || willStartRecordingAt > -1.0){
+        allocateRecordedMidiMessagesFifo();
+    }
+    
+    // Load sequence events from the state, from now on the SEQUENCE_EVENT children of the state are only written by the store
+    sequenceEvents.loadFromState(state);
+    sequenceNeedsUpdate = true;
+    undoHistory.clear();
     
     state.addListener(this);
 }
@@ -84,8 +140,14 @@ void Clip::updateStateMemberVersions()
     }
 }
 
-void Clip::timerCallback(){
-        
+void Clip::updateInMessageThread()
+{
+    // NOTE: this is called periodically from the Sequencer's timer for all clips, so it returns early for idle clips
+    // with nothing to update (no per-clip timers are used so that big sessions don't create thousands of timers)
+    if (!shouldUpdateInMessageThread.exchange(false) && !sequenceNeedsUpdate){
+        return;
+    }
+    
     // Add pending recorded notes to the sequence
     addRecordedNotesToSequence();
     
@@ -98,9 +160,13 @@ void Clip::timerCallback(){
     }
     
     // Recreate the MIDI sequence object and add it to the fifo if it has changed
+    // If a batch of edits is being applied, skip it for now and it will be done in the next call
     if (sequenceNeedsUpdate){
-        recreateSequenceAndAddToFifo();
-        sequenceNeedsUpdate = false;
+        const juce::ScopedTryLock stl (sequenceEditsLock);
+        if (stl.isLocked()){
+            recreateSequenceAndAddToFifo();
+            sequenceNeedsUpdate = false;
+        }
     }
     
     // Update stateX member values if these have changed
@@ -111,16 +177,19 @@ void Clip::timerCallback(){
 void Clip::playNow()
 {
     playhead->playNow();
+    notifyNeedsProcessing();
 }
 
 void Clip::playNow(double sliceOffset)
 {
     playhead->playNow(sliceOffset);
+    notifyNeedsProcessing();
 }
 
 void Clip::playAt(double positionInGlobalPlayhead)
 {
     playhead->playAt(positionInGlobalPlayhead);
+    notifyNeedsProcessing();
 }
 
 void Clip::stopNow()
@@ -130,11 +199,13 @@ void Clip::stopNow()
     }
     playhead->stopNow();
     resetPlayheadPosition();
+    notifyNeedsProcessing();
 }
 
 void Clip::stopAt(double positionInGlobalPlayhead)
 {
     playhead->stopAt(positionInGlobalPlayhead);
+    notifyNeedsProcessing();
 }
 
 void Clip::togglePlayStop()
@@ -153,7 +224,7 @@ void Clip::togglePlayStop()
     } else {
         if (playhead->isCuedToPlay()){
             // If clip is not playing but it is already cued to start, cancel the cue
-            playhead->clearPlayCue();
+            clearPlayCue();
             
             // And if it is also cued to start recording, clear that cue as well
             if (isCuedToStartRecording()){
@@ -170,14 +241,21 @@ void Clip::togglePlayStop()
     }
 }
 
+double Clip::getPlayAtCueBeats()
+{
+    return playhead->getPlayAtCueBeats();
+}
+
 void Clip::clearPlayCue()
 {
     playhead->clearPlayCue();
+    shouldUpdateInMessageThread = true;
 }
 
 void Clip::clearStopCue()
 {
     playhead->clearStopCue();
+    shouldUpdateInMessageThread = true;
 }
 
 void Clip::startRecordingNow()
@@ -186,6 +264,7 @@ void Clip::startRecordingNow()
     recording = true;
     hasJustStoppedRecordingFlag = false;
     willStopRecordingAt = -1.0;
+    notifyNeedsProcessing();
 }
 
 void Clip::stopRecordingNow()
@@ -194,16 +273,20 @@ void Clip::stopRecordingNow()
     recording = false;
     hasJustStoppedRecordingFlag = true;
     willStopRecordingAt = -1.0;
+    notifyNeedsProcessing();
 }
 
 void Clip::startRecordingAt(double positionInClipPlayhead)
 {
+    allocateRecordedMidiMessagesFifo();  // Make sure the fifo exists before the RT thread starts recording
     willStartRecordingAt = positionInClipPlayhead;
+    notifyNeedsProcessing();
 }
 
 void Clip::stopRecordingAt(double positionInClipPlayhead)
 {
     willStopRecordingAt = positionInClipPlayhead;
+    notifyNeedsProcessing();
 }
 
 void Clip::toggleRecord()
@@ -252,11 +335,13 @@ void Clip::toggleRecord()
 void Clip::clearStartRecordingCue()
 {
     willStartRecordingAt = -1.0;
+    shouldUpdateInMessageThread = true;
 }
 
 void Clip::clearStopRecordingCue()
 {
     willStopRecordingAt = -1.0;
+    shouldUpdateInMessageThread = true;
 }
 
 bool Clip::isPlaying()
@@ -311,12 +396,12 @@ bool Clip::hasZeroLength()
 
 int Clip::getNumSequenceEvents()
 {
-    return numSequenceEvents;
+    return sequenceEvents.size();
 }
 
 bool Clip::hasSequenceEvents()
 {
-    return numSequenceEvents > 0;
+    return sequenceEvents.size() > 0;
 }
 
 bool Clip::hasJustStoppedRecording()
@@ -375,22 +460,21 @@ void Clip::setClipLengthToGlobalFixedLength()
 
 void Clip::clearClipSequence()
 {
-    // Removes all sequence events from VT
-    for (int i=state.getNumChildren() - 1; i>=0; i--){
-        auto child = state.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            state.removeChild(i, nullptr);
-        }
-    }
+    // Removes all sequence events (this also removes them from VT)
+    const juce::ScopedLock sl (sequenceEditsLock);
+    sequenceEvents.clear();
+    sequenceNeedsUpdate = true;
     
     // Send note off messages for notes being played
     shouldSendRemainingNotesOff = true;
+    notifyNeedsProcessing();
 }
 
 void Clip::clearClip()
 {
     // NOTE: this should NOT be called from RT thread
     clearClipSequence();
+    removeAllAutomationLanes();
     
     // Also sets new length to 0.0 (and this will strigger stopping the clip and clearing queues)
     setClipLength(0.0);
@@ -401,18 +485,18 @@ void Clip::doubleSequence()
     // NOTE: this should NOT be called from RT thread
     
     // Makes the midi sequence twice as long and duplicates existing events in the second repetition of it
+    const juce::ScopedLock sl (sequenceEditsLock);
     saveToUndoStack();
     
-    // Iterate over all sequence events and re-add them at the end with doubled length
-    int numChildrenBeforeDoubling = state.getNumChildren();
-    for (int i=0; i<numChildrenBeforeDoubling; i++){
-        auto child = state.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            auto childAtDoubleTime = child.createCopy();
-            childAtDoubleTime.setProperty(ShepherdIDs::timestamp, (double)child.getProperty(ShepherdIDs::timestamp) + clipLengthInBeats, nullptr);
-            state.addChild(childAtDoubleTime, -1, nullptr);
-        }
+    // Copy all sequence events and re-add them at the end with doubled length
+    std::vector<SequenceEventRecord> eventsAtDoubleTime = sequenceEvents.getRecords();
+    for (auto& eventAtDoubleTime: eventsAtDoubleTime){
+        eventAtDoubleTime.uuid = UuidKey::createNew();
+        eventAtDoubleTime.timestamp += clipLengthInBeats;
     }
+    sequenceEvents.addAll(eventsAtDoubleTime);
+    sequenceNeedsUpdate = true;
+    doubleAutomationLanes();
     setClipLength(clipLengthInBeats * 2);
 }
 
@@ -421,25 +505,40 @@ void Clip::saveToUndoStack()
 {
     // NOTE: this should NOT be called from RT thread
     
-    // Add copy of clip state to the undo stack
-    // If more than X elements are added to the stack, remove the older ones
-    updateStateMemberVersions(); // Make sure state member versions are updated before adding to stack as ShepherdIDs::clipLengthInBeats will be needed when undoing
-    midiSequenceAndClipLengthUndoStack.push_back(state.createCopy());
-    if (midiSequenceAndClipLengthUndoStack.size() > allowedUndoLevels){
-        midiSequenceAndClipLengthUndoStack.erase(midiSequenceAndClipLengthUndoStack.begin());
-    }
+    // Add a checkpoint to the undo history. Changes made to the sequence events after this point will be reverted
+    // by the next undo. Older undo levels are discarded if the configured levels or memory budget are exceeded.
+    GlobalSettingsStruct settings = getGlobalSettings();
+    undoHistory.setLimits(settings.clipUndoLevels, (size_t)juce::jmax(0, settings.clipUndoMemoryBudgetBytes));
+    undoHistory.addCheckpoint(clipLengthInBeats);
 }
 
 void Clip::undo()
 {
     // NOTE: this should NOT be called from RT thread
     
-    // Check if there are any contents available in the undo stack
-    // If there are, replace the relevant parts of the current state with the relevant parts of the saved state
-    if (midiSequenceAndClipLengthUndoStack.size() > 0){
-        auto newState = midiSequenceAndClipLengthUndoStack.back().createCopy();
-        replaceSequence(newState, newState.getProperty(ShepherdIDs::clipLengthInBeats));
-        midiSequenceAndClipLengthUndoStack.pop_back();
+    // Revert the changes made since the last checkpoint in the undo history (only the changed events are updated)
+    const juce::ScopedLock sl (sequenceEditsLock);
+    double newLength = clipLengthInBeats;
+    if (undoHistory.undo(sequenceEvents, newLength)){
+        sequenceNeedsUpdate = true;
+        shouldSendRemainingNotesOff = true;
+        notifyNeedsProcessing();
+        setClipLength(newLength);
+    }
+}
+
+void Clip::redo()
+{
+    // NOTE: this should NOT be called from RT thread
+    
+    // Re-apply the changes reverted by the last undo
+    const juce::ScopedLock sl (sequenceEditsLock);
+    double newLength = clipLengthInBeats;
+    if (undoHistory.redo(sequenceEvents, newLength)){
+        sequenceNeedsUpdate = true;
+        shouldSendRemainingNotesOff = true;
+        notifyNeedsProcessing();
+        setClipLength(newLength);
     }
 }
 
@@ -450,31 +549,23 @@ void Clip::quantizeSequence(double quantizationStep)
 }
 
 void Clip::replaceSequence(juce::ValueTree newSequence, double newLength)
+{
+    // NOTE: this should NOT be called from RT thread
+    replaceSequenceEvents(SequenceEventStore::recordsFromClipState(newSequence), newLength);
+}
+
+void Clip::replaceSequenceEvents(const std::vector<SequenceEventRecord>& newSequenceEvents, double newLength)
 {
     // NOTE: this should NOT be called from RT thread
     
-    // First remove all sequence events
-    for (int i=0; i<state.getNumChildren(); i++){
-        auto child = state.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            state.removeChild(i, nullptr);
-            i = i-1;
-        }
-    }
+    // Replace all sequence events (this also replaces the SEQUENCE_EVENT children of the VT)
+    // The lock makes sure the sequence is not re-created until all events have been replaced
+    const juce::ScopedLock sl (sequenceEditsLock);
+    sequenceEvents.replaceAll(newSequenceEvents);
+    sequenceNeedsUpdate = true;
     
     shouldSendRemainingNotesOff = true;
-    
-    // Now add the new sequence events to the clip
-    int count = 0;
-    for (int i=0; i<newSequence.getNumChildren(); i++){
-        auto child = newSequence.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            auto childToAdd = child.createCopy();
-            state.addChild(childToAdd, -1, nullptr);
-            count += 1;
-        }
-    }
-    numSequenceEvents = count;
+    notifyNeedsProcessing();
     
     // Finally replace length
     setClipLength(newLength);
@@ -534,8 +625,38 @@ void Clip::prepareSlice()
     // Pull MIDI sequence from the FIFO
     ClipSequence::Ptr t;
     while( clipSequenceObjectsFifo.pull(t) ) { ; }
-    if( t != nullptr )
+    if( t != nullptr ){
         clipSequenceForRTThread = t;
+        lastRenderedAutomationValues.fill(-1);  // Automation lanes might have changed, render their current values again
+    }
+}
+
+/** Returns true if the clip needs to be processed in the current slice (e.g. it is playing, cued to play in this slice,
+ recording or has pending note offs or sequences). Idle clips are not processed, see Track::clipsPrepareSlice. Clips cued to
+ play in a later slice don't need processing until then, see CueScheduler. Called from the RT thread.
+ */
+bool Clip::needsProcessing()
+{
+    return shouldSendRemainingNotesOff ||
+           clipSequenceObjectsFifo.getNumAvailableForReading() > 0 ||
+           playhead->isPlaying() ||
+           (playhead->isCuedToPlay() && playhead->getPlayAtCueBeats() < playhead->getParentSlice().getEnd()) ||
+           playhead->isCuedToStop() ||
+           playhead->hasJustStoppedFlagSet() ||
+           recording ||
+           isCuedToStartRecording() ||
+           isCuedToStopRecording() ||
+           hasJustStoppedRecordingFlag;
+}
+
+/** Re-creates the sequence immediately (instead of waiting for the timer) and makes it the one used by the RT thread
+ This should only be called when the clip is not yet being processed by the RT thread (e.g. when preloading a session)
+ */
+void Clip::recreateSequenceNow()
+{
+    recreateSequenceAndAddToFifo();
+    sequenceNeedsUpdate = false;
+    prepareSlice();
 }
 
 /** Process the current slice of the global playhead to tigger notes that this clip should be playing (if any) and/or record incoming notes to the clip recording sequence (if any).
@@ -553,7 +674,7 @@ void Clip::prepareSlice()
  3) Trigger clip start if clip should start playing in this slice.
  
  4) If clip is playing (or was just triggered to start playing), trigger any notes of the clip's MIDI sequence that should be triggerd in this slice. This step takes into consideration clip's
- start and stop cue times to make sure no notes are added to "bufferToFill" which should not be added.
+ start and stop cue times to make sure no notes are added to "bufferToFill" which should not be added. Automation lanes are also rendered in this step.
  
  5) If clip is playing, make some checks about start/stop recording cue times and store them in variables that will be useful later for making comparissons.
  
@@ -582,6 +703,8 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
 {
     // 1) -------------------------------------------------------------------------------------------------
     
+    shouldUpdateInMessageThread = true;  // Playhead position, cues, recorded notes, etc. might change while processing the slice
+    
     if (shouldSendRemainingNotesOff){
         renderRemainingNoteOffsIntoMidiBuffer(bufferToFill);
         shouldSendRemainingNotesOff = false;
@@ -628,87 +751,53 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
         // true because start playing cue has already been updated. In this case, we take care of not triggering
         // notes that should happen before the start time cue. Similarly, if the clip is cued to stop in this slice,
         // playhead->isPlaying() will also be true but we make sure that we don't add notes that would happen after
-        // stop time cue. Note that some things like note quantization (if any), clip length adjustment, matched note
-        // on/offs, etc., are already rendered in the sequence.
-        for (int i=0; i < sequenceToRender.getNumEvents(); i++){
-            juce::MidiMessage& msg = sequenceToRender.getEventPointer(i)->message;
-            SequenceEventAnnotations* eventAnnotations = clipSequenceForRTThread->annotations[i];  // Note this could be nullptr
-
-            double eventPositionInBeats = msg.getTimeStamp();
-            if (loopingInThisSlice && eventPositionInBeats < sliceInBeats.getStart()){
-                // If we're looping and the event position is before the start of the slice, make checks using looped version
-                // of the event position to account for the case in which event would fall inside the looped slice
-                // See example:
-                // Clip notes:      [x---------------][x------ ...
-                // Playhead slices: |s0  |s1  |s2  |s3  |s4  |...
-                // The clip example above has only one note at the very start of it. In slice 0 (s0), the note will be correctly
-                // triggered because it's starting time will be coantined in slice 0. However, the looping of the clip falls
-                // in slice 3 (s3), and in that case the slice will start have a range that goes beyond the clip length time
-                // (e.g. if clip has length 16.0, this could be 14.0-18.0). Therefore to correctly trigger the note at the start
-                // of the clip repetition, we need to check if it is inside the slice by adding the clip length to it (checking
-                // for the "looped" version).
-                // Note that to make the above example easier we use slice sizes which are much bigger than what they'll really
-                // be in the real app
-                eventPositionInBeats += clipSequenceForRTThread->lengthInBeats;
+        // stop time cue (see renderSequenceEventInSlice). Note that some things like note quantization (if any), clip
+        // length adjustment, matched note on/offs, etc., are already rendered in the sequence.
+        // If lookahead rendering is enabled, the events of the slice are taken from the events pre-rendered by the
+        // LookaheadRenderer thread instead of iterating over the whole sequence (unless these are not available yet).
+        juce::Range<double> playingRangeInGlobalBeats = {isCuedToPlayInThisSlice ? willStartPlayingAtGlobalBeats : std::numeric_limits<double>::lowest(),
+                                                         isCuedToStopInThisSlice ? willStopPlayingAtGlobalBeats : std::numeric_limits<double>::max()};
+        LookaheadRenderer* lookaheadRenderer = getGlobalSettings().lookaheadRenderer;
+        if (lookaheadRenderer == nullptr){
+            releaseLookaheadSlot();
+        } else if (lookaheadSlot == nullptr){
+            lookaheadSlot = lookaheadRenderer->claimSlot();
+        }
+        
+        if (lookaheadSlot != nullptr && lookaheadSlot->getEventsInSlice(clipSequenceForRTThread.get(), sliceInBeats)){
+            for (auto& event: lookaheadSlot->getSliceEvents()){
+                renderSequenceEventInSlice(event.message, event.chance, event.beats, playingRangeInGlobalBeats, bufferToFill);
             }
-
-            if (sliceInBeats.contains(eventPositionInBeats))
-            {
-                double eventPositionInSliceInBeats = eventPositionInBeats - sliceInBeats.getStart();                
-                double eventPositionInGlobalPlayheadInBeats = eventPositionInSliceInBeats + playhead->getParentSlice().getStart();
-                if (isCuedToStopInThisSlice && eventPositionInGlobalPlayheadInBeats >= willStopPlayingAtGlobalBeats){
-                    // Case in which the current event of the sequence falls inside the current slice but the clip is
-                    // cued to stop at some point in the middle of the slice and the current event happens after that
-                } else if (isCuedToPlayInThisSlice && eventPositionInGlobalPlayheadInBeats < willStartPlayingAtGlobalBeats) {
-                    // Case in which the current event of the sequence falls inside the current slice but the clip is only
-                    // cued to start at some point in the middle of the slice and the current event happens before that
-                } else {
-                    // Normal case in which notes should be triggered
-                    
-                    // Check if note should be triggered depending on the chance parameter
-                    // Compute chance values for events of type "note on" when the chance property is lower than 1.0,
-                    // otherwise there is no need to compute the chance as notes will allways be played
-                    // Because note on and note off pairs will refer to the same SequenceEventAnnotations*
-                    // object, when the chance is compute for the note on is the same chance value for the
-                    // corresponding note off
-                    if (eventAnnotations != nullptr && msg.isNoteOn() && eventAnnotations->chance < 1.0){
-                        eventAnnotations->lastComputedChance = juce::Random::getSystemRandom().nextFloat();
-                    }
-                    // If the last computed chance is above the event chance, then skip this message
-                    // as it should not be rendered in the buffer
-                    // NOTE that events for which "chance" does not make sense, will have set eventAnnotations->chance to
-                    // 1.0 and eventAnnotations->lastComputedChance to 0.0 by default
-                    if (eventAnnotations != nullptr && eventAnnotations->lastComputedChance > eventAnnotations->chance) {
-                        continue;
-                    }
-
-                    // Calculate note position for the MIDI buffer (in samples)
-                    int eventPositionInSliceInSamples = eventPositionInSliceInBeats * (int)std::round(60.0 * getGlobalSettings().sampleRate / getClipBpm());
-                    jassert(juce::isPositiveAndBelow(eventPositionInSliceInSamples, getGlobalSettings().samplesPerSlice));
-                    
-                    // Re-write MIDI channel to use track's configured device, and add note to the buffer
-                    int midiOutputChannel = getTrackSettings().midiOutChannel;
-                    if (midiOutputChannel > -1){
-                        msg.setChannel(midiOutputChannel);
-                        if (bufferToFill != nullptr) bufferToFill->addEvent(msg, eventPositionInSliceInSamples);
-                    }
-                    
-                    // If the message is of type controller, also update the internal stored state of the controller
-                    if (msg.isController()){
-                        auto device = getTrackSettings().outputHwDevice;
-                        if (device != nullptr){
-                            device->setMidiCCParameterValue(msg.getControllerNumber(), msg.getControllerValue());
-                        }
-                    }
-                    
-                    // Keep track of notes currently played so later we can send note offs if needed (also store sustain pedal state)
-                    if      (msg.isNoteOn())  notesCurrentlyPlayed.setBit(msg.getNoteNumber(), true);
-                    else if (msg.isNoteOff()) notesCurrentlyPlayed.setBit(msg.getNoteNumber(), false);
-                    if      (msg.isController() && msg.getControllerName(MIDI_SUSTAIN_PEDAL_CC) && msg.getControllerValue() > 0)  sustainPedalBeingPressed = true;
-                    else if (msg.isController() && msg.getControllerName(MIDI_SUSTAIN_PEDAL_CC) && msg.getControllerValue() == 0) sustainPedalBeingPressed = false;
+        } else {
+            for (int i=0; i < sequenceToRender.getNumEvents(); i++){
+                const juce::MidiMessage& msg = sequenceToRender.getEventPointer(i)->message;
+                SequenceEventAnnotations* eventAnnotations = clipSequenceForRTThread->annotations[i].get();  // Note this could be nullptr
+                
+                double eventPositionInBeats = msg.getTimeStamp();
+                if (loopingInThisSlice && eventPositionInBeats < sliceInBeats.getStart()){
+                    // If we're looping and the event position is before the start of the slice, make checks using looped version
+                    // of the event position to account for the case in which event would fall inside the looped slice
+                    // See example:
+                    // Clip notes:      [x---------------][x------ ...
+                    // Playhead slices: |s0  |s1  |s2  |s3  |s4  |...
+                    // The clip example above has only one note at the very start of it. In slice 0 (s0), the note will be correctly
+                    // triggered because it's starting time will be coantined in slice 0. However, the looping of the clip falls
+                    // in slice 3 (s3), and in that case the slice will start have a range that goes beyond the clip length time
+                    // (e.g. if clip has length 16.0, this could be 14.0-18.0). Therefore to correctly trigger the note at the start
+                    // of the clip repetition, we need to check if it is inside the slice by adding the clip length to it (checking
+                    // for the "looped" version).
+                    // Note that to make the above example easier we use slice sizes which are much bigger than what they'll really
+                    // be in the real app
+                    eventPositionInBeats += clipSequenceForRTThread->lengthInBeats;
+                }
+                
+                if (sliceInBeats.contains(eventPositionInBeats)){
+                    float chance = eventAnnotations != nullptr ? eventAnnotations->chance : 1.0f;
+                    renderSequenceEventInSlice(msg, chance, eventPositionInBeats - sliceInBeats.getStart(), playingRangeInGlobalBeats, bufferToFill);
                 }
             }
         }
+        renderAutomationLanesInSlice(sliceInBeats, playingRangeInGlobalBeats, bufferToFill);
         
         // 5) -------------------------------------------------------------------------------------------------
         
@@ -738,13 +827,15 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
             startRecordingNow();
             
             for (auto msg: lastMidiNoteOnMessages){
+                if (recordedMidiMessages.load() == nullptr){
+                    break;
+                }
                 double startRecordingTimeBeatPositionInGlobalPlayhead = playhead->getParentSlice().getStart() + willStartRecordingAtClipPlayheadBeats - sliceInBeats.getStart();
                 double beatsBeforeStartRecordingTimeOfCurrentMessage = startRecordingTimeBeatPositionInGlobalPlayhead - msg.getTimeStamp();
                 if ((beatsBeforeStartRecordingTimeOfCurrentMessage > 0) && (beatsBeforeStartRecordingTimeOfCurrentMessage < preRecordingBeatsThreshold)){
                     // If the event time happened in the last 1/4 before the recording start position, quantize it to the start
                     // position (beat 0.0) and add it to the recorded midi sequence
-                    msg.setTimeStamp(0.0);
-                    recordedMidiMessages.push(msg);
+                    pushRecordedMidiMessage(msg, 0.0);
                 } else {
                     // If event time is equal or after the start recording time, we ignore it as it will be recorded while iterating
                     // incommingBuffer in the next step (7)
@@ -758,7 +849,7 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
         // If the clip only started recording in that slice, make sure we don't add notes that happen before the recording start time cue.
         // Also, if the clip should stop recording in that slice, make sure we don't add notes that happen after the recording stop time cue.
         
-        if (recording){
+        if (recording && recordedMidiMessages.load() != nullptr){
             for (const auto metadata : incommingBuffer)
             {
                 auto msg = metadata.getMessage();
@@ -776,13 +867,7 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
                         // that case we don't want to record the event.
                     } else {
                         // Case in which note should be recorded :)
-                        msg.setTimeStamp(eventPositionInBeats);
-                        recordedMidiMessages.push(msg);
-                        
-                        if (recordedMidiMessages.getAvailableSpace() < 10){
-                            DBG("WARNING, recording fifo for clip " << getName() << " getting close to full or full");
-                            DBG("- Available space: " << clipSequenceObjectsFifo.getAvailableSpace() << ", available for reading: " << clipSequenceObjectsFifo.getNumAvailableForReading());
-                        }
+                        pushRecordedMidiMessage(msg, eventPositionInBeats);
                     }
                 }
             }
@@ -803,6 +888,9 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
         
         if ((clipSequenceForRTThread->lengthInBeats > 0.0) && (sliceInBeats.contains(clipSequenceForRTThread->lengthInBeats) || clipSequenceForRTThread->lengthInBeats < sliceInBeats.getStart())){
             playhead->resetSlice(clipSequenceForRTThread->lengthInBeats - sliceInBeats.getEnd());
+            if (lookaheadSlot != nullptr && loopingInThisSlice){
+                lookaheadSlot->notifyClipLooped(clipSequenceForRTThread->lengthInBeats);
+            }
         }
         
         // ----------------------------------------------------------------------------------------------------
@@ -827,6 +915,8 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
     
     if (playhead->hasJustStopped()){
         renderRemainingNoteOffsIntoMidiBuffer(bufferToFill);
+        releaseLookaheadSlot();
+        lastRenderedAutomationValues.fill(-1);
     }
     
     // 12) -------------------------------------------------------------------------------------------------
@@ -847,6 +937,143 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
     }
 }
 
+/** Adds an event of the sequence to the MIDI buffer (if it should be played), updating the state of the notes being played.
+    @param msg                                  MIDI message of the event (channel will be re-written)
+    @param chance                              Probability of the event being played (only used for note on messages)
+    @param eventPositionInSliceInBeats  Position of the event relative to the start of the clip playhead slice
+    @param playingRangeInGlobalBeats    Range of the global playhead in which the clip is playing during this slice
+    @param bufferToFill                        MIDI buffer to be filled with notes triggered by this clip
+ */
+void Clip::renderSequenceEventInSlice(juce::MidiMessage msg, float chance, double eventPositionInSliceInBeats, juce::Range<double> playingRangeInGlobalBeats, juce::MidiBuffer* bufferToFill)
+{
+    double eventPositionInGlobalPlayheadInBeats = eventPositionInSliceInBeats + playhead->getParentSlice().getStart();
+    if (!playingRangeInGlobalBeats.contains(eventPositionInGlobalPlayheadInBeats)){
+        // Case in which the current event of the sequence falls inside the current slice but the clip is cued to stop at
+        // some point in the middle of the slice and the current event happens after that, or the clip is only cued to start
+        // at some point in the middle of the slice and the current event happens before that
+        return;
+    }
+    
+    // Check if note should be triggered depending on the chance parameter
+    // Compute chance values for events of type "note on" when the chance property is lower than 1.0,
+    // otherwise there is no need to compute the chance as notes will allways be played
+    // The result is stored per clip and note number (annotations can be shared by several clips so
+    // these are never modified) so that the corresponding note off is skipped as well
+    // NOTE that events for which "chance" does not make sense, will have chance set to 1.0
+    if (msg.isNoteOn()){
+        bool skipNote = chance < 1.0 && random.nextFloat() > chance;
+        notesSkippedByChance.setBit(msg.getNoteNumber(), skipNote);
+        if (skipNote) {
+            return;
+        }
+    } else if (msg.isNoteOff() && notesSkippedByChance[msg.getNoteNumber()]){
+        notesSkippedByChance.setBit(msg.getNoteNumber(), false);
+        return;
+    }
+    
+    // Calculate note position for the MIDI buffer (in samples)
+    int eventPositionInSliceInSamples = eventPositionInSliceInBeats * (int)std::round(60.0 * getGlobalSettings().sampleRate / getClipBpm());
+    jassert(juce::isPositiveAndBelow(eventPositionInSliceInSamples, getGlobalSettings().samplesPerSlice));
+    
+    // Re-write MIDI channel to use track's configured device, and add note to the buffer
+    int midiOutputChannel = getTrackSettings().midiOutChannel;
+    if (midiOutputChannel > -1){
+        msg.setChannel(midiOutputChannel);
+        if (bufferToFill != nullptr) bufferToFill->addEvent(msg, eventPositionInSliceInSamples);
+    }
+    
+    // NOTE: if the message is of type controller, the internal stored state of the controller in the output device is
+    // updated when the track buffer is written to the device (see Track::writeLastSliceMidiBufferToHardwareDeviceMidiBuffer)
+    
+    // Keep track of notes currently played so later we can send note offs if needed (also store sustain pedal state)
+    if      (msg.isNoteOn())  notesCurrentlyPlayed.setBit(msg.getNoteNumber(), true);
+    else if (msg.isNoteOff()) notesCurrentlyPlayed.setBit(msg.getNoteNumber(), false);
+    if      (msg.isController() && msg.getControllerName(MIDI_SUSTAIN_PEDAL_CC) && msg.getControllerValue() > 0)  sustainPedalBeingPressed = true;
+    else if (msg.isController() && msg.getControllerName(MIDI_SUSTAIN_PEDAL_CC) && msg.getControllerValue() == 0) sustainPedalBeingPressed = false;
+}
+
+/** Samples the automation lanes of the clip at automationPointsPerSlice equally spaced positions of the slice and adds a
+ MIDI message to the buffer whenever the quantized value of a lane changes.
+    @param sliceInBeats                        Slice of the clip playhead
+    @param playingRangeInGlobalBeats    Range of the global playhead in which the clip is playing during this slice
+    @param bufferToFill                        MIDI buffer to be filled with the automation messages
+ */
+void Clip::renderAutomationLanesInSlice(juce::Range<double> sliceInBeats, juce::Range<double> playingRangeInGlobalBeats, juce::MidiBuffer* bufferToFill)
+{
+    const std::vector<AutomationLane>& automationLanes = clipSequenceForRTThread->automationLanes;
+    if (automationLanes.size() == 0){
+        return;
+    }
+    double lengthInBeats = clipSequenceForRTThread->lengthInBeats;
+    int numPoints = getGlobalSettings().automationPointsPerSlice;
+    double pointSpacingInBeats = sliceInBeats.getLength() / (double)numPoints;
+    for (int i=0; i<numPoints; i++){
+        double pointPositionInSliceInBeats = i * pointSpacingInBeats;
+        if (!playingRangeInGlobalBeats.contains(pointPositionInSliceInBeats + playhead->getParentSlice().getStart())){
+            continue;
+        }
+        double pointPositionInClipInBeats = sliceInBeats.getStart() + pointPositionInSliceInBeats;
+        if (lengthInBeats > 0.0 && pointPositionInClipInBeats >= lengthInBeats){
+            // Clip loops in this slice, sample the curve at the looped position
+            pointPositionInClipInBeats -= lengthInBeats;
+        }
+        for (int j=0; j<(int)automationLanes.size(); j++){
+            int value = automationLanes[j].getQuantizedValueAt(pointPositionInClipInBeats);
+            if (value != lastRenderedAutomationValues[j]){
+                lastRenderedAutomationValues[j] = value;
+                renderSequenceEventInSlice(automationLanes[j].createMidiMessage(value), 1.0f, pointPositionInSliceInBeats, playingRangeInGlobalBeats, bufferToFill);
+            }
+        }
+    }
+}
+
+void Clip::releaseLookaheadSlot()
+{
+    // NOTE: the slot is only released here (RT thread) or when the clip is deleted (message thread, no longer processed by the RT thread)
+    if (lookaheadSlot != nullptr){
+        lookaheadSlot->release();
+        lookaheadSlot = nullptr;
+    }
+}
+
+
+void Clip::allocateRecordedMidiMessagesFifo()
+{
+    // NOTE: this should NOT be called from RT thread
+    // The fifo is never de-allocated once created and it is only published to the RT thread after it has been fully constructed
+    if (ownedRecordedMidiMessages == nullptr){
+        ownedRecordedMidiMessages = std::make_unique<RecordedMidiMessagesFifo>();
+        recordedNoteOnMessagesPendingToAdd.reserve(128);
+        recordedMidiMessages = ownedRecordedMidiMessages.get();
+    }
+}
+
+void Clip::pushRecordedMidiMessage(const juce::MidiMessage& msg, double positionInBeats)
+{
+    // NOTE: this is called from the RT thread
+    // Messages longer than 3 bytes are never recorded (see addRecordedNotesToSequence). If the fifo is full the message is
+    // lost, this is counted so that it can be reported in the stats (see Sequencer::getStats).
+    if (msg.getRawDataSize() > 3){
+        return;
+    }
+    RecordedMidiMessage recordedMsg;
+    std::memcpy(recordedMsg.data, msg.getRawData(), (size_t)msg.getRawDataSize());
+    recordedMsg.numBytes = msg.getRawDataSize();
+    recordedMsg.positionInBeats = positionInBeats;
+    RecordedMidiMessagesFifo* fifo = recordedMidiMessages.load();
+    if (fifo == nullptr){
+        return;
+    }
+    if (fifo->push(recordedMsg)){
+        numRecordedMessages += 1;
+        int fifoUsage = fifo->getNumAvailableForReading();
+        if (fifoUsage > maxRecordingFifoUsage.load()){
+            maxRecordingFifoUsage = fifoUsage;
+        }
+    } else {
+        numDroppedRecordedMessages += 1;
+    }
+}
 
 void Clip::addRecordedNotesToSequence()
 {
@@ -855,38 +1082,69 @@ void Clip::addRecordedNotesToSequence()
     // addRecordedNotesToSequence. We only add a SEQUENCE_EVENT child when we receive
     // a note off message for a corresponding note on which was stored in
     // "recordedNoteOnMessagesPendingToAdd"
+    // All the events recorded since the last call are added to the sequence at once so the sequence
+    // is only modified (and re-created) once per call
     
-    juce::MidiMessage msg;
-    while (recordedMidiMessages.pull(msg)) {
-        if (msg.isNoteOn()){
+    RecordedMidiMessagesFifo* fifo = recordedMidiMessages.load();
+    if (fifo == nullptr){
+        return;
+    }
+    
+    recordedSequenceEventsToAdd.clear();
+    GlobalSettingsStruct globalSettings = getGlobalSettings();
+    recordedAutomationThinner.setTolerances(globalSettings.automationThinningValueTolerance, globalSettings.automationThinningTimeTolerance);
+    RecordedMidiMessage recordedMsg;
+    bool pulledRecordedMessages = false;
+    while (fifo->pull(recordedMsg)) {
+        pulledRecordedMessages = true;
+        juce::uint8 messageType = recordedMsg.data[0] & 0xF0;
+        bool isNoteOn = messageType == 0x90 && recordedMsg.data[2] > 0;
+        bool isNoteOff = messageType == 0x80 || (messageType == 0x90 && recordedMsg.data[2] == 0);
+        if (isNoteOn){
             // Save the message to the "recordedNoteOnMessagesPendingToAdd" of pending note on messages
             // that will persist consecutive calls to addRecordedNotesToSequence
-            recordedNoteOnMessagesPendingToAdd.push_back(msg);
-        } else if (msg.isNoteOff()){
+            recordedNoteOnMessagesPendingToAdd.push_back(recordedMsg);
+        } else if (isNoteOff){
             // Find the corresponding pending note on message from "recordedNoteOnMessagesPendingToAdd"
             // and create a new SEQUENCE_EVENT of type "note"
             for (int i=0; i<recordedNoteOnMessagesPendingToAdd.size(); i++){
-                if (recordedNoteOnMessagesPendingToAdd[i].getNoteNumber() == msg.getNoteNumber()){
+                const RecordedMidiMessage& noteOnMsg = recordedNoteOnMessagesPendingToAdd[i];
+                if (noteOnMsg.data[1] == recordedMsg.data[1]){
                     // Found corresponding note on message, create SEQUENCE_EVENT event and remove the note on message from "recordedNoteOnMessagesPendingToAdd"
-                    int midiNote = msg.getNoteNumber();
-                    float midiVelocity = recordedNoteOnMessagesPendingToAdd[i].getFloatVelocity();
-                    double timestamp = recordedNoteOnMessagesPendingToAdd[i].getTimeStamp();
+                    int midiNote = recordedMsg.data[1];
+                    float midiVelocity = noteOnMsg.data[2] / 127.0f;
+                    double timestamp = noteOnMsg.positionInBeats;
                     // TODO: is it a problem if we obtain negative durations?
-                    double duration = msg.getTimeStamp() - recordedNoteOnMessagesPendingToAdd[i].getTimeStamp();
+                    double duration = recordedMsg.positionInBeats - noteOnMsg.positionInBeats;
                     if (duration < 0.0){
                         // If duration is negative, add clip length as playhead will have wrapped
                         duration += clipLengthInBeats;
                     }
-                    state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(timestamp, midiNote, midiVelocity, duration), -1, nullptr);
+                    recordedSequenceEventsToAdd.push_back(SequenceEventStore::createNoteRecord(timestamp, midiNote, midiVelocity, duration));
                     recordedNoteOnMessagesPendingToAdd.erase(recordedNoteOnMessagesPendingToAdd.begin() + i);
                     break;
                 }
             }
-        } else if (msg.isAftertouch() || msg.isController() || msg.isChannelPressure() || msg.isPitchWheel() ){
-            // Save the message as SEQUENCE_EVENT of type "midi"
-            state.addChild(ShepherdHelpers::createSequenceEventFromMidiMessage(msg), -1, nullptr);
+        } else if (messageType == 0xA0 || messageType == 0xB0 || messageType == 0xD0 || messageType == 0xE0){
+            // Aftertouch, controller, channel pressure and pitch wheel messages are saved as SEQUENCE_EVENT of type "midi"
+            // (redundant points are removed if automation thinning is enabled)
+            recordedAutomationThinner.addPoint(recordedMsg.data, recordedMsg.numBytes, recordedMsg.positionInBeats, clipLengthInBeats, recordedSequenceEventsToAdd);
         }
     }
+    // Pending automation points are kept between calls (so thinning is the same regardless of how the recorded messages are
+    // batched), and are only added once their gesture ended or when recording stops
+    if (!isRecording()){
+        recordedAutomationThinner.flush(recordedSequenceEventsToAdd);
+        recordedAutomationThinner.reset();
+    } else if (pulledRecordedMessages){
+        recordedAutomationThinner.flushEndedGestures(recordedMsg.positionInBeats, clipLengthInBeats, recordedSequenceEventsToAdd);
+    }
+    
+    if (recordedSequenceEventsToAdd.size() > 0){
+        const juce::ScopedLock sl (sequenceEditsLock);
+        sequenceEvents.addAll(recordedSequenceEventsToAdd);
+        sequenceNeedsUpdate = true;
+    }
     
     if (!isRecording() && recordedNoteOnMessagesPendingToAdd.size() > 0){
         // If clip is no longer recording and there are still elements in recordedNoteOnMessagesPendingToAdd, clear them
@@ -1072,26 +1330,39 @@ int Clip::getIndexOfMatchingKeyUpInSequence(juce::MidiMessageSequence& sequence,
     return -1;
 }
 
-juce::ValueTree Clip::getSequenceEventWithUUID(const juce::String& uuid)
+void Clip::addSequenceEvent(const SequenceEventRecord& record)
 {
-    for (int i=state.getNumChildren() - 1; i>=0; i--){
-        auto child = state.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT) && child.getProperty(ShepherdIDs::uuid) == uuid){
-            return child;
-        }
+    // NOTE: this should NOT be called from RT thread
+    sequenceEvents.add(record);
+    sequenceNeedsUpdate = true;
+}
+
+bool Clip::editSequenceEventWithUUID(const juce::String& uuid, const juce::var& eventData)
+{
+    // NOTE: this should NOT be called from RT thread
+    // Updates the event with the given UUID with the properties in eventData, returns false if event does not exist
+    int index = sequenceEvents.indexOf(UuidKey::fromString(uuid));
+    if (index < 0){
+        return false;
     }
-    return juce::ValueTree();
+    SequenceEventRecord record = sequenceEvents[index];
+    SequenceEventStore::applyJsonEdit(record, eventData);
+    sequenceEvents.update(index, record);
+    sequenceNeedsUpdate = true;
+    return true;
 }
 
 void Clip::removeSequenceEventWithUUID(const juce::String& uuid)
 {
-    auto sequenceEvent = getSequenceEventWithUUID(uuid);
-    if (sequenceEvent.isValid()){
+    // NOTE: this should NOT be called from RT thread
+    int index = sequenceEvents.indexOf(UuidKey::fromString(uuid));
+    if (index > -1){
         int midiNote = -1;
-        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
-            midiNote = (int)sequenceEvent.getProperty(ShepherdIDs::midiNote);
+        if (sequenceEvents[index].type == SequenceEventType::note){
+            midiNote = sequenceEvents[index].midiNote;
         }
-        state.removeChild(sequenceEvent, nullptr);
+        sequenceEvents.remove(index);
+        sequenceNeedsUpdate = true;
         if (midiNote > -1){
             if (notesCurrentlyPlayed[midiNote] == true){
                 juce::MidiMessage msg = juce::MidiMessage::noteOff(getTrackSettings().outputHwDevice->getMidiOutputChannel(), midiNote, 0.0f);
@@ -1102,44 +1373,187 @@ void Clip::removeSequenceEventWithUUID(const juce::String& uuid)
     }
 }
 
+bool Clip::applySequenceEdits(const juce::Array<juce::var>& edits)
+{
+    // NOTE: this should NOT be called from RT thread
+    // Applies a list of edits with the same format as the ones of /clip/editSequence, eg:
+    // [{"action": "editEvent", "eventUUID": "356cbbdjgf...", "eventData": {"midiNote": 80}}, {"action": "removeEvent", ...}, ...]
+    // Edits are applied as a single transaction: if any of the edits is not valid (eg: refers to an event that does not
+    // exist), none of them is applied and the function returns false. The sequence will only be re-created once all
+    // edits have been applied.
+    const juce::ScopedLock sl (sequenceEditsLock);
+    
+    // First check that all edits are valid
+    std::unordered_set<UuidKey, UuidKeyHash> removedEventUUIDs;
+    for (auto& edit: edits){
+        juce::String editAction = edit["action"].toString();
+        if (editAction == "removeEvent" || editAction == "editEvent"){
+            UuidKey eventUUID = UuidKey::fromString(edit["eventUUID"].toString());
+            if (sequenceEvents.indexOf(eventUUID) < 0 || removedEventUUIDs.count(eventUUID) > 0){
+                return false;
+            }
+            if (editAction == "removeEvent"){
+                removedEventUUIDs.insert(eventUUID);
+            }
+        } else if (editAction == "addEvent"){
+            int eventType = (int)edit["eventData"]["type"];
+            if (eventType != SequenceEventType::note && eventType != SequenceEventType::midi){
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    
+    // Now apply them
+    for (auto& edit: edits){
+        juce::String editAction = edit["action"].toString();
+        if (editAction == "removeEvent"){
+            removeSequenceEventWithUUID(edit["eventUUID"].toString());
+        } else if (editAction == "editEvent"){
+            editSequenceEventWithUUID(edit["eventUUID"].toString(), edit["eventData"]);
+        } else if (editAction == "addEvent"){
+            addSequenceEvent(SequenceEventStore::createRecordFromJson(edit["eventData"]));
+        }
+    }
+    return true;
+}
+
+int Clip::getSequenceVersion()
+{
+    return sequenceEvents.getVersion();
+}
+
+void Clip::setAutomationLane(const juce::var& laneData)
+{
+    // NOTE: this should NOT be called from RT thread
+    // Adds a new automation lane or replaces the existing one with the same UUID (see ACTION_ADDRESS_CLIP_SET_AUTOMATION_LANE
+    // for the format of laneData). Changes in AUTOMATION_LANE children flag the sequence for update (see valueTreeChildAdded).
+    juce::String laneUUID = laneData["uuid"].toString();
+    juce::ValueTree automationLane;
+    int numAutomationLanes = 0;
+    for (auto child: state){
+        if (child.hasType(ShepherdIDs::AUTOMATION_LANE)){
+            numAutomationLanes += 1;
+            if (laneUUID != "" && child[ShepherdIDs::uuid].toString() == laneUUID){
+                automationLane = child;
+            }
+        }
+    }
+    std::vector<AutomationLane::Breakpoint> breakpoints = AutomationLane::breakpointsFromJson(laneData["breakpoints"]);
+    int controllerNumber = juce::jlimit(-1, 127, (int)laneData.getProperty("controllerNumber", -1));
+    if (automationLane.isValid()){
+        automationLane.setProperty(ShepherdIDs::controllerNumber, controllerNumber, nullptr);
+        automationLane.setProperty(ShepherdIDs::breakpoints, AutomationLane::serializeBreakpoints(breakpoints), nullptr);
+    } else if (numAutomationLanes < MAX_NUM_AUTOMATION_LANES){
+        automationLane = juce::ValueTree(ShepherdIDs::AUTOMATION_LANE);
+        if (laneUUID != ""){
+            automationLane.setProperty(ShepherdIDs::uuid, laneUUID, nullptr);
+        } else {
+            ShepherdHelpers::createUuidProperty(automationLane);
+        }
+        automationLane.setProperty(ShepherdIDs::controllerNumber, controllerNumber, nullptr);
+        automationLane.setProperty(ShepherdIDs::breakpoints, AutomationLane::serializeBreakpoints(breakpoints), nullptr);
+        state.addChild(automationLane, -1, nullptr);
+    } else {
+        DBG("WARNING, clip " << getName() << " already has the maximum number of automation lanes");
+    }
+}
+
+void Clip::removeAutomationLaneWithUUID(const juce::String& uuid)
+{
+    // NOTE: this should NOT be called from RT thread
+    for (int i=state.getNumChildren() - 1; i>=0; i--){
+        if (state.getChild(i).hasType(ShepherdIDs::AUTOMATION_LANE) && state.getChild(i)[ShepherdIDs::uuid].toString() == uuid){
+            state.removeChild(i, nullptr);
+        }
+    }
+}
+
+void Clip::removeAllAutomationLanes()
+{
+    // NOTE: this should NOT be called from RT thread
+    for (int i=state.getNumChildren() - 1; i>=0; i--){
+        if (state.getChild(i).hasType(ShepherdIDs::AUTOMATION_LANE)){
+            state.removeChild(i, nullptr);
+        }
+    }
+}
+
+void Clip::replaceAutomationLanesWithOnesFrom(const juce::ValueTree& otherClipState)
+{
+    // NOTE: this should NOT be called from RT thread
+    // Automation lanes get new UUIDs so that these are unique in the whole state
+    removeAllAutomationLanes();
+    for (auto child: otherClipState){
+        if (child.hasType(ShepherdIDs::AUTOMATION_LANE)){
+            juce::ValueTree automationLane = child.createCopy();
+            ShepherdHelpers::updateUuidProperty(automationLane);
+            state.addChild(automationLane, -1, nullptr);
+        }
+    }
+}
+
+void Clip::doubleAutomationLanes()
+{
+    // NOTE: this should NOT be called from RT thread
+    // Repeats the breakpoints of the automation lanes in the second half of the doubled clip. Two breakpoints are added at
+    // the current clip length so that the value jumps from the end of the first repetition to the start of the second one.
+    if (clipLengthInBeats <= 0.0){
+        return;
+    }
+    for (auto child: state){
+        if (!child.hasType(ShepherdIDs::AUTOMATION_LANE)){
+            continue;
+        }
+        AutomationLane lane = AutomationLane::fromValueTree(child);
+        if (lane.breakpoints.size() == 0){
+            continue;
+        }
+        std::vector<AutomationLane::Breakpoint> firstRepetition;
+        for (auto& breakpoint: lane.breakpoints){
+            if (breakpoint.beats < clipLengthInBeats){
+                firstRepetition.push_back(breakpoint);
+            }
+        }
+        std::vector<AutomationLane::Breakpoint> doubledBreakpoints = firstRepetition;
+        doubledBreakpoints.push_back({clipLengthInBeats, lane.getValueAt(clipLengthInBeats), 0.0f});
+        doubledBreakpoints.push_back({clipLengthInBeats, lane.getValueAt(0.0), 0.0f});
+        for (auto breakpoint: firstRepetition){
+            breakpoint.beats += clipLengthInBeats;
+            doubledBreakpoints.push_back(breakpoint);
+        }
+        child.setProperty(ShepherdIDs::breakpoints, AutomationLane::serializeBreakpoints(doubledBreakpoints), nullptr);
+    }
+}
+
 //==============================================================================
 
 void Clip::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasChanged, const juce::Identifier& property)
 {
-    // Eg: change in quantization or individual note property
+    // Eg: change in quantization or clip length
+    // Note that changes in individual sequence events are made through the SequenceEventStore, which already
+    // flags the sequence for update (SEQUENCE_EVENT children in the VT are only a projection of the store)
     if ((property == ShepherdIDs::currentQuantizationStep) ||
         (property == ShepherdIDs::clipLengthInBeats) ||
-        (property == ShepherdIDs::timestamp) ||
-        (property == ShepherdIDs::uTime) ||
-        (property == ShepherdIDs::chance) ||
-        (property == ShepherdIDs::midiNote) ||
-        (property == ShepherdIDs::duration) ||
-        (property == ShepherdIDs::eventMidiBytes) ||
-        (property == ShepherdIDs::midiVelocity)){
+        treeWhosePropertyHasChanged.hasType(ShepherdIDs::AUTOMATION_LANE)){
         sequenceNeedsUpdate = true;
     }
 }
 
 void Clip::valueTreeChildAdded (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenAdded)
 {
-    // Eg: new note added
-    sequenceNeedsUpdate = true;
-    
-    // Update "numSequenceEvents"
-    int count = 0;
-    for (auto child: state) { if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)) {count += 1;}}
-    numSequenceEvents = count;
+    // Automation lanes are compiled with the sequence
+    if (childWhichHasBeenAdded.hasType(ShepherdIDs::AUTOMATION_LANE)){
+        sequenceNeedsUpdate = true;
+    }
 }
 
 void Clip::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenRemoved, int indexFromWhichChildWasRemoved)
 {
-    // Eg: note removed
-    sequenceNeedsUpdate = true;
-    
-    // Update "numSequenceEvents"
-    int count = 0;
-    for (auto child: state) { if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)) {count += 1;}}
-    numSequenceEvents = count;
+    if (childWhichHasBeenRemoved.hasType(ShepherdIDs::AUTOMATION_LANE)){
+        sequenceNeedsUpdate = true;
+    }
 }
 
 void Clip::valueTreeChildOrderChanged (juce::ValueTree& parentTree, int oldIndex, int newIndex)
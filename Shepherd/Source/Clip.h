@@ -16,7 +16,10 @@
 #include "MusicalContext.h"
 #include "HardwareDevice.h"
 #include "Fifo.h"
-#include "ReleasePool.h"
+#include "SequenceEventStore.h"
+#include "SequenceEditHistory.h"
+#include "AutomationThinner.h"
+#include "AutomationLane.h"
 
 
 struct TrackSettingsStruct {
@@ -28,16 +31,18 @@ struct SequenceEventAnnotations: juce::ReferenceCountedObject
 {
     // Struct to store sequence event properties that are needed for rendering the 
     // sequence in Clip::processSlice method (for example to support the "chance" feature)
-    juce::String sequenceEventUUID = "";
+    // NOTE: annotations are not modified once created because the ClipSequence objects that hold them can be shared by
+    // several clips (see Clip::loadContentsFromOtherClip)
+    using Ptr = juce::ReferenceCountedObjectPtr<SequenceEventAnnotations>;
     float chance = 1.0;
-    float lastComputedChance = 0.0;
 };
 
 struct ClipSequence: juce::ReferenceCountedObject
 {
     using Ptr = juce::ReferenceCountedObjectPtr<ClipSequence>;
     double lengthInBeats = 0.0;
-    std::vector<SequenceEventAnnotations*> annotations;
+    std::vector<SequenceEventAnnotations::Ptr> annotations;
+    std::vector<AutomationLane> automationLanes;  // Rendered separately from the MIDI sequence (see Clip::renderAutomationLanesInSlice)
     juce::MidiMessageSequence midiSequence = {};
     juce::MidiMessageSequence& sequenceAsMidi() {
         // Using helper function here as in the future we might want to store sequences with another format other than MIDI
@@ -45,31 +50,186 @@ struct ClipSequence: juce::ReferenceCountedObject
     }
 };
 
-class Clip: protected juce::ValueTree::Listener,
-            private juce::Timer
+/** Process-wide cache of compiled ClipSequence objects, keyed by a hash of everything the compiled sequence depends on
+ (sequence events, automation lanes, clip length, quantization step and wrapEventsAcrossClipLoop). Clips with identical contents (eg: after
+ duplicating scenes, copying loops across tracks or undoing/redoing) share the same compiled sequence instead of compiling
+ their own. The cache holds a reference to every compiled sequence, so sequences are never deleted in the RT thread.
+ Sequences that are no longer used by any clip are evicted periodically from the message thread.
+ */
+class ClipSequenceCache: private juce::Timer
+{
+public:
+    struct Key
+    {
+        // Two independent 64-bit hashes to make collisions practically impossible
+        juce::uint64 a = 0;
+        juce::uint64 b = 0;
+        bool operator== (const Key& other) const { return a == other.a && b == other.b; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator() (const Key& key) const { return (size_t)(key.a ^ (key.b * 0x9e3779b97f4a7c15ULL)); }
+    };
+
+    ClipSequenceCache()
+    {
+        startTimer(1 * 1000);
+    }
+
+    ~ClipSequenceCache() override
+    {
+        stopTimer();
+    }
+
+    static Key computeKey(const std::vector<SequenceEventRecord>& records, const std::vector<AutomationLane>& automationLanes, double clipLengthInBeats, double quantizationStep, bool wrapEventsAcrossClipLoop)
+    {
+        // Records are combined with a sum so that the key does not depend on their order in the store. UUIDs are not
+        // part of the key as these are not used in the compiled sequence.
+        Key key;
+        for (auto& record: records){
+            juce::uint64 words[7] = {(juce::uint64)record.type, doubleBits(record.timestamp), doubleBits(record.uTime), (juce::uint64)record.midiNote, doubleBits(record.midiVelocity), doubleBits(record.duration), doubleBits(record.chance)};
+            if (record.type != SequenceEventType::note){
+                words[3] = (juce::uint64)record.numMidiBytes | ((juce::uint64)record.midiBytes[0] << 8) | ((juce::uint64)record.midiBytes[1] << 16) | ((juce::uint64)record.midiBytes[2] << 24);
+            }
+            key.a += hashWords(words, 7, 0x243f6a8885a308d3ULL);
+            key.b += hashWords(words, 7, 0x13198a2e03707344ULL);
+        }
+        // Automation lanes are combined in order as lane indexes are used when rendering them
+        for (auto& lane: automationLanes){
+            juce::uint64 laneWords[2] = {(juce::uint64)(lane.controllerNumber + 1), (juce::uint64)lane.breakpoints.size()};
+            key.a = hashWords(laneWords, 2, key.a);
+            key.b = hashWords(laneWords, 2, key.b);
+            for (auto& breakpoint: lane.breakpoints){
+                juce::uint64 words[3] = {doubleBits(breakpoint.beats), doubleBits(breakpoint.value), doubleBits(breakpoint.curve)};
+                key.a = hashWords(words, 3, key.a);
+                key.b = hashWords(words, 3, key.b);
+            }
+        }
+        juce::uint64 settingsWords[4] = {(juce::uint64)records.size(), doubleBits(clipLengthInBeats), doubleBits(quantizationStep), (juce::uint64)wrapEventsAcrossClipLoop};
+        key.a = hashWords(settingsWords, 4, key.a);
+        key.b = hashWords(settingsWords, 4, key.b);
+        return key;
+    }
+
+    ClipSequence::Ptr find(const Key& key)
+    {
+        const juce::ScopedLock sl (cacheLock);
+        auto it = sequences.find(key);
+        if (it != sequences.end()){
+            hits += 1;
+            return it->second;
+        }
+        misses += 1;
+        return nullptr;
+    }
+
+    void add(const Key& key, ClipSequence::Ptr clipSequence)
+    {
+        const juce::ScopedLock sl (cacheLock);
+        sequences[key] = clipSequence;
+        numEntries = (int)sequences.size();
+    }
+
+    ClipSequence::Ptr retain(const ClipSequence* clipSequence)
+    {
+        // Returns a reference to the given sequence if it is still in the cache (nullptr otherwise). This is used by threads
+        // which only know the pointer of a sequence used by the RT thread (see ClipLookaheadSlot), holding the lock makes
+        // sure the sequence is not evicted while the reference is taken. This is only called when a lookahead slot is
+        // restarted, so a linear search is fine here.
+        const juce::ScopedLock sl (cacheLock);
+        for (auto& entry: sequences){
+            if (entry.second.get() == clipSequence){
+                return entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    int getNumEntries() const { return numEntries.get(); }
+    juce::int64 getNumHits() const { return hits.get(); }
+    juce::int64 getNumMisses() const { return misses.get(); }
+    juce::int64 getNumEvictions() const { return evictions.get(); }
+
+    void timerCallback() override
+    {
+        // Remove sequences which are only referenced by the cache
+        const juce::ScopedLock sl (cacheLock);
+        for (auto it = sequences.begin(); it != sequences.end();){
+            if (it->second->getReferenceCount() <= 1){
+                it = sequences.erase(it);
+                evictions += 1;
+            } else {
+                ++it;
+            }
+        }
+        numEntries = (int)sequences.size();
+    }
+
+private:
+    std::unordered_map<Key, ClipSequence::Ptr, KeyHash> sequences;
+    juce::CriticalSection cacheLock;
+    juce::Atomic<int> numEntries { 0 };
+    juce::Atomic<juce::int64> hits { 0 };
+    juce::Atomic<juce::int64> misses { 0 };
+    juce::Atomic<juce::int64> evictions { 0 };
+
+    static juce::uint64 doubleBits(double value)
+    {
+        juce::uint64 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static juce::uint64 hashWords(const juce::uint64* words, int numWords, juce::uint64 seed)
+    {
+        // splitmix64-based mixing of the given words
+        juce::uint64 h = seed;
+        for (int i=0; i<numWords; i++){
+            h += words[i] + 0x9e3779b97f4a7c15ULL;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            h = h ^ (h >> 31);
+        }
+        return h;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ClipSequenceCache)
+};
+
+class ClipLookaheadSlot;  // Forward declaration, see LookaheadRenderer.h
+
+class Clip: protected juce::ValueTree::Listener
 {
 public:
     Clip(const juce::ValueTree& state,
          std::function<juce::Range<double>()> playheadParentSliceGetter,
          std::function<GlobalSettingsStruct()> globalSettingsGetter,
          std::function<TrackSettingsStruct()> trackSettingsGetter,
-         std::function<MusicalContext*()> musicalContextGetter
+         std::function<MusicalContext*()> musicalContextGetter,
+         std::function<void()> needsProcessingNotifier
          );
+    ~Clip();
     void loadStateFromOtherClipState(const juce::ValueTree& _state, bool replaceSequenceEventUUIDs);
+    void loadContentsFromOtherClip(Clip& otherClip, bool replaceSequenceEventUUIDs);
     void bindState();
     void updateStateMemberVersions();
     juce::ValueTree state;
     
     juce::String getUUID() { return uuid.get(); };
     juce::String getName() { return name.get(); };
-    void stopAsyncTimer(){stopTimer();};
+    void updateInMessageThread();
     
     double getLocalSliceLength();
     double getClipBpm();
     void prepareSlice();
+    void recreateSequenceNow();
     void processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* bufferToFill, juce::Array<juce::MidiMessage>& lastMidiNoteOnMessages);
     void renderRemainingNoteOffsIntoMidiBuffer(juce::MidiBuffer* bufferToFill);
     bool shouldSendRemainingNotesOff = false;
+    bool needsProcessing();
+    double getPlayAtCueBeats();
+    double cueScheduledAtBeats = -1.0;  // Position of the cue added to the CueScheduler for this clip (if any), only used in RT thread
     
     void playNow();
     void playNow(double sliceOffset);
@@ -96,8 +256,10 @@ public:
     void doubleSequence();
     void quantizeSequence(double quantizationStep);
     void replaceSequence(juce::ValueTree newSequence, double newLength);
+    void replaceSequenceEvents(const std::vector<SequenceEventRecord>& newSequenceEvents, double newLength);
     void resetPlayheadPosition();
     void undo();
+    void redo();
     
     double getPlayheadPosition();
     double getLengthInBeats();
@@ -114,8 +276,20 @@ public:
     bool hasSequenceEvents();
     int getNumSequenceEvents();
     
-    juce::ValueTree getSequenceEventWithUUID(const juce::String& uuid);
+    void addSequenceEvent(const SequenceEventRecord& record);
+    bool editSequenceEventWithUUID(const juce::String& uuid, const juce::var& eventData);
     void removeSequenceEventWithUUID(const juce::String& uuid);
+    bool applySequenceEdits(const juce::Array<juce::var>& edits);
+    int getSequenceVersion();
+    
+    void setAutomationLane(const juce::var& laneData);
+    void removeAutomationLaneWithUUID(const juce::String& uuid);
+    
+    // Recording stats (can be called from any thread)
+    juce::int64 getNumRecordedMessages() const { return numRecordedMessages.load(); }
+    juce::int64 getNumDroppedRecordedMessages() const { return numDroppedRecordedMessages.load(); }
+    int getMaxRecordingFifoUsage() const { return maxRecordingFifoUsage.load(); }
+    juce::int64 getNumThinnedAutomationPoints() const { return recordedAutomationThinner.getNumThinnedPoints(); }
     
 protected:
     
@@ -144,29 +318,61 @@ private:
     double willStartRecordingAt = ShepherdDefaults::willStopRecordingAt;
     double willStopRecordingAt = ShepherdDefaults::willStopRecordingAt;
     double currentQuantizationStep = ShepherdDefaults::currentQuantizationStep;
-    int numSequenceEvents = 0;
     double shouldUpdateClipLenthInTimerTo = -1.0;
     
     std::unique_ptr<Playhead> playhead;
     
+    // Rendering of sequence events
+    void renderSequenceEventInSlice(juce::MidiMessage msg, float chance, double eventPositionInSliceInBeats, juce::Range<double> playingRangeInGlobalBeats, juce::MidiBuffer* bufferToFill);
+    juce::Random random { juce::Random::getSystemRandom().nextInt64() };  // Per clip (instead of the shared system random) as tracks can be processed in parallel
+    ClipLookaheadSlot* lookaheadSlot = nullptr;  // Slot of the LookaheadRenderer used while the clip plays (if lookahead rendering is enabled), only used in RT thread
+    void releaseLookaheadSlot();
+    
+    // Rendering of automation lanes
+    void renderAutomationLanesInSlice(juce::Range<double> sliceInBeats, juce::Range<double> playingRangeInGlobalBeats, juce::MidiBuffer* bufferToFill);
+    std::array<int, MAX_NUM_AUTOMATION_LANES> lastRenderedAutomationValues;  // -1 if no value rendered yet, only used in RT thread
+    void replaceAutomationLanesWithOnesFrom(const juce::ValueTree& otherClipState);
+    void removeAllAutomationLanes();
+    void doubleAutomationLanes();
+    
     // Keep notes while recording
-    Fifo<juce::MidiMessage, 100> recordedMidiMessages;
-    std::vector<juce::MidiMessage> recordedNoteOnMessagesPendingToAdd = {};
+    // The fifo is only allocated the first time the clip is armed to record so that clips which never record don't use that memory
+    struct RecordedMidiMessage
+    {
+        juce::uint8 data[3];
+        int numBytes;
+        double positionInBeats;
+    };
+    using RecordedMidiMessagesFifo = Fifo<RecordedMidiMessage, RECORDING_FIFO_SIZE>;
+    std::unique_ptr<RecordedMidiMessagesFifo> ownedRecordedMidiMessages;
+    std::atomic<RecordedMidiMessagesFifo*> recordedMidiMessages { nullptr };  // Published once ownedRecordedMidiMessages is allocated
+    void allocateRecordedMidiMessagesFifo();
+    void pushRecordedMidiMessage(const juce::MidiMessage& msg, double positionInBeats);
+    std::atomic<juce::int64> numRecordedMessages { 0 };
+    std::atomic<juce::int64> numDroppedRecordedMessages { 0 };  // Messages lost because the fifo was full
+    std::atomic<int> maxRecordingFifoUsage { 0 };
+    std::vector<RecordedMidiMessage> recordedNoteOnMessagesPendingToAdd = {};
+    std::vector<SequenceEventRecord> recordedSequenceEventsToAdd = {};  // Only used in addRecordedNotesToSequence, kept to reuse its memory
+    AutomationThinner recordedAutomationThinner;
     double hasJustStoppedRecordingFlag = false;
     double preRecordingBeatsThreshold = 0.20;  // When starting to record, if notes are played up to this amount before the recording start position, quantize them to the recording start position
     void addRecordedNotesToSequence();
     bool hasJustStoppedRecording();
     
-    std::vector<juce::ValueTree> midiSequenceAndClipLengthUndoStack;
-    int allowedUndoLevels = 5;
+    SequenceEventStore sequenceEvents;
+    juce::CriticalSection sequenceEditsLock;  // Held while applying batches of edits so the sequence is not re-created half way
+    
+    SequenceEditHistory undoHistory;
     void saveToUndoStack();
     bool shouldUndo = false;
     
     juce::BigInteger notesCurrentlyPlayed = 0;
+    juce::BigInteger notesSkippedByChance = 0;  // Notes whose last note on was skipped because of "chance" so their note off is skipped as well
     bool sustainPedalBeingPressed = false;
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<TrackSettingsStruct()> getTrackSettings;
     std::function<MusicalContext*()> getMusicalContext;
+    std::function<void()> notifyNeedsProcessing;  // Tells the track that this clip might need to be added to its active clips
     
     void clearAllCues();
     void stopClipNowAndClearAllCues();
@@ -180,82 +386,92 @@ private:
     void makeSureSequenceResetsPitchBend(juce::MidiMessageSequence& sequence);
     int getIndexOfMatchingKeyUpInSequence(juce::MidiMessageSequence& sequence, int index);
     
-    // Trigger re-creation of sequences and do other async tasks
-    void timerCallback() override;
+    // Set when there might be async tasks to do in updateInMessageThread (besides re-creating the sequence)
+    std::atomic<bool> shouldUpdateInMessageThread { true };
     
     // Real-time thread state sharing stuff
     void recreateSequenceAndAddToFifo() {
         
-        // Create sequence of MIDI messages by reading from SEQUENCE_EVENT elements in the state
+        // Create sequence of MIDI messages by reading from the sequence event records
         double quantizationStep = currentQuantizationStep;
         
+        // If an identical sequence was already compiled (by this or by another clip), it will be re-used and only the
+        // rendered timestamps of the events will be updated
+        std::vector<AutomationLane> automationLanes = AutomationLane::allFromClipState(state);
+        ClipSequenceCache::Key cacheKey = ClipSequenceCache::computeKey(sequenceEvents.getRecords(), automationLanes, clipLengthInBeats, quantizationStep, wrapEventsAcrossClipLoop);
+        ClipSequence::Ptr cachedClipSequence = compiledSequenceCache->find(cacheKey);
+        
         juce::MidiMessageSequence midiSequence;
-        std::vector<std::pair<juce::MidiMessage, SequenceEventAnnotations*>> rawAnnotations;
-        for (int i=0; i<state.getNumChildren(); i++){
-            auto sequenceEvent = state.getChild(i);
-            if (sequenceEvent.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-                bool shouldRenderEvent = true;
+        std::vector<std::pair<juce::MidiMessage, SequenceEventAnnotations::Ptr>> rawAnnotations;
+        juce::MidiMessage eventMessages[2];
+        for (int i=0; i<sequenceEvents.size(); i++){
+            const SequenceEventRecord& sequenceEvent = sequenceEvents[i];
+            bool shouldRenderEvent = true;
+            
+            if (sequenceEvent.timestamp < clipLengthInBeats) {
+                // If event starts before clip length, this will be rendered as MIDI message in the sequence
                 
-                if ((double)sequenceEvent.getProperty(ShepherdIDs::timestamp) < clipLengthInBeats) {
-                    // If event starts before clip length, this will be rendered as MIDI message in the sequence
-                    
-                    // Quantize the start time (add uTime to the start time)
-                    double originalStartTimestamp = (double)sequenceEvent.getProperty(ShepherdIDs::timestamp) + (double)sequenceEvent.getProperty(ShepherdIDs::uTime);
-                    if (originalStartTimestamp < 0.0){
-                        // If start time become negative because of uTime, make start of the event wrap
-                        originalStartTimestamp += clipLengthInBeats;
+                // Quantize the start time (add uTime to the start time)
+                double originalStartTimestamp = sequenceEvent.timestamp + sequenceEvent.uTime;
+                if (originalStartTimestamp < 0.0){
+                    // If start time become negative because of uTime, make start of the event wrap
+                    originalStartTimestamp += clipLengthInBeats;
+                }
+                double quantizedStartTimestamp = findNearestQuantizedBeatPosition(originalStartTimestamp, quantizationStep);
+                double quantizedEndTimestamp = -1.0;
+                
+                // If message is of type "note", we also need to calculate the quantized end time (note off)
+                // Note that we wrap the end position to be inside the clip length because we are sure that the
+                // start time of the event was already inside clip length. Another option would be to set the
+                // timestamp to the clip length itself, but then we would not be able to have notes that start
+                // in the middle of the clip and finish after the clip has looped
+                if (sequenceEvent.type == SequenceEventType::note) {
+                    if (wrapEventsAcrossClipLoop) {
+                        quantizedEndTimestamp = std::fmod(quantizedStartTimestamp + sequenceEvent.duration, clipLengthInBeats);
+                    } else {
+                        quantizedEndTimestamp = quantizedStartTimestamp + sequenceEvent.duration;
+                    }
+                    if (quantizedEndTimestamp >= clipLengthInBeats){
+                        // If end timestamp is beyond clip length and wrapEventsAcrossClipLoop is false, do not render event
+                        shouldRenderEvent = false;
+                    }
+                }
+                if (shouldRenderEvent){
+                    // Set computed properties, create annotation objects and render MIDI messages
+                    sequenceEvents.setRenderedTimestamps(i, quantizedStartTimestamp, quantizedEndTimestamp);
+                    if (cachedClipSequence != nullptr){
+                        continue;
                     }
-                    double quantizedStartTimestamp = findNearestQuantizedBeatPosition(originalStartTimestamp, quantizationStep);
-                    double quantizedEndTimestamp = -1.0;
                     
-                    // If message is of type "note", we also need to calculate the quantized end time (note off)
-                    // Note that we wrap the end position to be inside the clip length because we are sure that the
-                    // start time of the event was already inside clip length. Another option would be to set the
-                    // timestamp to the clip length itself, but then we would not be able to have notes that start
-                    // in the middle of the clip and finish after the clip has looped
-                    if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note) {
-                        double duration = sequenceEvent.getProperty(ShepherdIDs::duration);
-                        if (wrapEventsAcrossClipLoop) {
-                            quantizedEndTimestamp = std::fmod(quantizedStartTimestamp + duration, clipLengthInBeats);
-                        } else {
-                            quantizedEndTimestamp = quantizedStartTimestamp + duration;
-                        }
-                        if (quantizedEndTimestamp >= clipLengthInBeats){
-                            // If end timestamp is beyond clip length and wrapEventsAcrossClipLoop is false, do not render event
-                            shouldRenderEvent = false;
-                        }
+                    SequenceEventAnnotations::Ptr eventAnnotations = new SequenceEventAnnotations();
+                    if (sequenceEvent.type == SequenceEventType::note) {
+                        eventAnnotations->chance = sequenceEvent.chance;
                     }
-                    if (shouldRenderEvent){
-                        // Set computed properties, create annotation objects and render MIDI messages
-                        sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, quantizedStartTimestamp, nullptr);
-                        sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, quantizedEndTimestamp, nullptr);
-                        
-                        SequenceEventAnnotations* eventAnnotations = new SequenceEventAnnotations();
-                        eventAnnotations->sequenceEventUUID = sequenceEvent.getProperty(ShepherdIDs::uuid);
-                        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note) {
-                            eventAnnotations->chance = sequenceEvent.getProperty(ShepherdIDs::chance);
-                        }
-                        for (auto msg: ShepherdHelpers::eventValueTreeToMidiMessages(sequenceEvent)) {
-                            midiSequence.addEvent(msg);
-                            // Add the corresponding eventAnnotations object to the annotations list
-                            // We also need to add the event timestamp as this will be used to sort
-                            // the annotations vector and make sure it is aligned with the midi message
-                            // sequence
-                            rawAnnotations.push_back(std::make_pair(msg, eventAnnotations));
-                        }
+                    int numMessages = SequenceEventStore::recordToMidiMessages(sequenceEvent, quantizedStartTimestamp, quantizedEndTimestamp, eventMessages);
+                    for (int j=0; j<numMessages; j++) {
+                        midiSequence.addEvent(eventMessages[j]);
+                        // Add the corresponding eventAnnotations object to the annotations list
+                        // We also need to add the event timestamp as this will be used to sort
+                        // the annotations vector and make sure it is aligned with the midi message
+                        // sequence
+                        rawAnnotations.push_back(std::make_pair(eventMessages[j], eventAnnotations));
                     }
-                } else {
-                    shouldRenderEvent = false;
-                }
-                
-                if (!shouldRenderEvent){
-                    // If sequence event has timestamp above clip length, don't even render it as MIDI message
-                    sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, -1.0, nullptr);
-                    sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, -1.0, nullptr);
                 }
+            } else {
+                shouldRenderEvent = false;
+            }
+            
+            if (!shouldRenderEvent){
+                // If sequence event has timestamp above clip length, don't even render it as MIDI message
+                sequenceEvents.setRenderedTimestamps(i, -1.0, -1.0);
             }
         }
         
+        if (cachedClipSequence != nullptr){
+            addClipSequenceToFifo(cachedClipSequence);
+            return;
+        }
+        
         // Pre-process de MIDI sequence (update quantization, etc)
         preProcessSequence(midiSequence);
         
@@ -263,7 +479,7 @@ private:
         // sequence contents after preProcessSequence (and because MidiMessageSequence automatically sorts
         // MIDI messages). We do that by creating a new vector in which we sequentially add elements
         // from the old vector that correspond to the exact same midi message of the midi sequence.
-        std::vector<SequenceEventAnnotations*> annotations;
+        std::vector<SequenceEventAnnotations::Ptr> annotations;
         for (int i=0; i<midiSequence.getNumEvents(); i++){
             juce::MidiMessage targetMessage = midiSequence.getEventPointer(i)->message;
             bool messageFound = false;
@@ -286,9 +502,15 @@ private:
         clipSequenceObject->lengthInBeats = clipLengthInBeats;
         clipSequenceObject->midiSequence = midiSequence;
         clipSequenceObject->annotations = annotations;
+        clipSequenceObject->automationLanes = std::move(automationLanes);
 
-        clipSequenceObjectsReleasePool.add(clipSequenceObject);  // Add object to release pool so it is never deleted in the audio thread
+        compiledSequenceCache->add(cacheKey, clipSequenceObject);
+        addClipSequenceToFifo(clipSequenceObject);
+    }
+    void addClipSequenceToFifo(ClipSequence::Ptr clipSequenceObject) {
+        lastCreatedClipSequence = clipSequenceObject;
         clipSequenceObjectsFifo.push(clipSequenceObject);  // Add object to the fifo si it can be pulled from the audio thread (when MIDI messages are added to buffers)
+        notifyNeedsProcessing();
         
         if (clipSequenceObjectsFifo.getAvailableSpace() < 10){
             DBG("WARNING, fifo for clip " << getName() << " getting close to full or full");
@@ -296,7 +518,8 @@ private:
         }
     }
     Fifo<ClipSequence::Ptr, 20> clipSequenceObjectsFifo;
-    ReleasePool<ClipSequence> clipSequenceObjectsReleasePool; // ReleasePool<ClipSequence::Ptr> ?
+    juce::SharedResourcePointer<ClipSequenceCache> compiledSequenceCache;  // Also makes sure ClipSequence objects are never deleted in the audio thread
+    ClipSequence::Ptr lastCreatedClipSequence;  // Last sequence sent to the RT thread, only accessed from the message thread
     ClipSequence::Ptr clipSequenceForRTThread = new ClipSequence();
     bool sequenceNeedsUpdate = true;
     
@@ -309,14 +532,19 @@ struct ClipList: public drow::ValueTreeObjectList<Clip>
               std::function<juce::Range<double>()> playheadParentSliceGetter,
               std::function<GlobalSettingsStruct()> globalSettingsGetter,
               std::function<TrackSettingsStruct()> trackSettingsGetter,
-              std::function<MusicalContext*()> musicalContextGetter)
+              std::function<MusicalContext*()> musicalContextGetter,
+              std::function<void()> needsProcessingNotifier)
     : drow::ValueTreeObjectList<Clip> (v)
     {
         getPlayheadParentSlice = playheadParentSliceGetter;
         getGlobalSettings = globalSettingsGetter;
         getTrackSettings = trackSettingsGetter;
         getMusicalContext = musicalContextGetter;
+        notifyNeedsProcessing = needsProcessingNotifier;
         rebuildObjects();
+        for (auto* object: objects){
+            newObjectAdded(object);
+        }
     }
 
     ~ClipList()
@@ -335,31 +563,49 @@ struct ClipList: public drow::ValueTreeObjectList<Clip>
                          getPlayheadParentSlice,
                          getGlobalSettings,
                          getTrackSettings,
-                         getMusicalContext);
+                         getMusicalContext,
+                         notifyNeedsProcessing);
     }
 
     void deleteObject (Clip* c) override
     {
-        c->stopAsyncTimer();
         delete c;
     }
 
-    void newObjectAdded (Clip*) override    {}
-    void objectRemoved (Clip*) override     {}
+    void newObjectAdded (Clip* object) override
+    {
+        objectsByUuid[UuidKey::fromString(object->getUUID())] = object;
+    }
+    
+    void objectRemoved (Clip* object) override
+    {
+        objectsByUuid.erase(UuidKey::fromString(object->getUUID()));
+    }
+    
     void objectOrderChanged() override      {}
     
     Clip* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
+        auto* object = getObjectWithUUID(UuidKey::fromString(uuid));
+        if (object != nullptr && object->getUUID() == uuid){
+            return object;
         }
         return nullptr;
     }
     
+    Clip* getObjectWithUUID(const UuidKey& uuid) {
+        auto it = objectsByUuid.find(uuid);
+        if (it != objectsByUuid.end()){
+            return it->second;
+        }
+        return nullptr;
+    }
+    
+    std::unordered_map<UuidKey, Clip*, UuidKeyHash> objectsByUuid;  // Kept in sync with "objects" in newObjectAdded/objectRemoved
+    
     std::function<juce::Range<double>()> getPlayheadParentSlice;
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<TrackSettingsStruct()> getTrackSettings;
     std::function<MusicalContext*()> getMusicalContext;
+    std::function<void()> notifyNeedsProcessing;
 };
 
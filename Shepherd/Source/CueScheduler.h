@@ -0,0 +1,94 @@
+/*
+  ==============================================================================
+
+    CueScheduler.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+class Track;
+class Clip;
+
+
+struct ScheduledCue {
+    double beats = 0.0;  // Position in the global playhead at which the cue is due
+    Track* track = nullptr;
+    Clip* clip = nullptr;
+};
+
+
+/** Time-ordered queue of pending clip cues. Instead of every cued clip checking its cues in every slice, clips with
+ cues that are not yet due are added to this queue and only the cues due in the current slice are popped and dispatched
+ (see Track::updateActiveClips and Track::activateClip). The queue is a binary min-heap with storage allocated upfront.
+ NOTE: this should only be used from the RT thread (except for the stats getters)
+ */
+class CueScheduler
+{
+public:
+    CueScheduler()
+    {
+        cues.reserve(MAX_NUM_TRACKS * MAX_NUM_SCENES);
+    }
+
+    bool schedule(double beats, Track* track, Clip* clip)
+    {
+        // Adds a cue to the queue, returns false if there's no space left (in that case the caller should not rely on
+        // the scheduler for that cue)
+        if (cues.size() == cues.capacity()){
+            return false;
+        }
+        ScheduledCue cue;
+        cue.beats = beats;
+        cue.track = track;
+        cue.clip = clip;
+        cues.push_back(cue);
+        std::push_heap(cues.begin(), cues.end(), isLater);
+        updateStats();
+        return true;
+    }
+
+    template <typename DispatchFunction>
+    void popDueCues(double sliceEndInBeats, DispatchFunction dispatch)
+    {
+        // Pops all cues due before the end of the current slice and calls dispatch(track, clip) for each of them
+        while (cues.size() > 0 && cues.front().beats < sliceEndInBeats){
+            ScheduledCue cue = cues.front();
+            std::pop_heap(cues.begin(), cues.end(), isLater);
+            cues.pop_back();
+            dispatch(cue.track, cue.clip);
+        }
+        updateStats();
+    }
+
+    void clear()
+    {
+        cues.clear();
+        updateStats();
+    }
+
+    int getNumScheduledCues() const { return numScheduledCues; }
+    double getNextCueBeats() const { return nextCueBeats; }
+
+private:
+    std::vector<ScheduledCue> cues;
+    std::atomic<int> numScheduledCues { 0 };
+    std::atomic<double> nextCueBeats { -1.0 };
+
+    static bool isLater(const ScheduledCue& a, const ScheduledCue& b)
+    {
+        return a.beats > b.beats;
+    }
+
+    void updateStats()
+    {
+        numScheduledCues = (int)cues.size();
+        nextCueBeats = cues.size() > 0 ? cues.front().beats : -1.0;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CueScheduler)
+};
@@ -12,15 +12,19 @@
 
 
 HardwareDevice::HardwareDevice(const juce::ValueTree& _state,
-                               std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter,
-                               std::function<MidiInputDeviceData*(juce::String deviceName)> midiInputDeviceDataGetter
+                               std::function<int(juce::String deviceName, HardwareDeviceType type)> midiDeviceHandleGetter,
+                               std::function<MidiOutputDeviceData*(int handle)> midiOutputDeviceDataGetter,
+                               std::function<MidiInputDeviceData*(int handle)> midiInputDeviceDataGetter
                                ): state(_state)
 {
-    getMidiOutputDeviceData = midiOutputDeviceDataGetter;
-    getMidiInputDeviceData = midiInputDeviceDataGetter;
+    getMidiOutputDeviceDataByHandle = midiOutputDeviceDataGetter;
+    getMidiInputDeviceDataByHandle = midiInputDeviceDataGetter;
     
     bindState();
     
+    // Resolve the handle of the MIDI device so that it does not need to be looked up by name when processing slices
+    midiDeviceHandle = midiDeviceHandleGetter(isTypeInput() ? getMidiInputDeviceName() : getMidiOutputDeviceName(), getType());
+    
     if (isTypeOutput()){
         for (int i=0; i<midiCCParameterValues.size(); i++){
             midiCCParameterValues[i] = 64;  // Initialize all midi ccs to 64 (middle value)
@@ -28,7 +32,12 @@ HardwareDevice::HardwareDevice(const juce::ValueTree& _state,
         stateMidiCCParameterValues = ShepherdHelpers::serialize128IntArray(midiCCParameterValues); // Update the state version of the midiCCParameterValues list so change is reflected in state
     }
     
+    if (isTypeOutput()){
+        incomingMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    }
+    
     if (isTypeInput()){
+        processedIncomingMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
         if (stateControlChangeMapping == ""){
             for (int i=0; i<controlChangeMapping.size(); i++){
                 controlChangeMapping[i] = i;  // Initialize all midi cc mappings to the input number (no transformation)
@@ -46,6 +55,17 @@ HardwareDevice::HardwareDevice(const juce::ValueTree& _state,
         } else {
             notesMapping = ShepherdHelpers::deserialize128IntArray(stateNotesMapping);
         }
+
+        if (stateVelocityCurve == ""){
+            for (int i=0; i<velocityCurve.size(); i++){
+                velocityCurve[i] = i;  // Initialize velocity curve to the input velocity (no transformation)
+            }
+            stateVelocityCurve = ShepherdHelpers::serialize128IntArray(velocityCurve); // Update the state version of the velocityCurve list so change is reflected in state
+        } else {
+            velocityCurve = ShepherdHelpers::deserialize128IntArray(stateVelocityCurve);
+        }
+        
+        compileInputTransform();
     }
 }
 
@@ -71,6 +91,7 @@ void HardwareDevice::bindState()
     stateMidiCCParameterValues.referTo(state, ShepherdIDs::midiCCParameterValuesList, nullptr, ShepherdDefaults::emptyString);
     stateControlChangeMapping.referTo(state, ShepherdIDs::controlChangeMapping, nullptr, ShepherdDefaults::emptyString);
     stateNotesMapping.referTo(state, ShepherdIDs::notesMapping, nullptr, ShepherdDefaults::emptyString);
+    stateVelocityCurve.referTo(state, ShepherdIDs::velocityCurve, nullptr, ShepherdDefaults::emptyString);
     // NOTE: unlike other stateXXX properties in other objects like Clip, midiCCParameterValues and others here should never be loaded from state, so we don't do it here
 }
 
@@ -78,7 +99,7 @@ void HardwareDevice::bindState()
 
 void HardwareDevice::sendMidi(juce::MidiMessage msg)
 {
-    auto midiOutputDeviceData = getMidiOutputDeviceData(getMidiOutputDeviceName());
+    auto midiOutputDeviceData = getMidiOutputDeviceData();
     if (midiOutputDeviceData != nullptr){
         addMidiMessageToRenderInBufferFifo(msg);
         if (msg.isController()){
@@ -138,7 +159,7 @@ void HardwareDevice::renderPendingMidiMessagesToRenderInBuffer()
 {
     // If there are pending MIDI messages to be rendered in the hardware device buffer buffer, send them
     juce::MidiMessage msg;
-    auto midiOutputDeviceData = getMidiOutputDeviceData(getMidiOutputDeviceName());
+    auto midiOutputDeviceData = getMidiOutputDeviceData();
     if (midiOutputDeviceData == nullptr) { return; }
     juce::MidiBuffer* buffer = &midiOutputDeviceData->buffer;
     while (midiMessagesToRenderInBuffer.pull(msg)) {
@@ -152,101 +173,116 @@ void HardwareDevice::renderPendingMidiMessagesToRenderInBuffer()
 
 // -------------------------------------- INPUT DEVICES
 
-bool HardwareDevice::filterAndProcessIncomingMidiMessage(juce::MidiMessage& msg, HardwareDevice* outputDevice)
+void HardwareDevice::compileInputTransform()
 {
-    // Return false if message should not be added to incoming buffer, also modify message according to the target output device
-    // (e.g. change midi ouput channel)
-    
-    if (allowedMidiInputChannel.get() != 0){
-        if (msg.getChannel() != allowedMidiInputChannel.get()){
-            return false;
-        }
-    }
-    
-    int newMidiChannel = outputDevice->getMidiOutputChannel();
-    
-    if (msg.isNoteOnOrOff() || msg.isAftertouch()){
-        int newNoteNumber = notesMapping[msg.getNoteNumber()];
-        if (newNoteNumber == -1){
-            return false;  // Message should be discarted
-        } else {
-            msg.setNoteNumber(newNoteNumber);  // Update note number according to mapping
-        }
-        if ((msg.isNoteOnOrOff() && allowNoteMessages.get()) || (msg.isAftertouch() && allowAftertouchMessages.get())){
-            msg.setChannel(newMidiChannel);
-            return true;
-        }
+    // Compile the current input settings into an InputTransform and pass it to the RT thread. This should be called every time
+    // the input settings change, which happens when the device is created and from the WebSockets thread when mappings are
+    // set (see Sequencer::processMessageFromController). Only the latest compiled transform is used by the RT thread. The transform
+    // is also passed to the message thread, which uses it for direct MIDI thru (see getInputTransform).
+    InputTransform transform;
+    transform.kindByStatus[0x8 - 8] = allowNoteMessages.get() ? InputTransform::note : InputTransform::discard;
+    transform.kindByStatus[0x9 - 8] = allowNoteMessages.get() ? InputTransform::note : InputTransform::discard;
+    transform.kindByStatus[0xA - 8] = allowAftertouchMessages.get() ? InputTransform::polyAftertouch : InputTransform::discard;
+    transform.kindByStatus[0xB - 8] = allowControllerMessages.get() ? InputTransform::controller : InputTransform::discard;
+    transform.kindByStatus[0xD - 8] = allowChannelPressureMessages.get() ? InputTransform::channelPressure : InputTransform::discard;
+    transform.kindByStatus[0xE - 8] = allowPitchBendMessages.get() ? InputTransform::pitchWheel : InputTransform::discard;
+    int allowedChannel = allowedMidiInputChannel.get();
+    transform.channelMask = (allowedChannel >= 1 && allowedChannel <= 16) ? (juce::uint16)(1 << (allowedChannel - 1)) : 0xFFFF;
+    for (int i=0; i<128; i++){
+        transform.notesMapping[i] = (juce::int8)juce::jlimit(-1, 127, notesMapping[i]);
+        transform.controlChangeMapping[i] = (juce::int8)juce::jlimit(-1, 127, controlChangeMapping[i]);
+        transform.velocityCurve[i] = (juce::uint8)(i == 0 ? 0 : juce::jlimit(1, 127, velocityCurve[i]));
     }
-    else if (msg.isController() && allowControllerMessages.get()){
-        int newControllerNumber = controlChangeMapping[msg.getControllerNumber()];
-        int newControllerValue = msg.getControllerValue();
-        if (newControllerNumber == -1){
-            return false;  // Message should be discarted
-        } else {
-            // If cc messages are from a "relative" controller, compute the absolute cc value that shoud be sent, otherwise keep original value
-            if (controlChangeMessagesAreRelative.get()){
-                int rawControllerValue = msg.getControllerValue();
-                int increment = 0;
-                if (rawControllerValue > 0 && rawControllerValue < 64){
-                    increment = rawControllerValue;
-                } else {
-                    increment = rawControllerValue - 128;
-                }
-                int currentValue = outputDevice->getMidiCCParameterValue(newControllerNumber);
-                int absoluteControllerValue = currentValue + increment;
-                if (absoluteControllerValue > 127){
-                    absoluteControllerValue = 127;
-                } else if (absoluteControllerValue < 0){
-                    absoluteControllerValue = 0;
-                }
-                newControllerValue = absoluteControllerValue;
+    transform.controlChangeMessagesAreRelative = controlChangeMessagesAreRelative.get();
+    inputTransforms.push(transform);
+    inputTransformsForMessageThread.push(transform);
+    inputTransformVersion += 1;
+}
+
+const InputTransform& HardwareDevice::getInputTransform()
+{
+    // NOTE: this is called from the message thread
+    // The version is incremented after the transform is pushed, so if the version is read before calling this the returned
+    // transform is at least as new as that version (a newer transform will have a newer version, which will be noticed later)
+    JUCE_ASSERT_MESSAGE_THREAD
+    inputTransformsForMessageThread.pull(compiledInputTransform);
+    return compiledInputTransform;
+}
+
+void HardwareDevice::renderIncomingMidiMessageForOutputDevice(juce::uint8* data, HardwareDevice* outputDevice)
+{
+    // Modify an already filtered and mapped message according to the target output device (e.g. change midi ouput channel)
+    if ((data[0] & 0xF0) == 0xB0){
+        int controllerNumber = data[1];
+        int newControllerValue = data[2];
+        // If cc messages are from a "relative" controller, compute the absolute cc value that shoud be sent, otherwise keep original value
+        if (inputTransform.controlChangeMessagesAreRelative){
+            int rawControllerValue = data[2];
+            int increment = 0;
+            if (rawControllerValue > 0 && rawControllerValue < 64){
+                increment = rawControllerValue;
+            } else {
+                increment = rawControllerValue - 128;
             }
-            auto newMsg = juce::MidiMessage::controllerEvent (msg.getChannel(), newControllerNumber, newControllerValue);
-            newMsg.setTimeStamp (msg.getTimeStamp());
-            msg = newMsg;
-            // NOTE: isn't there a way to simple set controller number like when setting note number?
+            int currentValue = outputDevice->getMidiCCParameterValue(controllerNumber);
+            newControllerValue = juce::jlimit(0, 127, currentValue + increment);
+            data[2] = (juce::uint8)newControllerValue;
         }
-        msg.setChannel(newMidiChannel);
-        outputDevice->setMidiCCParameterValue(newControllerNumber, newControllerValue);  // If message is of type controller, also update the internal stored state of the controller
-        return true;
+        outputDevice->setMidiCCParameterValue(controllerNumber, newControllerValue);  // If message is of type controller, also update the internal stored state of the controller
     }
-    else if (msg.isPitchWheel() && allowPitchBendMessages.get()){
-        msg.setChannel(newMidiChannel);
-        return true;
-    }
-    else if (msg.isChannelPressure() && allowChannelPressureMessages.get()){
-        msg.setChannel(newMidiChannel);
-        return true;
+    int newMidiChannel = outputDevice->getMidiOutputChannel();
+    if (newMidiChannel >= 1 && newMidiChannel <= 16){
+        data[0] = (juce::uint8)((data[0] & 0xF0) | (newMidiChannel - 1));
     }
-    // NOTE: if none of the explictely specified MIDI message types is allowed, return false (i.e. always exclude sysex, program change, clock, etc.)
-    return false;
 }
 
-void HardwareDevice::processAndRenderIncomingMessagesIntoBuffer(juce::MidiBuffer& bufferToFill, HardwareDevice* outputDevice)
+void HardwareDevice::processIncomingMessagesForCurrentSlice(int fixedVelocity)
 {
-    // use getMidiInputDeviceData to get latest block of messages for the device, process them and add to the buffer
-    auto midiInputDeviceData = getMidiInputDeviceData(getMidiInputDeviceName());
+    // Filter and map the messages received by the device in the current slice (as set in getMidiInputDeviceData), and store
+    // the results so these can be rendered for any number of output devices with renderProcessedIncomingMessagesIntoBuffer.
+    // This should be called once per slice from the RT thread.
+    inputTransforms.pull(inputTransform);  // Use the latest compiled transform (if it changed)
+    processedIncomingMidiBuffer.clear();
+    auto midiInputDeviceData = getMidiInputDeviceData();
     if (midiInputDeviceData == nullptr) { return; }
-    juce::MidiBuffer* lastBlockOfMessages = &midiInputDeviceData->buffer;
-    if (lastBlockOfMessages != nullptr){
-        for (auto metadata: *lastBlockOfMessages){
-            juce::MidiMessage msg = metadata.getMessage();
-            if (filterAndProcessIncomingMidiMessage(msg, outputDevice)){
-                // NOTE: msg should have been processed here as it is passed to filterAndProcessIncomingMidiMessage by reference
-                bufferToFill.addEvent(msg, metadata.samplePosition);
-            }
+    juce::uint8 mappedData[3];
+    for (auto metadata: midiInputDeviceData->buffer){
+        int numMappedBytes = inputTransform.filterAndMap(metadata.data, metadata.numBytes, mappedData, fixedVelocity);
+        if (numMappedBytes > 0){
+            processedIncomingMidiBuffer.addEvent(mappedData, numMappedBytes, metadata.samplePosition);
         }
     }
 }
 
+void HardwareDevice::renderProcessedIncomingMessagesIntoBuffer(juce::MidiBuffer& bufferToFill, HardwareDevice* outputDevice)
+{
+    // Render the messages stored in processIncomingMessagesForCurrentSlice into the buffer, adapted to the given output device.
+    // NOTE: this should be called only once per output device and slice as rendering updates the state of relative controllers
+    juce::uint8 data[3];
+    for (auto metadata: processedIncomingMidiBuffer){
+        std::memcpy(data, metadata.data, (size_t)metadata.numBytes);
+        renderIncomingMidiMessageForOutputDevice(data, outputDevice);
+        bufferToFill.addEvent(data, metadata.numBytes, metadata.samplePosition);
+    }
+}
+
 void HardwareDevice::setNotesMapping(juce::String& serializedNotesMapping)
 {
     notesMapping = ShepherdHelpers::deserialize128IntArray(serializedNotesMapping);
     stateNotesMapping = ShepherdHelpers::serialize128IntArray(notesMapping);
+    compileInputTransform();
 }
 
 void HardwareDevice::setControlChangeMapping(juce::String& serializedControlChangeMapping)
 {
     controlChangeMapping = ShepherdHelpers::deserialize128IntArray(serializedControlChangeMapping);
     stateControlChangeMapping = ShepherdHelpers::serialize128IntArray(controlChangeMapping);
+    compileInputTransform();
+}
+
+void HardwareDevice::setVelocityCurve(juce::String& serializedVelocityCurve)
+{
+    velocityCurve = ShepherdHelpers::deserialize128IntArray(serializedVelocityCurve);
+    stateVelocityCurve = ShepherdHelpers::serialize128IntArray(velocityCurve);
+    compileInputTransform();
 }
@@ -13,14 +13,17 @@
 #include <JuceHeader.h>
 #include "helpers_shepherd.h"
 #include "Fifo.h"
+#include "TripleBuffer.h"
 #include "MusicalContext.h"
+#include "InputTransform.h"
 
 class HardwareDevice
 {
 public:
     HardwareDevice(const juce::ValueTree& state,
-                   std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter,
-                   std::function<MidiInputDeviceData*(juce::String deviceName)> midiInputDeviceDataGetter);
+                   std::function<int(juce::String deviceName, HardwareDeviceType type)> midiDeviceHandleGetter,
+                   std::function<MidiOutputDeviceData*(int handle)> midiOutputDeviceDataGetter,
+                   std::function<MidiInputDeviceData*(int handle)> midiInputDeviceDataGetter);
     void bindState();
     juce::ValueTree state;
     
@@ -28,9 +31,9 @@ public:
     bool isTypeOutput() { return type.get() == HardwareDeviceType::output; };
     bool isMidiInitialized() {
         if (isTypeInput()){
-            return getMidiInputDeviceData(getMidiInputDeviceName()) != nullptr;
+            return getMidiInputDeviceData() != nullptr;
         } else {
-            return getMidiOutputDeviceData(getMidiOutputDeviceName()) != nullptr;
+            return getMidiOutputDeviceData() != nullptr;
         }
     }
     
@@ -48,6 +51,7 @@ public:
     // Relevant for output devices
     int getMidiOutputChannel() { return midiOutputChannel.get(); }
     juce::String getMidiOutputDeviceName(){ return midiOutputDeviceName.get();}
+    MidiOutputDeviceData* getMidiOutputDeviceData() { return getMidiOutputDeviceDataByHandle(midiDeviceHandle); }
     void sendMidi(juce::MidiMessage msg);
     void sendAllNotesOff();
     void loadPreset(int bankNumber, int presetNumber);
@@ -55,19 +59,27 @@ public:
     void setMidiCCParameterValue(int index, int value);
     void addMidiMessageToRenderInBufferFifo(juce::MidiMessage msg);
     void renderPendingMidiMessagesToRenderInBuffer();
+    juce::MidiBuffer& getIncomingMidiBuffer() { return incomingMidiBuffer; }
     
     // Relevant for input devices
     juce::String getMidiInputDeviceName(){ return midiInputDeviceName.get();}
-    bool filterAndProcessIncomingMidiMessage(juce::MidiMessage& msg, HardwareDevice* outputDevice);
-    void processAndRenderIncomingMessagesIntoBuffer(juce::MidiBuffer& bufferToFill, HardwareDevice* outputDevice);
+    MidiInputDeviceData* getMidiInputDeviceData() { return getMidiInputDeviceDataByHandle(midiDeviceHandle); }
+    void compileInputTransform();
+    const InputTransform& getInputTransform();
+    int getInputTransformVersion() { return inputTransformVersion.load(); }
+    void renderIncomingMidiMessageForOutputDevice(juce::uint8* data, HardwareDevice* outputDevice);
+    void processIncomingMessagesForCurrentSlice(int fixedVelocity);
+    void renderProcessedIncomingMessagesIntoBuffer(juce::MidiBuffer& bufferToFill, HardwareDevice* outputDevice);
     void setNotesMapping(juce::String& serializedNotesMapping);
     void setControlChangeMapping(juce::String& serializedControlChangeMapping);
+    void setVelocityCurve(juce::String& serializedVelocityCurve);
     
 private:
     juce::CachedValue<juce::String> uuid;
     juce::CachedValue<int> type;  // Should correspond to HardwareDeviceType
     juce::CachedValue<juce::String> name;
     juce::CachedValue<juce::String> shortName;
+    int midiDeviceHandle = -1;  // Handle of the MIDI input or output device, resolved when the hardware device is created
     
     // For output devices
     juce::CachedValue<juce::String> midiOutputDeviceName;
@@ -75,8 +87,9 @@ private:
     std::array<int, 128> midiCCParameterValues = {0};
     juce::CachedValue<juce::String> stateMidiCCParameterValues;
     
-    std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
+    std::function<MidiOutputDeviceData*(int handle)> getMidiOutputDeviceDataByHandle;
     Fifo<juce::MidiMessage, 100> midiMessagesToRenderInBuffer;
+    juce::MidiBuffer incomingMidiBuffer;  // Messages from all input devices rendered for this output device in the current slice
     
     // For input devices
     juce::CachedValue<juce::String> midiInputDeviceName;
@@ -91,20 +104,33 @@ private:
     juce::CachedValue<juce::String> stateControlChangeMapping;
     std::array<int, 128> notesMapping = {};
     juce::CachedValue<juce::String> stateNotesMapping;
+    std::array<int, 128> velocityCurve = {};
+    juce::CachedValue<juce::String> stateVelocityCurve;
+    std::atomic<int> inputTransformVersion { 0 };
+    TripleBuffer<InputTransform> inputTransformsForMessageThread;
+    InputTransform compiledInputTransform;  // Latest compiled transform, only used in the message thread
+    TripleBuffer<InputTransform> inputTransforms;  // Compiled when the input settings change (see compileInputTransform)
+    InputTransform inputTransform;  // Latest compiled transform, only used in the RT thread
+    juce::MidiBuffer processedIncomingMidiBuffer;  // Filtered and mapped messages of the current slice
     
-    std::function<MidiInputDeviceData*(juce::String deviceName)> getMidiInputDeviceData;
+    std::function<MidiInputDeviceData*(int handle)> getMidiInputDeviceDataByHandle;
 };
 
 struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
 {
     HardwareDeviceList (const juce::ValueTree& v,
-                        std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter,
-                        std::function<MidiInputDeviceData*(juce::String deviceName)> midiInputDeviceDataGetter)
+                        std::function<int(juce::String deviceName, HardwareDeviceType type)> midiDeviceHandleGetter,
+                        std::function<MidiOutputDeviceData*(int handle)> midiOutputDeviceDataGetter,
+                        std::function<MidiInputDeviceData*(int handle)> midiInputDeviceDataGetter)
     : drow::ValueTreeObjectList<HardwareDevice> (v)
     {
+        getMidiDeviceHandle = midiDeviceHandleGetter;
         getMidiOutputDeviceData = midiOutputDeviceDataGetter;
         getMidiInputDeviceData = midiInputDeviceDataGetter;
         rebuildObjects();
+        for (auto* object: objects){
+            newObjectAdded(object);
+        }
     }
 
     ~HardwareDeviceList()
@@ -120,6 +146,7 @@ struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
     HardwareDevice* createNewObject (const juce::ValueTree& v) override
     {
         return new HardwareDevice (v,
+                                   getMidiDeviceHandle,
                                    getMidiOutputDeviceData,
                                    getMidiInputDeviceData);
     }
@@ -129,21 +156,66 @@ struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
         delete c;
     }
 
-    void newObjectAdded (HardwareDevice*) override    {}
-    void objectRemoved (HardwareDevice*) override     {}
+    void newObjectAdded (HardwareDevice* object) override
+    {
+        objectsByUuid[UuidKey::fromString(object->getUUID())] = object;
+        rebuildNameIndexes();
+    }
+    
+    void objectRemoved (HardwareDevice* object) override
+    {
+        objectsByUuid.erase(UuidKey::fromString(object->getUUID()));
+        rebuildNameIndexes();
+    }
+    
     void objectOrderChanged() override       {}
     
     HardwareDevice* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
+        auto* object = getObjectWithUUID(UuidKey::fromString(uuid));
+        if (object != nullptr && object->getUUID() == uuid){
+            return object;
+        }
+        return nullptr;
+    }
+    
+    HardwareDevice* getObjectWithUUID(const UuidKey& uuid) {
+        auto it = objectsByUuid.find(uuid);
+        if (it != objectsByUuid.end()){
+            return it->second;
+        }
+        return nullptr;
+    }
+    
+    std::unordered_map<UuidKey, HardwareDevice*, UuidKeyHash> objectsByUuid;  // Kept in sync with "objects" in newObjectAdded/objectRemoved
+    
+    HardwareDevice* getObjectWithName(const juce::String& name, HardwareDeviceType type) {
+        // Returns the device of the given type whose name or short name matches "name"
+        auto& devicesByName = type == HardwareDeviceType::input ? inputDevicesByName : outputDevicesByName;
+        auto it = devicesByName.find(name);
+        if (it != devicesByName.end()){
+            return it->second;
         }
         return nullptr;
     }
     
-    std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
-    std::function<MidiInputDeviceData*(juce::String deviceName)> getMidiInputDeviceData;
+    void rebuildNameIndexes() {
+        // Devices are only added/removed when loading hardware device definitions, so simply re-create the indexes.
+        // Use "emplace" so that, if several devices share a name, the first one in the list is returned (as when iterating)
+        inputDevicesByName.clear();
+        outputDevicesByName.clear();
+        for (auto* object: objects){
+            auto& devicesByName = object->getType() == HardwareDeviceType::input ? inputDevicesByName : outputDevicesByName;
+            devicesByName.emplace(object->getShortName(), object);
+            devicesByName.emplace(object->getName(), object);
+        }
+    }
+    
+    std::unordered_map<juce::String, HardwareDevice*, StringHash> inputDevicesByName;
+    std::unordered_map<juce::String, HardwareDevice*, StringHash> outputDevicesByName;
+    
+    std::function<int(juce::String deviceName, HardwareDeviceType type)> getMidiDeviceHandle;
+    std::function<MidiOutputDeviceData*(int handle)> getMidiOutputDeviceData;
+    std::function<MidiInputDeviceData*(int handle)> getMidiInputDeviceData;
     
     juce::StringArray getAvailableOutputHardwareDeviceNames() {
         juce::StringArray availableHardwareDeviceNames = {};
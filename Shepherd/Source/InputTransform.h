@@ -0,0 +1,94 @@
+/*
+  ==============================================================================
+
+    InputTransform.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+
+/** Settings of an input hardware device (allowed channel and message types, notes and CC mappings, velocity curve)
+ compiled into lookup tables so that messages can be filtered and mapped with a few table lookups and without branching
+ on the individual settings. An InputTransform is compiled every time the settings of the device change, and passed to
+ the RT thread by copy (see HardwareDevice::compileInputTransform).
+ */
+struct InputTransform
+{
+    enum MessageKind: juce::uint8
+    {
+        discard = 0,
+        note,
+        polyAftertouch,
+        controller,
+        pitchWheel,
+        channelPressure
+    };
+
+    std::array<juce::uint8, 8> kindByStatus = {};  // Indexed by the high nibble of the status byte minus 8 (0x8n-0xFn)
+    juce::uint16 channelMask = 0xFFFF;  // Bit N is set if messages in MIDI channel N+1 are allowed
+    std::array<juce::int8, 128> notesMapping = {};  // -1 to discard the note
+    std::array<juce::int8, 128> controlChangeMapping = {};  // -1 to discard the controller
+    std::array<juce::uint8, 128> velocityCurve = {};  // Note on velocities
+    bool controlChangeMessagesAreRelative = false;
+
+    int filterAndMap(const juce::uint8* data, int numBytes, juce::uint8* mappedData, int fixedVelocity) const
+    {
+        // Writes the mapped version of the message in mappedData and returns its number of bytes, or 0 if the message
+        // should be discarded. If fixedVelocity > -1, it replaces the velocity of note on messages.
+        // NOTE: sysex and system messages are always discarded
+        juce::uint8 status = data[0];
+        if (status < 0x80 || status >= 0xF0){
+            return 0;
+        }
+        if ((channelMask & (1 << (status & 0x0F))) == 0){
+            return 0;
+        }
+        juce::uint8 kind = kindByStatus[(status >> 4) - 8];
+        if (numBytes < (kind == channelPressure ? 2 : 3)){
+            return 0;
+        }
+        mappedData[0] = status;
+        switch (kind){
+            case note: {
+                juce::int8 newNoteNumber = notesMapping[data[1] & 0x7F];
+                if (newNoteNumber < 0) return 0;
+                juce::uint8 velocity = data[2] & 0x7F;
+                if ((status & 0xF0) == 0x90 && velocity > 0){
+                    // Note offs sent as note ons with velocity 0 must remain note offs
+                    velocity = fixedVelocity > -1 ? (juce::uint8)juce::jlimit(1, 127, fixedVelocity) : velocityCurve[velocity];
+                }
+                mappedData[1] = (juce::uint8)newNoteNumber;
+                mappedData[2] = velocity;
+                return 3;
+            }
+            case polyAftertouch: {
+                juce::int8 newNoteNumber = notesMapping[data[1] & 0x7F];
+                if (newNoteNumber < 0) return 0;
+                mappedData[1] = (juce::uint8)newNoteNumber;
+                mappedData[2] = data[2];
+                return 3;
+            }
+            case controller: {
+                // NOTE: the values of relative controllers are kept as they are, these are resolved when rendering for an output device
+                juce::int8 newControllerNumber = controlChangeMapping[data[1] & 0x7F];
+                if (newControllerNumber < 0) return 0;
+                mappedData[1] = (juce::uint8)newControllerNumber;
+                mappedData[2] = data[2];
+                return 3;
+            }
+            case pitchWheel:
+                mappedData[1] = data[1];
+                mappedData[2] = data[2];
+                return 3;
+            case channelPressure:
+                mappedData[1] = data[1];
+                return 2;
+            default:
+                return 0;
+        }
+    }
+};
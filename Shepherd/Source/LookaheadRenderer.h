@@ -0,0 +1,381 @@
+/*
+  ==============================================================================
+
+    LookaheadRenderer.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+#include "Fifo.h"
+#include "Clip.h"
+
+
+struct LookaheadEvent {
+    int generation = 0;
+    bool isCoverageMarker = false;  // If true, all events before "beats" have already been pushed (message is not used)
+    double beats = 0.0;  // Position in the "unwrapped" clip playhead (loop number * clip length + position in the clip)
+    juce::MidiMessage message;
+    float chance = 1.0f;
+};
+
+struct LookaheadRequest {
+    int generation = 0;
+    const ClipSequence* sequence = nullptr;
+    double startBeats = 0.0;
+};
+
+
+/** Pre-renders the events of the sequence of a playing clip ahead of time. Events are rendered by the LookaheadRenderer
+ thread (the "worker") and pushed to a fifo together with "coverage markers" that tell up to which position all events
+ have been rendered. The RT thread pops the events of each slice from the fifo instead of iterating the whole sequence.
+ Events are rendered in "unwrapped" clip playhead positions (i.e. positions keep growing when the clip loops) and don't
+ depend on tempo, so these only need to be re-rendered when the sequence changes or the clip playhead jumps (e.g. when the
+ clip starts playing). In that case, the RT thread "restarts" the slot: it increments the generation number and sends a
+ request to the worker, events of older generations are discarded when popped. Until the worker has rendered events beyond
+ the end of the current slice, the clip renders the slice directly from the sequence (see Clip::processSlice).
+ NOTE: the members in the "RT thread" section should only be used from the RT thread and those in the "worker" section only
+ from the worker thread.
+ */
+class ClipLookaheadSlot
+{
+public:
+    ClipLookaheadSlot()
+    {
+        sliceEvents.reserve(eventsFifoSize);
+    }
+
+    bool claim()
+    {
+        // Called from the RT thread, the new owner will restart the slot in the first call to getEventsInSlice
+        bool expected = false;
+        if (!claimed.compare_exchange_strong(expected, true)){
+            return false;
+        }
+        sequenceForRTThread = nullptr;
+        loopOffsetInBeats = 0.0;
+        return true;
+    }
+
+    void release()
+    {
+        claimed = false;
+    }
+
+    bool isClaimed() const
+    {
+        return claimed.load();
+    }
+
+    std::atomic<juce::int64> numSlicesRenderedFromLookahead { 0 };
+    std::atomic<juce::int64> numSlicesRenderedDirectly { 0 };
+    std::atomic<juce::int64> numSliceEventsOverflows { 0 };  // Slices rendered directly because sliceEvents was full
+
+    //==============================================================================
+    // RT thread
+
+    bool getEventsInSlice(const ClipSequence* sequence, juce::Range<double> sliceInBeats)
+    {
+        // Fills sliceEvents with the pre-rendered events that fall in the given clip playhead slice and returns true. If the
+        // events of the slice are not available (lookahead restarted or worker not far enough), returns false and the slice
+        // should be rendered directly from the sequence. This must be called for every slice while the clip is playing.
+        sliceEvents.clear();
+        double sliceStart = sliceInBeats.getStart() + loopOffsetInBeats;
+        double sliceEnd = sliceInBeats.getEnd() + loopOffsetInBeats;
+        if (sequence != sequenceForRTThread || std::abs(sliceStart - expectedSliceStart) > 1e-6){
+            // Sequence changed or playhead jumped, start rendering again after the end of the current slice
+            loopOffsetInBeats = 0.0;
+            restart(sequence, sliceInBeats.getEnd());
+            numSlicesRenderedDirectly += 1;
+            return false;
+        }
+        expectedSliceStart = sliceEnd;
+        consumedUpToBeats = sliceEnd;
+
+        // Pop events until an event (or coverage marker) of the current generation beyond the end of the slice is found
+        // Events of older generations and events which were already rendered directly are discarded
+        bool covered = coveredUpToBeats >= sliceEnd;
+        LookaheadEvent event;
+        while (!covered){
+            if (hasHeldEvent){
+                event = heldEvent;
+                hasHeldEvent = false;
+            } else if (!events.pull(event)){
+                break;
+            }
+            if (event.generation != generation){
+                continue;
+            }
+            if (event.isCoverageMarker){
+                coveredUpToBeats = juce::jmax(coveredUpToBeats, event.beats);
+                covered = coveredUpToBeats >= sliceEnd;
+            } else if (event.beats < directlyRenderedUpToBeats){
+                continue;
+            } else if (event.beats >= sliceEnd){
+                heldEvent = event;
+                hasHeldEvent = true;
+                covered = true;
+            } else if (sliceEvents.size() == sliceEvents.capacity()){
+                // No more pre-allocated space for the events of the slice, render the whole slice directly instead
+                numSliceEventsOverflows += 1;
+                break;
+            } else {
+                event.beats = juce::jmax(0.0, event.beats - sliceStart);  // Position relative to the start of the slice
+                sliceEvents.push_back(event);
+            }
+        }
+
+        if (!covered){
+            // Events popped so far will be rendered directly, discard them (and later events of this slice when these arrive)
+            sliceEvents.clear();
+            directlyRenderedUpToBeats = sliceEnd;
+            numSlicesRenderedDirectly += 1;
+            return false;
+        }
+        numSlicesRenderedFromLookahead += 1;
+        return true;
+    }
+
+    void notifyClipLooped(double clipLengthInBeats)
+    {
+        // Called when the clip playhead is reset because the clip loops, so that unwrapped positions keep growing
+        loopOffsetInBeats += clipLengthInBeats;
+    }
+
+    const std::vector<LookaheadEvent>& getSliceEvents() const
+    {
+        // Events of the current slice (see getEventsInSlice), with positions relative to the start of the slice
+        return sliceEvents;
+    }
+
+    //==============================================================================
+    // Worker thread
+
+    bool renderAhead(double lookaheadBeats, ClipSequenceCache& compiledSequenceCache)
+    {
+        // Pushes the events of the sequence up to lookaheadBeats after the position consumed by the RT thread. Returns
+        // true if new events were pushed.
+        LookaheadRequest request;
+        bool hasNewRequest = false;
+        while (requests.pull(request)){
+            hasNewRequest = true;
+        }
+        if (hasNewRequest){
+            workerGeneration = request.generation;
+            workerSequence = compiledSequenceCache.retain(request.sequence);
+            startRenderingAt(request.startBeats);
+        }
+        if (!isClaimed()){
+            // Don't keep a reference to the sequence of clips which are no longer playing
+            workerSequence = nullptr;
+        }
+        if (workerSequence == nullptr){
+            return false;
+        }
+
+        bool pushedEvents = false;
+        double renderUpToBeats = consumedUpToBeats.load() + lookaheadBeats;
+        double nextEventBeats = getNextEventBeats();
+        while (nextEventBeats < renderUpToBeats && events.getAvailableSpace() > 1){
+            // NOTE: leave space for a coverage marker
+            LookaheadEvent event;
+            event.generation = workerGeneration;
+            event.beats = nextEventBeats;
+            event.message = workerSequence->midiSequence.getEventPointer(eventIndex)->message;
+            SequenceEventAnnotations* eventAnnotations = workerSequence->annotations[eventIndex].get();
+            event.chance = eventAnnotations != nullptr ? eventAnnotations->chance : 1.0f;
+            events.push(event);
+            pushedEvents = true;
+            eventIndex += 1;
+            nextEventBeats = getNextEventBeats();
+        }
+        if (nextEventBeats != lastCoverageMarkerBeats && events.getAvailableSpace() > 0){
+            // All events before the next event to render have been pushed
+            LookaheadEvent marker;
+            marker.generation = workerGeneration;
+            marker.isCoverageMarker = true;
+            marker.beats = nextEventBeats;
+            events.push(marker);
+            lastCoverageMarkerBeats = nextEventBeats;
+        }
+        return pushedEvents;
+    }
+
+private:
+    static constexpr int eventsFifoSize = 512;
+
+    std::atomic<bool> claimed { false };
+    Fifo<LookaheadEvent, eventsFifoSize> events;
+    Fifo<LookaheadRequest, 8> requests;
+    std::atomic<double> consumedUpToBeats { 0.0 };
+
+    // RT thread
+    std::vector<LookaheadEvent> sliceEvents;
+    int generation = 0;
+    const ClipSequence* sequenceForRTThread = nullptr;
+    double loopOffsetInBeats = 0.0;
+    double expectedSliceStart = 0.0;
+    double coveredUpToBeats = 0.0;
+    double directlyRenderedUpToBeats = 0.0;
+    LookaheadEvent heldEvent;
+    bool hasHeldEvent = false;
+
+    void restart(const ClipSequence* sequence, double startBeats)
+    {
+        LookaheadRequest request;
+        request.generation = generation + 1;
+        request.sequence = sequence;
+        request.startBeats = juce::jmax(0.0, startBeats);
+        if (!requests.push(request)){
+            // Requests fifo full, try again in the next slice
+            sequenceForRTThread = nullptr;
+            return;
+        }
+        generation = request.generation;
+        sequenceForRTThread = sequence;
+        expectedSliceStart = startBeats;
+        consumedUpToBeats = startBeats;
+        coveredUpToBeats = request.startBeats;
+        directlyRenderedUpToBeats = request.startBeats;
+        hasHeldEvent = false;
+    }
+
+    // Worker thread
+    int workerGeneration = 0;
+    ClipSequence::Ptr workerSequence;
+    juce::int64 loopIndex = 0;
+    int eventIndex = 0;
+    int numEventsInLoop = 0;
+    double lastCoverageMarkerBeats = -1.0;
+
+    void startRenderingAt(double startBeats)
+    {
+        lastCoverageMarkerBeats = -1.0;
+        loopIndex = 0;
+        eventIndex = 0;
+        numEventsInLoop = 0;
+        if (workerSequence == nullptr){
+            return;
+        }
+        auto& midiSequence = workerSequence->midiSequence;
+        double lengthInBeats = workerSequence->lengthInBeats;
+        double startPositionInLoop = startBeats;
+        numEventsInLoop = midiSequence.getNumEvents();
+        if (lengthInBeats > 0.0){
+            // Events at or after the clip length are never played (these should not exist in compiled sequences anyway)
+            numEventsInLoop = midiSequence.getNextIndexAtTime(lengthInBeats);
+            loopIndex = (juce::int64)std::floor(startBeats / lengthInBeats);
+            startPositionInLoop = startBeats - loopIndex * lengthInBeats;
+        }
+        eventIndex = juce::jmin(midiSequence.getNextIndexAtTime(startPositionInLoop), numEventsInLoop);
+    }
+
+    double getNextEventBeats()
+    {
+        // Returns the unwrapped position of the next event to render, moving to the next loop if needed
+        double lengthInBeats = workerSequence->lengthInBeats;
+        if (eventIndex >= numEventsInLoop){
+            if (lengthInBeats <= 0.0 || numEventsInLoop == 0){
+                return std::numeric_limits<double>::max();
+            }
+            loopIndex += 1;
+            eventIndex = 0;
+        }
+        double loopStartBeats = lengthInBeats > 0.0 ? loopIndex * lengthInBeats : 0.0;
+        return loopStartBeats + workerSequence->midiSequence.getEventPointer(eventIndex)->message.getTimeStamp();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ClipLookaheadSlot)
+};
+
+
+/** Thread which pre-renders the sequences of playing clips ahead of time (see ClipLookaheadSlot). Slots are allocated
+ upfront and claimed by clips from the RT thread when these start playing, so the cost of rendering the events of a slice
+ in the RT thread does not depend on the size of the sequences. Lookahead rendering is disabled if the lookahead window is 0.
+ */
+class LookaheadRenderer: private juce::Thread
+{
+public:
+    LookaheadRenderer(): juce::Thread ("LookaheadRenderer")
+    {
+        for (int i=0; i<MAX_NUM_TRACKS; i++){
+            slots.add(new ClipLookaheadSlot());
+        }
+        startThread(5);
+    }
+
+    ~LookaheadRenderer()
+    {
+        stopThread(2000);
+    }
+
+    void setLookaheadBeats(double newLookaheadBeats)
+    {
+        lookaheadBeats = juce::jmax(0.0, newLookaheadBeats);
+    }
+
+    bool isEnabled() const
+    {
+        return lookaheadBeats.load() > 0.0;
+    }
+
+    ClipLookaheadSlot* claimSlot()
+    {
+        // Returns a free slot (or nullptr if all are in use), called from the RT thread
+        for (auto slot: slots){
+            if (slot->claim()){
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    juce::var getStats()
+    {
+        int slotsInUse = 0;
+        juce::int64 slicesRenderedFromLookahead = 0;
+        juce::int64 slicesRenderedDirectly = 0;
+        juce::int64 sliceEventsOverflows = 0;
+        for (auto slot: slots){
+            if (slot->isClaimed()) slotsInUse += 1;
+            slicesRenderedFromLookahead += slot->numSlicesRenderedFromLookahead.load();
+            slicesRenderedDirectly += slot->numSlicesRenderedDirectly.load();
+            sliceEventsOverflows += slot->numSliceEventsOverflows.load();
+        }
+        juce::DynamicObject::Ptr stats = new juce::DynamicObject();
+        stats->setProperty("lookaheadBeats", lookaheadBeats.load());
+        stats->setProperty("slotsInUse", slotsInUse);
+        stats->setProperty("slicesRenderedFromLookahead", slicesRenderedFromLookahead);
+        stats->setProperty("slicesRenderedDirectly", slicesRenderedDirectly);
+        stats->setProperty("sliceEventsOverflows", sliceEventsOverflows);
+        return stats.get();
+    }
+
+private:
+    juce::OwnedArray<ClipLookaheadSlot> slots;
+    std::atomic<double> lookaheadBeats { 0.0 };
+    juce::SharedResourcePointer<ClipSequenceCache> compiledSequenceCache;
+
+    void run() override
+    {
+        while (!threadShouldExit()){
+            bool pushedEvents = false;
+            double currentLookaheadBeats = lookaheadBeats.load();
+            if (currentLookaheadBeats > 0.0){
+                for (auto slot: slots){
+                    if (slot->renderAhead(currentLookaheadBeats, *compiledSequenceCache)){
+                        pushedEvents = true;
+                    }
+                }
+            }
+            if (!pushedEvents){
+                wait(1);
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LookaheadRenderer)
+};
@@ -24,6 +24,16 @@ public:
     void initialise (const juce::String& commandLine) override
     {
         // This method is where you should put your application's initialisation code..
+        
+        if (commandLine.contains ("--benchmark"))
+        {
+            // Run the sequencer benchmark without opening any window, audio/MIDI device or WebSockets server, print the results
+            // and quit
+            Sequencer sequencer (false);
+            std::cout << juce::JSON::toString (sequencer.runBenchmark (10000)) << std::endl;
+            quit();
+            return;
+        }
 
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
@@ -89,7 +89,7 @@ public:
         bufferToFill.clearActiveBufferRegion();
         
         int sliceNumSamples = bufferToFill.numSamples;
-        sequencer.getNextMIDISlice(sliceNumSamples);
+        sequencer.getNextMIDIBlock(sliceNumSamples);
         
         #if JUCE_DEBUG
         // All buffers are combined into a single buffer which is then sent to the synth
@@ -0,0 +1,211 @@
+/*
+  ==============================================================================
+
+    MidiInputRing.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Fifo.h"
+#include "InputTransform.h"
+#include "defines_shepherd.h"
+
+
+/** Receives the messages of a MIDI input device and passes them to the RT thread through a lock-free single producer/single
+ consumer ring, together with their arrival time. This replaces juce::MidiMessageCollector, which takes a lock both in the
+ MIDI input callback and in the RT thread. When the messages are retrieved for an audio block, each message is placed at the
+ position given by its arrival time, considering that the block corresponds to the blockNumSamples samples before the block
+ is retrieved. Therefore all messages have the same latency of one block (instead of being squeezed in the block) so the
+ relative timing of the messages is preserved.
+ The ring also keeps some counters about overflows and about the time between the arrival of a message and the moment it
+ is processed by the RT thread.
+ Optionally, the ring can also send the messages directly to output devices from the MIDI input thread ("direct MIDI thru")
+ so that input monitoring does not add the latency of the audio blocks. The routes of all rings are published by the sequencer
+ as a single snapshot (see Sequencer::updateMidiThruRoutes).
+ */
+class MidiInputRing: public juce::MidiInputCallback
+{
+public:
+    static constexpr int maxNumThruRoutes = 32;
+
+    struct ThruRoute
+    {
+        const MidiInputRing* input = nullptr;  // Ring of the MIDI input device whose messages are sent through this route
+        InputTransform transform;  // Transform of the input hardware device
+        int fixedVelocity = -1;
+        MidiOutputDeviceData* output = nullptr;
+        int midiChannel = -1;  // MIDI channel of the output hardware device
+        const void* transformSource = nullptr;  // Used to check if routes have changed
+        int transformVersion = 0;
+    };
+
+    struct ThruOutputHardwareDevices
+    {
+        // Output hardware devices which receive the monitored messages of all input hardware devices through direct MIDI thru
+        std::array<const void*, maxNumThruRoutes> devices;
+        int numDevices = 0;
+
+        bool contains(const void* outputHardwareDevice) const
+        {
+            for (int i=0; i<numDevices; i++){
+                if (devices[i] == outputHardwareDevice) return true;
+            }
+            return false;
+        }
+    };
+
+    struct ThruRoutes
+    {
+        // Routes of all the rings. The RT thread uses outputHardwareDevices of the same snapshot to decide which monitored
+        // messages it should not send itself (see Sequencer::updateDirectThruOutputDevices).
+        std::array<ThruRoute, maxNumThruRoutes> routes;
+        int numRoutes = 0;
+        ThruOutputHardwareDevices outputHardwareDevices;
+
+        bool isEquivalentTo(const ThruRoutes& other) const
+        {
+            if (numRoutes != other.numRoutes || outputHardwareDevices.numDevices != other.outputHardwareDevices.numDevices) return false;
+            for (int i=0; i<numRoutes; i++){
+                const ThruRoute& a = routes[i];
+                const ThruRoute& b = other.routes[i];
+                if (a.input != b.input || a.output != b.output || a.midiChannel != b.midiChannel || a.fixedVelocity != b.fixedVelocity || a.transformSource != b.transformSource || a.transformVersion != b.transformVersion){
+                    return false;
+                }
+            }
+            for (int i=0; i<outputHardwareDevices.numDevices; i++){
+                if (outputHardwareDevices.devices[i] != other.outputHardwareDevices.devices[i]) return false;
+            }
+            return true;
+        }
+    };
+
+    MidiInputRing(const std::atomic<ThruRoutes*>& sharedThruRoutes): thruRoutes(sharedThruRoutes)
+    {
+    }
+
+    void reset(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+    }
+
+    void handleIncomingMidiMessage (juce::MidiInput*, const juce::MidiMessage& message) override
+    {
+        // NOTE: this is called from the MIDI input thread of the device
+        // Messages longer than 3 bytes (sysex) are not passed as these are not used by Shepherd
+        if (message.getRawDataSize() > 3){
+            numMessagesDiscarded += 1;
+            return;
+        }
+        TimestampedMidiMessage event;
+        std::memcpy(event.data, message.getRawData(), (size_t)message.getRawDataSize());
+        event.numBytes = message.getRawDataSize();
+        // MIDI input messages are timestamped with juce::Time::getMillisecondCounterHiRes() * 0.001
+        event.arrivalTimeMs = message.getTimeStamp() > 0.0 ? message.getTimeStamp() * 1000.0 : juce::Time::getMillisecondCounterHiRes();
+        if (ring.push(event)){
+            numMessagesReceived += 1;
+        } else {
+            numMessagesDropped += 1;
+        }
+        if (thruRoutes.load() != nullptr){
+            sendThru(message);
+        }
+    }
+
+    bool isSendingThruMessages() const
+    {
+        // Used to wait until the MIDI input thread is not using previously published routes before deleting them
+        return isSendingThru.load();
+    }
+
+    void removeNextBlockOfMessages (juce::MidiBuffer& destBuffer, int blockNumSamples)
+    {
+        // NOTE: this is called from the RT thread
+        double nowMs = juce::Time::getMillisecondCounterHiRes();
+        double samplesPerMs = sampleRate.load() * 0.001;
+        TimestampedMidiMessage event;
+        while (ring.pull(event)){
+            double latencyMs = juce::jmax(0.0, nowMs - event.arrivalTimeMs);
+            int samplePosition = blockNumSamples - 1 - (int)(latencyMs * samplesPerMs);
+            destBuffer.addEvent(event.data, event.numBytes, juce::jlimit(0, blockNumSamples - 1, samplePosition));
+            numMessagesProcessed += 1;
+            totalLatencyMs = totalLatencyMs.load() + latencyMs;
+            if (latencyMs > maxLatencyMs.load()){
+                maxLatencyMs = latencyMs;
+            }
+        }
+    }
+
+    juce::var getStats()
+    {
+        juce::int64 processed = numMessagesProcessed.load();
+        juce::DynamicObject::Ptr stats = new juce::DynamicObject();
+        stats->setProperty("received", numMessagesReceived.load());
+        stats->setProperty("dropped", numMessagesDropped.load());
+        stats->setProperty("discarded", numMessagesDiscarded.load());
+        stats->setProperty("meanLatencyMs", processed > 0 ? totalLatencyMs.load() / (double)processed : 0.0);
+        stats->setProperty("maxLatencyMs", maxLatencyMs.load());
+        stats->setProperty("sentThru", numMessagesSentThru.load());
+        return stats.get();
+    }
+
+private:
+    struct TimestampedMidiMessage
+    {
+        juce::uint8 data[3];
+        int numBytes;
+        double arrivalTimeMs;
+    };
+
+    Fifo<TimestampedMidiMessage, 1024> ring;
+    std::atomic<double> sampleRate { 44100.0 };
+
+    // Written by the MIDI input thread
+    std::atomic<juce::int64> numMessagesReceived { 0 };
+    std::atomic<juce::int64> numMessagesDropped { 0 };  // Messages lost because the ring was full
+    std::atomic<juce::int64> numMessagesDiscarded { 0 };  // Sysex messages
+    std::atomic<juce::int64> numMessagesSentThru { 0 };
+
+    // Written by the RT thread
+    std::atomic<juce::int64> numMessagesProcessed { 0 };
+    std::atomic<double> totalLatencyMs { 0.0 };
+    std::atomic<double> maxLatencyMs { 0.0 };
+
+    // Direct MIDI thru
+    const std::atomic<ThruRoutes*>& thruRoutes;  // Owned by the sequencer
+    std::atomic<bool> isSendingThru { false };
+
+    void sendThru(const juce::MidiMessage& message)
+    {
+        // NOTE: this is called from the MIDI input thread. isSendingThru must be set before loading the routes (see
+        // isSendingThruMessages). Output devices are also used by the RT thread, so their sendLock is held while sending.
+        isSendingThru = true;
+        ThruRoutes* routes = thruRoutes.load();
+        if (routes != nullptr){
+            juce::uint8 mappedData[3];
+            for (int i=0; i<routes->numRoutes; i++){
+                const ThruRoute& route = routes->routes[i];
+                if (route.input != this){
+                    continue;
+                }
+                int numMappedBytes = route.transform.filterAndMap(message.getRawData(), message.getRawDataSize(), mappedData, route.fixedVelocity);
+                // Controller messages are not sent directly because relative controllers depend on the state of the output
+                // device, these are monitored through the slice engine (see Track::processInputMessages)
+                if (numMappedBytes == 0 || (mappedData[0] & 0xF0) == 0xB0){
+                    continue;
+                }
+                if (route.midiChannel >= 1 && route.midiChannel <= 16){
+                    mappedData[0] = (juce::uint8)((mappedData[0] & 0xF0) | (route.midiChannel - 1));
+                }
+                const juce::SpinLock::ScopedLockType sl (route.output->sendLock);
+                route.output->device->sendMessageNow(juce::MidiMessage(mappedData, numMappedBytes));
+                numMessagesSentThru += 1;
+            }
+        }
+        isSendingThru = false;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiInputRing)
+};
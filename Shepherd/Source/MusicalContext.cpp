@@ -35,6 +35,9 @@ void MusicalContext::bindState()
     bpm.referTo(state, ShepherdIDs::bpm, nullptr, ShepherdDefaults::bpm);
     meter.referTo(state, ShepherdIDs::meter, nullptr, ShepherdDefaults::meter);
     metronomeOn.referTo(state, ShepherdIDs::metronomeOn, nullptr, ShepherdDefaults::metronomeOn);
+    
+    // Start the master timeline at the position loaded from the state
+    startTempoSegment(playheadPositionInSamples, playheadPositionInBeats, bpm);
 }
 
 void MusicalContext::updateStateMemberVersions()
@@ -74,6 +77,34 @@ double MusicalContext::getSliceLengthInBeats()
     return (double)getGlobalSettings().samplesPerSlice / (60.0 * getGlobalSettings().sampleRate / bpm);
 }
 
+juce::Range<double> MusicalContext::getSliceRangeInBeats()
+{
+    // Range of the current slice computed from the sample clock. The end of a slice is exactly the same value as the start of
+    // the next one (unless the position or the tempo change), so playheads derived from it can check for continuity.
+    return {playheadPositionInBeats, samplesToBeats(playheadPositionInSamples + getGlobalSettings().samplesPerSlice)};
+}
+
+double MusicalContext::samplesToBeats(juce::int64 samplePosition)
+{
+    double sampleRate = getGlobalSettings().sampleRate;
+    double segmentStartBeats = (double)tempoSegment.startTick / (double)TIMELINE_TICKS_PER_BEAT;
+    if (sampleRate <= 0.0){
+        return segmentStartBeats;
+    }
+    return segmentStartBeats + (double)(samplePosition - tempoSegment.startSample) * tempoSegment.bpm / (60.0 * sampleRate);
+}
+
+void MusicalContext::startTempoSegment(juce::int64 startSample, double startBeats, double segmentBpm)
+{
+    // Start a new tempo segment at the given position of the sample clock. The beat position of the start of the segment
+    // is stored as an integer number of ticks so that the mapping of the segment is exact and the only rounding happens
+    // when a segment starts (i.e. when tempo changes or the playhead position is set), and not at every slice.
+    tempoSegment.startSample = startSample;
+    tempoSegment.startTick = (juce::int64)std::llround(startBeats * (double)TIMELINE_TICKS_PER_BEAT);
+    tempoSegment.bpm = segmentBpm;
+    playheadPositionInBeats = samplesToBeats(playheadPositionInSamples);
+}
+
 
 //==============================================================================
 
@@ -82,9 +113,21 @@ double MusicalContext::getPlayheadPositionInBeats()
     return playheadPositionInBeats;
 }
 
+juce::int64 MusicalContext::getPlayheadPositionInSamples()
+{
+    return playheadPositionInSamples;
+}
+
 void MusicalContext::setPlayheadPosition(double newPosition)
 {
-    playheadPositionInBeats = newPosition;
+    startTempoSegment(playheadPositionInSamples, newPosition, tempoSegment.bpm);
+}
+
+void MusicalContext::advancePlayheadBySlice()
+{
+    playheadPositionInSamples += getGlobalSettings().samplesPerSlice;
+    playheadPositionInBeats = samplesToBeats(playheadPositionInSamples);
+    playheadStartedInCurrentSlice = false;
 }
 
 bool MusicalContext::playheadIsPlaying()
@@ -94,6 +137,7 @@ bool MusicalContext::playheadIsPlaying()
 
 void MusicalContext::setPlayheadIsPlaying(bool onOff)
 {
+    playheadStartedInCurrentSlice = onOff && !isPlaying;
     isPlaying = onOff;
 }
 
@@ -132,6 +176,7 @@ void MusicalContext::setBpm(double newBpm)
 {
     jassert(newBpm > 0.0);
     bpm = newBpm;
+    startTempoSegment(playheadPositionInSamples, playheadPositionInBeats, newBpm);
 }
 
 double MusicalContext::getBpm()
@@ -178,6 +223,22 @@ void MusicalContext::resetCounters()
     lastBarCountedPlayheadPosition = 0.0;
 }
 
+void MusicalContext::continueTransportFrom(const MusicalContext& other)
+{
+    // Copy transport position and counters from another musical context so that this one continues
+    // from the exact same point (used when switching sessions while playing). This is RT safe.
+    playheadPositionInSamples = other.playheadPositionInSamples;
+    startTempoSegment(other.playheadPositionInSamples, other.playheadPositionInBeats, bpm);
+    isPlaying = other.isPlaying;
+    playheadStartedInCurrentSlice = other.playheadStartedInCurrentSlice;
+    doingCountIn = other.doingCountIn;
+    countInPlayheadPositionInBeats = other.countInPlayheadPositionInBeats;
+    barCount = other.barCount;
+    lastBarCountedPlayheadPosition = other.lastBarCountedPlayheadPosition;
+    metronomePendingNoteOffSamplePosition = other.metronomePendingNoteOffSamplePosition;
+    metronomePendingNoteOffIsHigh = other.metronomePendingNoteOffIsHigh;
+}
+
 int MusicalContext::getBarCount()
 {
     return barCount;
@@ -195,8 +256,11 @@ double MusicalContext::getBeatsInBarCount()
 void MusicalContext::renderMetronomeInSlice(juce::MidiBuffer& bufferToFill)
 {
     // Add metronome ticks to the buffer
-    if (metronomePendingNoteOffSamplePosition > -1){
-        // If there was a noteOff metronome message pending from previous block, add it now to the buffer
+    if (metronomePendingNoteOffSamplePosition >= getGlobalSettings().samplesPerSlice){
+        // The pending noteOff falls after the current slice (slices can be shorter than the metronome tick), keep it pending
+        metronomePendingNoteOffSamplePosition -= getGlobalSettings().samplesPerSlice;
+    } else if (metronomePendingNoteOffSamplePosition > -1){
+        // If there was a noteOff metronome message pending from previous slice, add it now to the buffer
         juce::MidiMessage msgOff = juce::MidiMessage::noteOff(metronomeMidiChannel, metronomePendingNoteOffIsHigh ? metronomeHighMidiNote: metronomeLowMidiNote, 0.0f);
         #if !RPI_BUILD
         // Don't send note off messages in RPI_BUILD as it messed up external metronome
@@ -207,67 +271,58 @@ void MusicalContext::renderMetronomeInSlice(juce::MidiBuffer& bufferToFill)
     }
     if ((metronomeOn && isPlaying) || doingCountIn) {
         
-        double previousBeat = isPlaying ? playheadPositionInBeats : countInPlayheadPositionInBeats;
-        double beatsPerSample = 1.0 / (60.0 * getGlobalSettings().sampleRate / getBpm());
-        for (int i=0; i<getGlobalSettings().samplesPerSlice; i++){
-            
-            double nextBeat = previousBeat + beatsPerSample;
-            double previousBeatNearestQuantized = std::round(previousBeat);
-            double nextBeatNearestQuantized = std::round(nextBeat);
-            double tickTime = -1.0;
-        
-            if (previousBeat <= previousBeatNearestQuantized && previousBeatNearestQuantized < nextBeat){
-                // If previousBeatNearestQuantized is in the middle of both beats, add midi metronome message
-                tickTime = previousBeatNearestQuantized;
-            }
-            else if (previousBeat <= nextBeatNearestQuantized && nextBeatNearestQuantized < nextBeat) {
-                // If nextBeatNearestQuantized is in the middle of both beats, add midi metronome message
-                tickTime = nextBeatNearestQuantized;
-            }
+        // Compute the samples at which beats start in the current slice directly from the beat range of the slice, instead of
+        // checking every sample of the slice
+        int samplesPerSlice = getGlobalSettings().samplesPerSlice;
+        juce::Range<double> sliceInBeats = isPlaying ? getSliceRangeInBeats() : juce::Range<double>{countInPlayheadPositionInBeats, countInPlayheadPositionInBeats + getSliceLengthInBeats()};
+        if (sliceInBeats.getLength() <= 0.0 || samplesPerSlice <= 0){
+            return;
+        }
+        double beatsPerSample = sliceInBeats.getLength() / (double)samplesPerSlice;
+        for (double tickTime = std::ceil(sliceInBeats.getStart()); tickTime < sliceInBeats.getEnd(); tickTime += 1.0){
+            int i = juce::jlimit(0, samplesPerSlice - 1, (int)std::floor((tickTime - sliceInBeats.getStart()) / beatsPerSample));
             
-            if (tickTime > -1.0){
-                bool tickIsHigh = (nextBeat - lastBarCountedPlayheadPosition) < (getGlobalSettings().samplesPerSlice * beatsPerSample);
-                juce::MidiMessage msgOn = juce::MidiMessage::noteOn(metronomeMidiChannel, tickIsHigh ? metronomeHighMidiNote: metronomeLowMidiNote, metronomeMidiVelocity);
-                bufferToFill.addEvent(msgOn, i);
-                if (i + metronomeTickLengthInSamples < getGlobalSettings().samplesPerSlice){
-                    juce::MidiMessage msgOff = juce::MidiMessage::noteOff(metronomeMidiChannel, tickIsHigh ? metronomeHighMidiNote: metronomeLowMidiNote, 0.0f);
-                    #if !RPI_BUILD
-                    // Don't send note off messages in RPI_BUILD as it messed up external metronome
-                    // Should investigate why...
-                    bufferToFill.addEvent(msgOff, i + metronomeTickLengthInSamples);
-                    #endif
-                } else {
-                    metronomePendingNoteOffSamplePosition = i + metronomeTickLengthInSamples - getGlobalSettings().samplesPerSlice;
-                    metronomePendingNoteOffIsHigh = tickIsHigh;
-                }
+            // Bar counter is updated before rendering the metronome, so the first beat of a bar is the last counted bar position
+            bool tickIsHigh = tickTime == lastBarCountedPlayheadPosition;
+            juce::MidiMessage msgOn = juce::MidiMessage::noteOn(metronomeMidiChannel, tickIsHigh ? metronomeHighMidiNote: metronomeLowMidiNote, metronomeMidiVelocity);
+            bufferToFill.addEvent(msgOn, i);
+            if (i + metronomeTickLengthInSamples < samplesPerSlice){
+                juce::MidiMessage msgOff = juce::MidiMessage::noteOff(metronomeMidiChannel, tickIsHigh ? metronomeHighMidiNote: metronomeLowMidiNote, 0.0f);
+                #if !RPI_BUILD
+                // Don't send note off messages in RPI_BUILD as it messed up external metronome
+                // Should investigate why...
+                bufferToFill.addEvent(msgOff, i + metronomeTickLengthInSamples);
+                #endif
+            } else {
+                metronomePendingNoteOffSamplePosition = i + metronomeTickLengthInSamples - samplesPerSlice;
+                metronomePendingNoteOffIsHigh = tickIsHigh;
             }
-            
-            previousBeat = nextBeat;
         }
     }
 }
 
-void MusicalContext::renderMidiClockInSlice(juce::MidiBuffer& bufferToFill)
+void MusicalContext::renderMidiClockInSlice(juce::MidiBuffer& bufferToFill, int ticksPerBeat, double offsetMs)
 {
-    // Addd 24 ticks per beat
+    // Add ticksPerBeat clock ticks per beat. Tick positions are computed from the beat range of the slice (so the cost
+    // depends on the number of ticks and not on the number of samples in the slice). A positive offset delays the clock
+    // by offsetMs (and a negative offset sends it earlier). Ticks are never rendered before the first one (tick 0), which is
+    // rendered in the slice in which playback starts right after the MIDI start message. With a negative offset, the ticks
+    // which should have been sent before playback started are all sent at the start of that slice.
     if (isPlaying){
-        double previousBeat = playheadPositionInBeats;
-        double beatsPerSample = 1.0 / (60.0 * getGlobalSettings().sampleRate / getBpm());
-        for (int i=0; i<getGlobalSettings().samplesPerSlice; i++){
-            double nextBeat = previousBeat + beatsPerSample;
-            double previousBeatNearestQuantized = std::round(previousBeat * 24.0) / 24.0;
-            double nextBeatNearestQuantized = std::round(nextBeat * 24.0) / 24.0;
-            if (previousBeat <= previousBeatNearestQuantized && previousBeatNearestQuantized < nextBeat){
-                // If previousBeatNearestQuantized is in the middle of both beats, add midi clock tick
-                juce::MidiMessage clockMsg = juce::MidiMessage::midiClock();
-                bufferToFill.addEvent(clockMsg, i);
-            }
-            else if (previousBeat <= nextBeatNearestQuantized && nextBeatNearestQuantized < nextBeat) {
-                // If nextBeatNearestQuantized is in the middle of both beats, add midi clock tick
-                juce::MidiMessage clockMsg = juce::MidiMessage::midiClock();
-                bufferToFill.addEvent(clockMsg, i);
-            }
-            previousBeat = nextBeat;
+        int samplesPerSlice = getGlobalSettings().samplesPerSlice;
+        juce::Range<double> sliceInBeats = getSliceRangeInBeats();
+        if (sliceInBeats.getLength() <= 0.0 || samplesPerSlice <= 0){
+            return;
+        }
+        double beatsPerSample = sliceInBeats.getLength() / (double)samplesPerSlice;
+        double offsetInBeats = offsetMs * 0.001 * getGlobalSettings().sampleRate * beatsPerSample;
+        double startTick = (sliceInBeats.getStart() - offsetInBeats) * ticksPerBeat;
+        double endTick = (sliceInBeats.getEnd() - offsetInBeats) * ticksPerBeat;
+        double firstTick = playheadStartedInCurrentSlice ? 0.0 : juce::jmax(0.0, std::ceil(startTick));
+        for (double tick = firstTick; tick < endTick; tick += 1.0){
+            int i = juce::jlimit(0, samplesPerSlice - 1, (int)std::floor((tick - startTick) / ticksPerBeat / beatsPerSample));
+            juce::MidiMessage clockMsg = juce::MidiMessage::midiClock();
+            bufferToFill.addEvent(clockMsg, i);
         }
     }
 }
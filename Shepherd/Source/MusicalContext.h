@@ -14,6 +14,15 @@
 #include "helpers_shepherd.h"
 
 
+struct TimelineTempoSegment {
+    // Section of the master timeline with a constant tempo. Positions inside the segment are computed from the number of samples
+    // elapsed since its start (and not by accumulating slice lengths), so these don't drift over time.
+    juce::int64 startSample = 0;  // Position of the start of the segment in the sample clock
+    juce::int64 startTick = 0;  // Position of the start of the segment in beats (in TIMELINE_TICKS_PER_BEAT units)
+    double bpm = ShepherdDefaults::bpm;
+};
+
+
 class MusicalContext
 {
 public:
@@ -25,9 +34,12 @@ public:
     
     double getNextQuantizedBarPosition();
     double getSliceLengthInBeats();
+    juce::Range<double> getSliceRangeInBeats();
     
     double getPlayheadPositionInBeats();
+    juce::int64 getPlayheadPositionInSamples();
     void setPlayheadPosition(double newPosition);
+    void advancePlayheadBySlice();
     
     bool playheadIsPlaying();
     void setPlayheadIsPlaying(bool onOff);
@@ -52,18 +64,27 @@ public:
     
     void updateBarsCounter(juce::Range<double> currentSliceRange);
     void resetCounters();
+    void continueTransportFrom(const MusicalContext& other);
     int getBarCount();
     double getBeatsInBarCount();
     
     void renderMetronomeInSlice(juce::MidiBuffer& bufferToFill);
-    void renderMidiClockInSlice(juce::MidiBuffer& bufferToFill);
+    void renderMidiClockInSlice(juce::MidiBuffer& bufferToFill, int ticksPerBeat, double offsetMs);
     void renderMidiStartInSlice(juce::MidiBuffer& bufferToFill);
     void renderMidiStopInSlice(juce::MidiBuffer& bufferToFill);
     
 private:
     
+    // The master timeline is a sample clock (playheadPositionInSamples) which is mapped to beats using the current tempo segment.
+    // playheadPositionInBeats is always derived from it and never incremented directly.
+    juce::int64 playheadPositionInSamples = 0;
+    TimelineTempoSegment tempoSegment;
+    double samplesToBeats(juce::int64 samplePosition);
+    void startTempoSegment(juce::int64 startSample, double startBeats, double segmentBpm);
+    
     double playheadPositionInBeats = ShepherdDefaults::playheadPosition;
     bool isPlaying = ShepherdDefaults::playing;
+    bool playheadStartedInCurrentSlice = false;  // Used to render the first MIDI clock ticks after a MIDI start message
     bool doingCountIn = ShepherdDefaults::doingCountIn;
     double countInPlayheadPositionInBeats = ShepherdDefaults::playheadPosition;
     int barCount = ShepherdDefaults::barCount;
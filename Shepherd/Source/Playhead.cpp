@@ -12,11 +12,11 @@
 
 Playhead::Playhead(const juce::ValueTree& _state,
                    std::function<juce::Range<double>()> parentSliceGetter,
-                   std::function<double()> localSliceLengthGetter
+                   std::function<double()> bpmMultiplierGetter
                    ): state(_state)
 {
     getParentSlice = parentSliceGetter;
-    getLocalSliceLength = localSliceLengthGetter;
+    getBpmMultiplier = bpmMultiplierGetter;
     bindState();
 }
 
@@ -128,8 +128,21 @@ void Playhead::captureSlice()
     if (! playing)
         return;
     
-    const auto sliceLength = getLocalSliceLength(); //getParentSlice().getLength();
-    currentSlice.setEnd(currentSlice.getStart() + sliceLength);
+    // Instead of adding the slice length to the current position in every slice (which accumulates rounding errors), the
+    // position is derived from the parent's slice. If the parent's slice does not continue the previous one (e.g. the
+    // global playhead was moved or tempo changed) or the bpm multiplier changed, the playhead is re-anchored so that
+    // it continues from its current position.
+    const auto parentSlice = getParentSlice();
+    const double bpmMultiplier = getBpmMultiplier();
+    if (shouldReanchor || parentSlice.getStart() != lastParentSliceEnd || bpmMultiplier != anchorBpmMultiplier){
+        anchorBpmMultiplier = bpmMultiplier;
+        anchorInParentBeats = parentSlice.getStart() - currentSlice.getStart() / anchorBpmMultiplier;
+        shouldReanchor = false;
+    } else {
+        currentSlice.setStart((parentSlice.getStart() - anchorInParentBeats) * anchorBpmMultiplier);
+    }
+    currentSlice.setEnd((parentSlice.getEnd() - anchorInParentBeats) * anchorBpmMultiplier);
+    lastParentSliceEnd = parentSlice.getEnd();
 }
 
 void Playhead::releaseSlice()
@@ -147,10 +160,12 @@ void Playhead::resetSlice()
 {
     currentSlice = {0.0, 0.0};
     playheadPositionInBeats = currentSlice.getStart();
+    shouldReanchor = true;
 }
 
 void Playhead::resetSlice(double sliceOffset)
 {
     currentSlice = {-sliceOffset, -sliceOffset};
     playheadPositionInBeats = currentSlice.getStart();
+    shouldReanchor = true;
 }
@@ -18,7 +18,7 @@ class Playhead
 public:
     Playhead(const juce::ValueTree& state,
              std::function<juce::Range<double>()> parentSliceGetter,
-             std::function<double()> localSliceLengthGetter);
+             std::function<double()> bpmMultiplierGetter);
     void bindState();
     void updateStateMemberVersions();
     juce::ValueTree state;
@@ -34,6 +34,7 @@ public:
     bool isCuedToPlay() const;
     bool isCuedToStop() const;
     bool hasJustStopped();
+    bool hasJustStoppedFlagSet() const { return hasJustStoppedFlag; };
     double getPlayAtCueBeats() const;
     double getStopAtCueBeats() const;
     void clearPlayCue();
@@ -46,10 +47,17 @@ public:
 
     juce::Range<double> getCurrentSlice() const noexcept;
     std::function<juce::Range<double>()> getParentSlice;
-    std::function<double()> getLocalSliceLength;
+    std::function<double()> getBpmMultiplier;
 
 private:
     juce::Range<double> currentSlice { 0.0, 0.0 };
+    
+    // The playhead position is derived from the parent's position as (parentPosition - anchorInParentBeats) * anchorBpmMultiplier.
+    // The anchor is only updated when the position is reset or the parent/multiplier changes in a non-continuous way.
+    double anchorInParentBeats = 0.0;
+    double anchorBpmMultiplier = 1.0;
+    double lastParentSliceEnd = 0.0;
+    bool shouldReanchor = true;
     double playheadPositionInBeats = ShepherdDefaults::playheadPosition;
     bool playing = ShepherdDefaults::playing;
     double willPlayAt = ShepherdDefaults::willPlayAt;
@@ -0,0 +1,194 @@
+/*
+  ==============================================================================
+
+    SequenceEditHistory.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+#include "SequenceEventStore.h"
+
+
+/** Undo/redo history of the sequence events of a clip. Instead of storing a full copy of the sequence for each
+ undo level, each level (a "step") stores only the events that changed since the corresponding checkpoint was
+ created (their contents before and after the changes). Undoing or redoing a step is therefore proportional to the
+ number of changed events and not to the size of the sequence, and unchanged events are never duplicated in memory.
+ The number of levels and the memory used by the history are bounded, older steps are discarded first.
+ NOTE: this should NOT be used from RT thread
+ */
+class SequenceEditHistory
+{
+public:
+    SequenceEditHistory()
+    {
+    }
+
+    void setLimits(int newMaxLevels, size_t newMemoryBudgetBytes)
+    {
+        maxLevels = juce::jmax(1, newMaxLevels);
+        memoryBudgetBytes = newMemoryBudgetBytes;
+        enforceLimits();
+    }
+
+    void clear()
+    {
+        undoSteps.clear();
+        redoSteps.clear();
+        usedMemoryBytes = 0;
+    }
+
+    bool canUndo() const { return undoSteps.size() > 0; }
+    bool canRedo() const { return redoSteps.size() > 0; }
+    int getNumUndoLevels() const { return (int)undoSteps.size(); }
+    size_t getUsedMemoryBytes() const { return usedMemoryBytes; }
+
+    void addCheckpoint(double clipLengthInBeats)
+    {
+        // Starts a new step. Changes made from now on will be reverted by the next call to undo.
+        redoSteps.clear();
+        undoSteps.emplace_back();
+        undoSteps.back().clipLengthBefore = clipLengthInBeats;
+        recomputeUsedMemory();
+        enforceLimits();
+    }
+
+    void recordChange(const SequenceEventRecord* before, const SequenceEventRecord* after)
+    {
+        // Called by the SequenceEventStore for every added (before == nullptr), removed (after == nullptr) or updated
+        // record. Changes are only recorded if there is a checkpoint to go back to. If the same event is changed several
+        // times in the same step, only its first "before" and last "after" versions are kept.
+        if (isApplyingStep || undoSteps.size() == 0){
+            return;
+        }
+        if (redoSteps.size() > 0){
+            // Changes made after undoing invalidate the redo history
+            redoSteps.clear();
+            recomputeUsedMemory();
+        }
+        Step& step = undoSteps.back();
+        const UuidKey& uuid = before != nullptr ? before->uuid : after->uuid;
+        auto it = step.changeIndexByUuid.find(uuid);
+        if (it == step.changeIndexByUuid.end()){
+            EventChange change;
+            change.uuid = uuid;
+            change.existedBefore = before != nullptr;
+            if (before != nullptr) change.before = *before;
+            step.changeIndexByUuid[uuid] = (int)step.changes.size();
+            step.changes.push_back(change);
+            usedMemoryBytes += bytesPerChange;
+            if (usedMemoryBytes > memoryBudgetBytes){
+                enforceLimits();
+            }
+        }
+        // NOTE: enforceLimits never removes the current step, but it might have moved it so get it again
+        Step& currentStep = undoSteps.back();
+        EventChange& change = currentStep.changes[currentStep.changeIndexByUuid[uuid]];
+        change.existsAfter = after != nullptr;
+        if (after != nullptr) change.after = *after;
+    }
+
+    bool undo(SequenceEventStore& store, double& clipLengthInBeats)
+    {
+        // Reverts the changes of the last step, returns false if there was nothing to undo
+        if (undoSteps.size() == 0){
+            return false;
+        }
+        Step step = std::move(undoSteps.back());
+        undoSteps.pop_back();
+        step.clipLengthAfter = clipLengthInBeats;
+        applyStep(store, step, true);
+        clipLengthInBeats = step.clipLengthBefore;
+        redoSteps.push_back(std::move(step));
+        return true;
+    }
+
+    bool redo(SequenceEventStore& store, double& clipLengthInBeats)
+    {
+        // Re-applies the changes of the last undone step, returns false if there was nothing to redo
+        if (redoSteps.size() == 0){
+            return false;
+        }
+        Step step = std::move(redoSteps.back());
+        redoSteps.pop_back();
+        applyStep(store, step, false);
+        clipLengthInBeats = step.clipLengthAfter;
+        undoSteps.push_back(std::move(step));
+        return true;
+    }
+
+private:
+    struct EventChange
+    {
+        UuidKey uuid;
+        bool existedBefore = false;
+        bool existsAfter = false;
+        SequenceEventRecord before;
+        SequenceEventRecord after;
+    };
+
+    struct Step
+    {
+        std::vector<EventChange> changes;
+        std::unordered_map<UuidKey, int, UuidKeyHash> changeIndexByUuid;
+        double clipLengthBefore = 0.0;
+        double clipLengthAfter = 0.0;
+    };
+
+    // Approximate memory used by each recorded change (including its entry in the index)
+    static constexpr size_t bytesPerChange = sizeof(EventChange) + sizeof(UuidKey) + 4 * sizeof(void*);
+    static constexpr size_t bytesPerStep = sizeof(Step);
+
+    std::vector<Step> undoSteps;  // NOTE: not a std::deque as that allocates memory even when empty (and most clips never use undo)
+    std::vector<Step> redoSteps;
+    int maxLevels = ShepherdDefaults::clipUndoLevels;
+    size_t memoryBudgetBytes = (size_t)ShepherdDefaults::clipUndoMemoryBudgetBytes;
+    size_t usedMemoryBytes = 0;
+    bool isApplyingStep = false;
+
+    void applyStep(SequenceEventStore& store, const Step& step, bool revert)
+    {
+        // Set all changed events to their "before" (revert) or "after" contents. Changes made to the store here must
+        // not be recorded as new changes.
+        isApplyingStep = true;
+        for (auto& change: step.changes){
+            bool shouldExist = revert ? change.existedBefore : change.existsAfter;
+            const SequenceEventRecord& target = revert ? change.before : change.after;
+            int index = store.indexOf(change.uuid);
+            if (index > -1 && shouldExist){
+                store.update(index, target);
+            } else if (index > -1){
+                store.remove(index);
+            } else if (shouldExist){
+                store.add(target);
+            }
+        }
+        isApplyingStep = false;
+    }
+
+    void recomputeUsedMemory()
+    {
+        usedMemoryBytes = 0;
+        for (auto& step: undoSteps) usedMemoryBytes += bytesPerStep + step.changes.size() * bytesPerChange;
+        for (auto& step: redoSteps) usedMemoryBytes += bytesPerStep + step.changes.size() * bytesPerChange;
+    }
+
+    void enforceLimits()
+    {
+        // Discard the oldest steps until the number of levels and the used memory are within limits. The most recent
+        // step is always kept (even if it alone exceeds the memory budget) so that it can still be undone.
+        int numStepsToDiscard = 0;
+        while ((int)undoSteps.size() - numStepsToDiscard > 1 && ((int)undoSteps.size() - numStepsToDiscard > maxLevels || usedMemoryBytes > memoryBudgetBytes)){
+            usedMemoryBytes -= bytesPerStep + undoSteps[numStepsToDiscard].changes.size() * bytesPerChange;
+            numStepsToDiscard += 1;
+        }
+        if (numStepsToDiscard > 0){
+            undoSteps.erase(undoSteps.begin(), undoSteps.begin() + numStepsToDiscard);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SequenceEditHistory)
+};
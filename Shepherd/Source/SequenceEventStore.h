@@ -0,0 +1,457 @@
+/*
+  ==============================================================================
+
+    SequenceEventStore.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+struct SequenceEventRecord {
+    // Fixed-size representation of a SEQUENCE_EVENT. Generic MIDI events keep their raw bytes instead of the
+    // comma-separated string used in the state, so no string parsing/formatting is needed to render them.
+    // Note that rendered timestamps are not part of the record as these depend on the clip which renders it.
+    UuidKey uuid;
+    int type = SequenceEventType::midi;
+    double timestamp = 0.0;
+    double uTime = ShepherdDefaults::uTime;
+
+    // Used by events of type "note"
+    int midiNote = 0;
+    float midiVelocity = 0.0f;
+    double duration = 0.0;
+    float chance = ShepherdDefaults::chance;
+
+    // Used by events of type "midi"
+    int numMidiBytes = 0;
+    juce::uint8 midiBytes[3] = {0, 0, 0};
+};
+
+struct SequenceEventBlock: juce::ReferenceCountedObject
+{
+    // Block of sequence event records which can be shared by several SequenceEventStore objects (eg: when clips are
+    // duplicated, or in undo snapshots). A block must not be modified while shared, SequenceEventStore makes a copy
+    // of it before the first modification (copy-on-write).
+    using Ptr = juce::ReferenceCountedObjectPtr<SequenceEventBlock>;
+    std::vector<SequenceEventRecord> records;
+    std::unordered_map<UuidKey, int, UuidKeyHash> indexByUuid;  // Index of each record in "records"
+};
+
+
+/** Stores the sequence events of a clip as SequenceEventRecord objects. This is the source of truth for the
+ sequence contents. SEQUENCE_EVENT children are still kept in the clip state (the "projection") so the UI receives
+ them as before, but these are only written from the store and never read back while rendering the sequence.
+ NOTE: this should NOT be used from RT thread
+ */
+class SequenceEventStore
+{
+public:
+    SequenceEventStore()
+    {
+    }
+
+    void loadFromState(const juce::ValueTree& clipState)
+    {
+        // Bind the store to the given clip state and load all SEQUENCE_EVENT children from it
+        state = clipState;
+        block = getSharedEmptyBlock();
+        projection.clear();
+        projectionIsContiguous = true;
+        firstProjectionChildIndex = 0;
+        for (int i=0; i<state.getNumChildren(); i++){
+            auto child = state.getChild(i);
+            if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+                makeBlockWritable();
+                block->records.push_back(recordFromValueTree(child));
+                block->indexByUuid[block->records.back().uuid] = (int)block->records.size() - 1;
+                if (projection.size() == 0){
+                    firstProjectionChildIndex = i;
+                } else if (i != firstProjectionChildIndex + (int)projection.size()){
+                    projectionIsContiguous = false;
+                }
+                projection.push_back(child);
+            }
+        }
+    }
+
+    int size() const { return (int)block->records.size(); }
+    int getVersion() const { return version; }
+    const SequenceEventRecord& operator[] (int index) const { return block->records[index]; }
+    const std::vector<SequenceEventRecord>& getRecords() const { return block->records; }
+    SequenceEventBlock::Ptr getBlock() const { return block; }
+
+    int indexOf(const UuidKey& uuid) const
+    {
+        auto it = block->indexByUuid.find(uuid);
+        if (it != block->indexByUuid.end()){
+            return it->second;
+        }
+        return -1;
+    }
+
+    // If set, called for every added (before == nullptr), removed (after == nullptr) or updated record (used to keep
+    // the undo history, see SequenceEditHistory). Not called when loading records from the state.
+    std::function<void(const SequenceEventRecord* before, const SequenceEventRecord* after)> onRecordChanged;
+
+    void add(const SequenceEventRecord& record)
+    {
+        if (onRecordChanged) onRecordChanged(nullptr, &record);
+        makeBlockWritable();
+        block->records.push_back(record);
+        block->indexByUuid[record.uuid] = (int)block->records.size() - 1;
+        projection.push_back(recordToValueTree(record));
+        // Keep SEQUENCE_EVENT children contiguous by adding the new one right after the previous last one
+        int childIndex = (projectionIsContiguous && projection.size() > 1) ? getProjectionChildIndex((int)projection.size() - 2) + 1 : -1;
+        state.addChild(projection.back(), childIndex, nullptr);
+        version += 1;
+    }
+
+    void remove(int index)
+    {
+        // The order of the records is not relevant (events are sorted when rendering the sequence), so the removed
+        // record is replaced by the last one to avoid shifting all the following records and their indexes
+        jassert(juce::isPositiveAndBelow(index, size()));
+        if (onRecordChanged) onRecordChanged(&block->records[index], nullptr);
+        makeBlockWritable();
+        auto& records = block->records;
+        int lastIndex = (int)records.size() - 1;
+        if (projectionIsContiguous){
+            // Also move the child of the last record to the position of the removed one so children stay in projection order
+            int childIndex = getProjectionChildIndex(index);
+            int lastChildIndex = getProjectionChildIndex(lastIndex);
+            state.removeChild(childIndex, nullptr);
+            if (index != lastIndex){
+                state.moveChild(lastChildIndex - 1, childIndex, nullptr);
+            }
+        } else {
+            state.removeChild(projection[index], nullptr);
+        }
+        block->indexByUuid.erase(records[index].uuid);
+        if (index != lastIndex){
+            records[index] = records[lastIndex];
+            projection[index] = projection[lastIndex];
+            block->indexByUuid[records[index].uuid] = index;
+        }
+        records.pop_back();
+        projection.pop_back();
+        version += 1;
+    }
+
+    void addAll(const std::vector<SequenceEventRecord>& newRecords)
+    {
+        makeBlockWritable();
+        block->records.reserve(block->records.size() + newRecords.size());
+        block->indexByUuid.reserve(block->indexByUuid.size() + newRecords.size());
+        projection.reserve(projection.size() + newRecords.size());
+        for (auto& record: newRecords){
+            add(record);
+        }
+    }
+
+    void replaceAll(const std::vector<SequenceEventRecord>& newRecords)
+    {
+        SequenceEventBlock::Ptr newBlock = new SequenceEventBlock();
+        newBlock->records = newRecords;
+        for (int i=0; i<(int)newBlock->records.size(); i++){
+            newBlock->indexByUuid[newBlock->records[i].uuid] = i;
+        }
+        replaceAll(newBlock);
+    }
+
+    void replaceAll(SequenceEventBlock::Ptr newBlock)
+    {
+        // Replace the records by the ones in newBlock, without copying them (the block will be shared)
+        // Remove SEQUENCE_EVENT children starting from the end of the state so that each removal is O(1) (removing
+        // children by reference or from the start would make the whole operation O(n^2) for big sequences)
+        if (onRecordChanged){
+            for (auto& record: block->records) onRecordChanged(&record, nullptr);
+            for (auto& record: newBlock->records) onRecordChanged(nullptr, &record);
+        }
+        for (int i=state.getNumChildren() - 1; i>=0; i--){
+            if (state.getChild(i).hasType(ShepherdIDs::SEQUENCE_EVENT)){
+                state.removeChild(i, nullptr);
+            }
+        }
+        block = newBlock;
+        projection.clear();
+        projection.reserve(block->records.size());
+        projectionIsContiguous = true;
+        firstProjectionChildIndex = state.getNumChildren();
+        for (auto& record: block->records){
+            projection.push_back(recordToValueTree(record));
+            state.addChild(projection.back(), -1, nullptr);
+        }
+        version += 1;
+    }
+
+    void replaceAllWithContentsOf(const SequenceEventStore& other, bool replaceUUIDs)
+    {
+        // Share the records of another store (copying them only if new UUIDs are needed) and also copy the rendered
+        // timestamps of its projection so these don't need to be computed again
+        if (replaceUUIDs){
+            std::vector<SequenceEventRecord> newRecords = other.getRecords();
+            for (auto& record: newRecords){
+                record.uuid = UuidKey::createNew();
+            }
+            replaceAll(newRecords);
+        } else {
+            replaceAll(other.getBlock());
+        }
+        jassert(projection.size() == other.projection.size());
+        for (int i=0; i<(int)projection.size(); i++){
+            setRenderedTimestamps(i, other.projection[i].getProperty(ShepherdIDs::renderedStartTimestamp), other.projection[i].getProperty(ShepherdIDs::renderedEndTimestamp));
+        }
+    }
+
+    void clear()
+    {
+        replaceAll(getSharedEmptyBlock());
+    }
+
+    void update(int index, const SequenceEventRecord& record)
+    {
+        // Replace the record at index and update the projected properties that changed
+        jassert(juce::isPositiveAndBelow(index, size()));
+        if (onRecordChanged) onRecordChanged(&block->records[index], &record);
+        makeBlockWritable();
+        block->records[index] = record;
+        writeRecordToValueTree(record, projection[index]);
+        version += 1;
+    }
+
+    void setRenderedTimestamps(int index, double renderedStartTimestamp, double renderedEndTimestamp)
+    {
+        // NOTE: ValueTree::setProperty does not notify listeners if the value did not change
+        projection[index].setProperty(ShepherdIDs::renderedStartTimestamp, renderedStartTimestamp, nullptr);
+        projection[index].setProperty(ShepherdIDs::renderedEndTimestamp, renderedEndTimestamp, nullptr);
+    }
+
+    //==============================================================================
+
+    static SequenceEventRecord createNoteRecord(double timestamp, int note, float velocity, double duration, double utime, float chance)
+    {
+        SequenceEventRecord record;
+        record.uuid = UuidKey::createNew();
+        record.type = SequenceEventType::note;
+        record.timestamp = timestamp;
+        record.uTime = utime;
+        record.midiNote = note;
+        record.midiVelocity = velocity;
+        record.duration = duration;
+        record.chance = chance;
+        return record;
+    }
+
+    static SequenceEventRecord createNoteRecord(double timestamp, int note, float velocity, double duration)
+    {
+        return createNoteRecord(timestamp, note, velocity, duration, ShepherdDefaults::uTime, ShepherdDefaults::chance);
+    }
+
+    static SequenceEventRecord createMidiRecord(const juce::MidiMessage& msg)
+    {
+        SequenceEventRecord record;
+        record.uuid = UuidKey::createNew();
+        record.type = SequenceEventType::midi;
+        record.timestamp = msg.getTimeStamp();
+        record.numMidiBytes = juce::jmin(msg.getRawDataSize(), 3);
+        for (int i=0; i<record.numMidiBytes; i++){
+            record.midiBytes[i] = msg.getRawData()[i];
+        }
+        return record;
+    }
+
+    static SequenceEventRecord createMidiRecord(double timestamp, const juce::String& eventMidiBytes, double utime)
+    {
+        SequenceEventRecord record;
+        record.uuid = UuidKey::createNew();
+        record.type = SequenceEventType::midi;
+        record.timestamp = timestamp;
+        record.uTime = utime;
+        parseMidiBytesString(eventMidiBytes, record);
+        return record;
+    }
+
+    static SequenceEventRecord createRecordFromJson(const juce::var& eventData)
+    {
+        // Create a new record (with new UUID) from the JSON representation of events used in /clip/setSequence and /clip/editSequence
+        SequenceEventRecord record;
+        if ((int)eventData["type"] == SequenceEventType::note){
+            record = createNoteRecord((double)eventData["timestamp"],
+                                      (int)eventData["midiNote"],
+                                      (float)eventData["midiVelocity"],
+                                      (double)eventData["duration"],
+                                      (double)eventData.getProperty("utime", ShepherdDefaults::uTime),
+                                      (float)eventData.getProperty("chance", ShepherdDefaults::chance));
+        } else {
+            record = createMidiRecord((double)eventData["timestamp"],
+                                      eventData["eventMidiBytes"].toString(),
+                                      (double)eventData.getProperty("utime", ShepherdDefaults::uTime));
+        }
+        return record;
+    }
+
+    static void applyJsonEdit(SequenceEventRecord& record, const juce::var& eventData)
+    {
+        // Update the record with the properties present in eventData (only the ones relevant for the record type)
+        if (eventData.hasProperty("timestamp")) record.timestamp = (double)eventData["timestamp"];
+        if (eventData.hasProperty("utime")) record.uTime = (double)eventData["utime"];
+        if (record.type == SequenceEventType::note){
+            if (eventData.hasProperty("midiNote")) record.midiNote = (int)eventData["midiNote"];
+            if (eventData.hasProperty("midiVelocity")) record.midiVelocity = (float)eventData["midiVelocity"];
+            if (eventData.hasProperty("chance")) record.chance = (float)eventData["chance"];
+            if (eventData.hasProperty("duration")) record.duration = (double)eventData["duration"];
+        } else if (record.type == SequenceEventType::midi){
+            if (eventData.hasProperty("eventMidiBytes")) parseMidiBytesString(eventData["eventMidiBytes"].toString(), record);
+        }
+    }
+
+    static SequenceEventRecord recordFromValueTree(const juce::ValueTree& sequenceEvent)
+    {
+        SequenceEventRecord record;
+        record.uuid = UuidKey::fromString(sequenceEvent.getProperty(ShepherdIDs::uuid).toString());
+        record.type = (int)sequenceEvent.getProperty(ShepherdIDs::type, SequenceEventType::midi);
+        record.timestamp = sequenceEvent.getProperty(ShepherdIDs::timestamp, 0.0);
+        record.uTime = sequenceEvent.getProperty(ShepherdIDs::uTime, ShepherdDefaults::uTime);
+        if (record.type == SequenceEventType::note){
+            record.midiNote = sequenceEvent.getProperty(ShepherdIDs::midiNote, 0);
+            record.midiVelocity = sequenceEvent.getProperty(ShepherdIDs::midiVelocity, 0.0f);
+            record.duration = sequenceEvent.getProperty(ShepherdIDs::duration, 0.0);
+            record.chance = sequenceEvent.getProperty(ShepherdIDs::chance, ShepherdDefaults::chance);
+        } else {
+            parseMidiBytesString(sequenceEvent.getProperty(ShepherdIDs::eventMidiBytes, ShepherdDefaults::eventMidiBytes).toString(), record);
+        }
+        return record;
+    }
+
+    static std::vector<SequenceEventRecord> recordsFromClipState(const juce::ValueTree& clipState)
+    {
+        std::vector<SequenceEventRecord> records;
+        for (auto child: clipState){
+            if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+                records.push_back(recordFromValueTree(child));
+            }
+        }
+        return records;
+    }
+
+    static juce::ValueTree recordToValueTree(const SequenceEventRecord& record)
+    {
+        juce::ValueTree sequenceEvent {ShepherdIDs::SEQUENCE_EVENT};
+        writeRecordToValueTree(record, sequenceEvent);
+        sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, -1.0, nullptr);
+        sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, -1.0, nullptr);
+        return sequenceEvent;
+    }
+
+    static void writeRecordToValueTree(const SequenceEventRecord& record, juce::ValueTree& sequenceEvent)
+    {
+        // NOTE: ValueTree::setProperty does not notify listeners if the value did not change
+        sequenceEvent.setProperty(ShepherdIDs::uuid, record.uuid.toString(), nullptr);
+        sequenceEvent.setProperty(ShepherdIDs::type, record.type, nullptr);
+        sequenceEvent.setProperty(ShepherdIDs::timestamp, record.timestamp, nullptr);
+        sequenceEvent.setProperty(ShepherdIDs::uTime, record.uTime, nullptr);
+        if (record.type == SequenceEventType::note){
+            sequenceEvent.setProperty(ShepherdIDs::midiNote, record.midiNote, nullptr);
+            sequenceEvent.setProperty(ShepherdIDs::midiVelocity, record.midiVelocity, nullptr);
+            sequenceEvent.setProperty(ShepherdIDs::duration, record.duration, nullptr);
+            sequenceEvent.setProperty(ShepherdIDs::chance, record.chance, nullptr);
+        } else {
+            sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, midiBytesToString(record), nullptr);
+        }
+    }
+
+    static int recordToMidiMessages(const SequenceEventRecord& record, double renderedStartTimestamp, double renderedEndTimestamp, juce::MidiMessage (&messages)[2])
+    {
+        // Fills "messages" with the MIDI messages corresponding to the record (at the given rendered timestamps) and
+        // returns the number of messages
+        // NOTE: don't care about MIDI channel here as they will be replaced when sending the notes to the appropriate output device
+        int midiChannel = 1;
+
+        if (record.type == SequenceEventType::midi) {
+            if (record.numMidiBytes == 2){
+                messages[0] = juce::MidiMessage(record.midiBytes[0], record.midiBytes[1]);
+            } else if (record.numMidiBytes == 3){
+                messages[0] = juce::MidiMessage(record.midiBytes[0], record.midiBytes[1], record.midiBytes[2]);
+            } else {
+                messages[0] = juce::MidiMessage();
+            }
+            messages[0].setChannel(midiChannel);
+            messages[0].setTimeStamp(renderedStartTimestamp);
+            return 1;
+
+        } else if (record.type == SequenceEventType::note) {
+            messages[0] = juce::MidiMessage::noteOn(midiChannel, record.midiNote, record.midiVelocity);
+            messages[0].setTimeStamp(renderedStartTimestamp);
+            messages[1] = juce::MidiMessage::noteOff(midiChannel, record.midiNote, 0.0f);
+            messages[1].setTimeStamp(renderedEndTimestamp);
+            return 2;
+        }
+        return 0;
+    }
+
+    static juce::String midiBytesToString(const SequenceEventRecord& record)
+    {
+        juce::String bytesString;
+        for (int i=0; i<record.numMidiBytes; i++){
+            if (i > 0) bytesString << ",";
+            bytesString << (int)record.midiBytes[i];
+        }
+        return bytesString;
+    }
+
+    static void parseMidiBytesString(const juce::String& bytesString, SequenceEventRecord& record)
+    {
+        // eventMidiBytes = comma separated byte values, eg: 127,75,12
+        juce::StringArray bytes;
+        bytes.addTokens(bytesString, ",", "");
+        record.numMidiBytes = juce::jmin(bytes.size(), 3);
+        for (int i=0; i<record.numMidiBytes; i++){
+            record.midiBytes[i] = (juce::uint8)bytes[i].getIntValue();
+        }
+    }
+
+private:
+    juce::ValueTree state;
+    SequenceEventBlock::Ptr block = getSharedEmptyBlock();
+    std::vector<juce::ValueTree> projection;  // SEQUENCE_EVENT children of the state, aligned with block->records
+    bool projectionIsContiguous = true;  // True if SEQUENCE_EVENT children are contiguous and in the same order as projection
+    int firstProjectionChildIndex = 0;  // Index of the child of projection[0] in the state (updated lazily, see getProjectionChildIndex)
+    
+    int getProjectionChildIndex(int index)
+    {
+        // Index in the state of the child of projection[index], derived from the index of the first one so children don't need
+        // to be searched. The first one is only searched again if other children were added or removed before it.
+        jassert(projectionIsContiguous);
+        if (state.getChild(firstProjectionChildIndex) != projection[0]){
+            firstProjectionChildIndex = state.indexOf(projection[0]);
+        }
+        return firstProjectionChildIndex + index;
+    }
+    
+    static SequenceEventBlock::Ptr getSharedEmptyBlock()
+    {
+        // All empty stores share the same empty block so that empty clips don't need to allocate one each. The block is
+        // never modified as the static pointer keeps it shared (see makeBlockWritable).
+        static SequenceEventBlock::Ptr emptyBlock = new SequenceEventBlock();
+        return emptyBlock;
+    }
+    
+    void makeBlockWritable()
+    {
+        // If the block is shared with other stores (or undo snapshots), make a copy before modifying it
+        if (block->getReferenceCount() > 1){
+            SequenceEventBlock::Ptr newBlock = new SequenceEventBlock();
+            newBlock->records = block->records;
+            newBlock->indexByUuid = block->indexByUuid;
+            block = newBlock;
+        }
+    }
+    int version = 0;  // Incremented every time the sequence events are modified (rendered timestamps not included)
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SequenceEventStore)
+};
@@ -12,8 +12,10 @@
 
 
 //==============================================================================
-Sequencer::Sequencer()
+Sequencer::Sequencer(bool connectToDevicesAndController)
 {
+    // If connectToDevicesAndController is false, no MIDI devices are opened, the WebSockets server is not started and an empty
+    // session is loaded instead of the last saved one. This is used to benchmark the sequencer (see runBenchmark).
     // Initialize state as root
     state = ShepherdHelpers::createDefaultStateRoot();
     
@@ -23,36 +25,61 @@ Sequencer::Sequencer()
         location.createDirectory();
     }
     
-    // Start timer for recurring tasks
-    startTimer (50);
+    // Start timer for recurring tasks (when benchmarking these are called by runBenchmark)
+    if (connectToDevicesAndController){
+        startTimer (50);
+    }
     
     // Pre allocate memory for MIDI buffers
     // My rough tests indicate that 1 midi message takes 9 int8 array positions in the midibuffer.data structure
     // (therefore 9 bytes?). These buffers are cleared at every slice, so some milliseconds only, no need to make them super
     // big but make them considerably big to be on the safe side.
     midiClockMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    midiClockDestinationMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
     midiMetronomeMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
     pushMidiClockMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
     monitoringNotesMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    tracksReceivingInput.ensureStorageAllocated(MAX_NUM_TRACKS);
+    outputDevicesReceivingInput.ensureStorageAllocated(MAX_NUM_TRACKS);
+    for (int handle=0; handle<MAX_NUM_MIDI_DEVICES; handle++){
+        midiInDevicesByHandle[handle] = nullptr;
+        midiOutDevicesByHandle[handle] = nullptr;
+    }
 
     // Init hardware devices
     initializeHardwareDevices();
 
-    // Load some settings from file
-    sendMidiClockMidiDeviceNames = getListStringPropertyFromSettingsFile("midiDevicesToSendClockTo");
-    sendMetronomeMidiDeviceName = getStringPropertyFromSettingsFile("metronomeMidiDevice");
-    
-    // Init MIDI
-    // Better to do it after hardware devices so we init devices needed in hardware devices as well
-    initializeMIDIInputs();
-    initializeMIDIOutputs();
-    notesMonitoringMidiOutput = juce::MidiOutput::createNewDevice(SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME);
-    
-    // Init WebSockets
-    initializeWS();
-    
-    // Load first preset (if no presets saved, it will create an empty session)
-    loadSessionFromFile("0");
+    // Load settings from file (and watch the file for changes so some settings can be applied without restart)
+    backendSettings.setSettingsFile(getDataLocation().getChildFile("backendSettings").withFileExtension("json"));
+    backendSettings.onChange = [this]{ shouldApplyBackendSettings = true; };
+    applyBackendSettings();
+    applyPendingMidiDeviceSettings();  // RT thread is not running yet, we can directly apply the settings here
+    backendSettings.startWatching();
+    
+    // Create the pool of threads to process tracks in parallel (if enabled). Each track only writes to its own buffers while
+    // processing its clips, and track buffers are merged into the hardware device buffers in track order (see getNextMIDISlice)
+    int numTrackProcessingThreads = backendSettings.getSettings().trackProcessingThreads;
+    if (numTrackProcessingThreads > 0){
+        trackProcessingPool = std::make_unique<TrackProcessingPool>(numTrackProcessingThreads, [this](int trackIndex){
+            tracksForRTThread.load()->objects.getUnchecked(trackIndex)->clipsProcessSlice();
+        });
+    }
+    
+    if (connectToDevicesAndController){
+        // Init MIDI
+        // Better to do it after hardware devices so we init devices needed in hardware devices as well
+        initializeMIDIInputs();
+        initializeMIDIOutputs();
+        notesMonitoringMidiOutput = juce::MidiOutput::createNewDevice(SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME);
+        
+        // Init WebSockets
+        initializeWS();
+        
+        // Load first preset (if no presets saved, it will create an empty session)
+        loadSessionFromFile("0");
+    } else {
+        loadNewEmptySession(DEFAULT_NUM_TRACKS, DEFAULT_NUM_SCENES);
+    }
 
     sequencerInitialized = true;
 }
@@ -87,14 +114,7 @@ juce::File Sequencer::getDataLocation() {
 
 void Sequencer::saveCurrentSessionToFile(juce::String filePath)
 {
-    juce::File outputFile;
-    if (juce::File::isAbsolutePath(filePath)){
-        // File path is an absolute path to a file where to save the session
-        outputFile = juce::File(filePath);
-    } else {
-        // File path is the name of the file only, save it in the default location
-        outputFile = getDataLocation().getChildFile(filePath).withFileExtension("xml");
-    }
+    juce::File outputFile = getSessionFile(filePath);
     
     // Get the part of the state that corresponds to the session, remove things from it like playhead positions,
     // play/recording state and other things which are "voaltile"
@@ -168,8 +188,8 @@ bool Sequencer::validateAndUpdateStateToLoad(juce::ValueTree& stateToCheck)
                     nClips += 1;
                     for (int k=0; k<secondLevelChild.getNumChildren(); k++){
                         auto thirdLevelChild = secondLevelChild.getChild(k);
-                        if (!thirdLevelChild.hasType(ShepherdIDs::SEQUENCE_EVENT)){
-                            DBG("Clip element contains child elements of type other than SEQUENCE_EVENT");
+                        if (!thirdLevelChild.hasType(ShepherdIDs::SEQUENCE_EVENT) && !thirdLevelChild.hasType(ShepherdIDs::AUTOMATION_LANE)){
+                            DBG("Clip element contains child elements of type other than SEQUENCE_EVENT or AUTOMATION_LANE");
                             return false;
                         }
                     }
@@ -192,6 +212,8 @@ bool Sequencer::validateAndUpdateStateToLoad(juce::ValueTree& stateToCheck)
 
 void Sequencer::loadSession(juce::ValueTree& stateToLoad)
 {
+    const juce::ScopedLock sl (sessionObjectsLock);
+    
     // Make some checks about the state which is about to be loaded, and if all is fine, proceed loading state
     if (validateAndUpdateStateToLoad(stateToLoad)){
         
@@ -201,6 +223,10 @@ void Sequencer::loadSession(juce::ValueTree& stateToLoad)
             // the RT thread has time to be executed and clips set to stop (with note offs sent)
             if (musicalContext->playheadIsPlaying()){ shouldToggleIsPlaying = true; }
             juce::Time::waitForMillisecondCounter(juce::Time::getMillisecondCounter() + 50);
+            
+            // If a preloaded session was waiting to be switched in, forget about it (or, if the RT thread already switched
+            // to it, finish the switch so that its objects are owned by the sequencer and deleted when replaced below)
+            discardPreloadedSession();
 
             // Remove current state VT listener
             state.removeListener(this);
@@ -215,30 +241,11 @@ void Sequencer::loadSession(juce::ValueTree& stateToLoad)
         // Add state change listener and bind cached properties to state properties
         bindState();
         
-        // Initialize musical context
-        musicalContext = std::make_unique<MusicalContext>([this]{return getGlobalSettings();}, state.getChildWithName(ShepherdIDs::SESSION));
-        const int metronomeMidiChannel = getIntPropertyFromSettingsFile("metronomeMidiChannel");
-        if (metronomeMidiChannel != -1){
-            musicalContext->setMetronomeMidiChannel(metronomeMidiChannel);
-        }
-        
-        // Initialize tracks
-        tracks = std::make_unique<TrackList>(state.getChildWithName(ShepherdIDs::SESSION),
-                                             [this]{
-                                                 return juce::Range<double>{musicalContext->getPlayheadPositionInBeats(), musicalContext->getPlayheadPositionInBeats() + musicalContext->getSliceLengthInBeats()};
-                                             },
-                                             [this]{
-                                                 return getGlobalSettings();
-                                             },
-                                             [this]{
-                                                 return musicalContext.get();
-                                             },
-                                             [this](juce::String deviceName, HardwareDeviceType type){
-                                                 return getHardwareDeviceByName(deviceName, type);
-                                             },
-                                             [this](juce::String deviceName){
-                                                 return getMidiOutputDeviceData(deviceName);
-                                             });
+        // Initialize musical context and tracks (the RT thread discards the cues scheduled for the clips of the previous
+        // session once it starts using the new tracks)
+        auto newMusicalContext = createMusicalContext(state.getChildWithName(ShepherdIDs::SESSION));
+        auto newTracks = createTracks(state.getChildWithName(ShepherdIDs::SESSION), newMusicalContext.get());
+        replaceSessionObjects(std::move(newMusicalContext), std::move(newTracks));
         
         // Send message to frontend indiating that Shepherd is ready to rock
         sendMessageToController(juce::OSCMessage(ACTION_ADDRESS_STARTED_MESSAGE));  // For new state synchroniser
@@ -255,17 +262,67 @@ void Sequencer::loadNewEmptySession(int numTracks, int numScenes)
     loadSession(stateToLoad);
 }
 
-void Sequencer::loadSessionFromFile(juce::String filePath)
+std::unique_ptr<MusicalContext> Sequencer::createMusicalContext(const juce::ValueTree& sessionState)
+{
+    auto newMusicalContext = std::make_unique<MusicalContext>([this]{return getGlobalSettings();}, sessionState);
+    const int metronomeMidiChannel = backendSettings.getSettings().metronomeMidiChannel;
+    if (metronomeMidiChannel != -1){
+        newMusicalContext->setMetronomeMidiChannel(metronomeMidiChannel);
+    }
+    return newMusicalContext;
+}
+
+std::unique_ptr<TrackList> Sequencer::createTracks(const juce::ValueTree& sessionState, MusicalContext* sessionMusicalContext)
+{
+    // NOTE: the lambdas passed here refer to the MusicalContext object of the same session (and not to the musicalContext
+    // member of the sequencer) so that the tracks of a preloaded session can be used before the session objects are replaced
+    return std::make_unique<TrackList>(sessionState,
+                                       [sessionMusicalContext]{
+                                           return sessionMusicalContext->getSliceRangeInBeats();
+                                       },
+                                       [this]{
+                                           return getGlobalSettings();
+                                       },
+                                       [sessionMusicalContext]{
+                                           return sessionMusicalContext;
+                                       },
+                                       [this](juce::String deviceName, HardwareDeviceType type){
+                                           return getHardwareDeviceByName(deviceName, type);
+                                       },
+                                       [this]{
+                                           return &cueScheduler;
+                                       });
+}
+
+void Sequencer::replaceSessionObjects(std::unique_ptr<MusicalContext> newMusicalContext, std::unique_ptr<TrackList> newTracks)
+{
+    // Publish the new session objects for the RT thread, then wait until it is not processing a block before deleting the
+    // replaced ones as it could still be using them (this should take no longer than processing one block)
+    const juce::ScopedLock sl (sessionObjectsLock);
+    musicalContextForRTThread = newMusicalContext.get();
+    tracksForRTThread = newTracks.get();
+    while (isProcessingBlock.load()){
+        juce::Thread::yield();
+    }
+    musicalContext = std::move(newMusicalContext);
+    tracks = std::move(newTracks);
+}
+
+juce::File Sequencer::getSessionFile(juce::String filePath)
 {
-    bool stateLoadedFromFileSuccessfully = false;
-    juce::File sessionFile;
     if (juce::File::isAbsolutePath(filePath)){
-        // File path is an absolute path to a file where to save the session
-        sessionFile = juce::File(filePath);
+        // File path is an absolute path to a session file
+        return juce::File(filePath);
     } else {
-        // File path is the name of the file only, save it in the default location
-        sessionFile = getDataLocation().getChildFile(filePath).withFileExtension("xml");
+        // File path is the name of the file only, use the default location
+        return getDataLocation().getChildFile(filePath).withFileExtension("xml");
     }
+}
+
+void Sequencer::loadSessionFromFile(juce::String filePath)
+{
+    bool stateLoadedFromFileSuccessfully = false;
+    juce::File sessionFile = getSessionFile(filePath);
     juce::ValueTree stateToLoad;
     if (sessionFile.existsAsFile()){
         if (auto xml = std::unique_ptr<juce::XmlElement> (juce::XmlDocument::parse (sessionFile))){
@@ -278,62 +335,227 @@ void Sequencer::loadSessionFromFile(juce::String filePath)
     loadSession(stateToLoad);
 }
 
-juce::String Sequencer::getStringPropertyFromSettingsFile(juce::String propertyName)
+void Sequencer::preloadSessionFromFile(juce::String filePath)
 {
-    juce::String returnValue = "";
-    juce::File backendSettingsLocation = getDataLocation().getChildFile("backendSettings").withFileExtension("json");
-    if (backendSettingsLocation.existsAsFile()){
-        juce::var parsedJson;
-        auto result = juce::JSON::parse(backendSettingsLocation.loadFileAsString(), parsedJson);
-        if (result.wasOk())
-        {
-            if (parsedJson.isObject()){
-                returnValue = parsedJson.getProperty(propertyName, "").toString();
-            }
+    // Parse, validate and build all the objects of a session in a background thread so that it can later be switched in
+    // without interrupting playback (see switchToPreloadedSession)
+    int expectedStatus = PreloadedSessionStatus::ready;
+    if (!preloadedSessionStatus.compare_exchange_strong(expectedStatus, PreloadedSessionStatus::loading)){
+        expectedStatus = PreloadedSessionStatus::none;
+        if (!preloadedSessionStatus.compare_exchange_strong(expectedStatus, PreloadedSessionStatus::loading)){
+            DBG("Can't preload session while another session is being preloaded or switched");
+            return;
         }
     }
-    return returnValue;
+    
+    backgroundTasksPool.addJob([this, filePath]{
+        // If there was a previously preloaded session that was not switched, it can be safely deleted here as it was never
+        // used by the RT thread
+        preloadedSession.reset();
+        
+        juce::File sessionFile = getSessionFile(filePath);
+        juce::ValueTree stateToLoad;
+        if (sessionFile.existsAsFile()){
+            if (auto xml = std::unique_ptr<juce::XmlElement> (juce::XmlDocument::parse (sessionFile))){
+                stateToLoad = juce::ValueTree::fromXml (*xml);
+            }
+        }
+        if (!validateAndUpdateStateToLoad(stateToLoad)){
+            DBG("ERROR: Could not preload session data from " << sessionFile.getFullPathName() << " as it is incompatible or it has inconsistencies...");
+            preloadedSessionStatus = PreloadedSessionStatus::none;
+            return;
+        }
+        
+        // Create all session objects and compile clip sequences so the RT thread has everything ready when the session is switched
+        auto newPreloadedSession = std::make_unique<PreloadedSession>();
+        newPreloadedSession->sessionState = stateToLoad;
+        newPreloadedSession->musicalContext = createMusicalContext(stateToLoad);
+        newPreloadedSession->tracks = createTracks(stateToLoad, newPreloadedSession->musicalContext.get());
+        for (auto track: newPreloadedSession->tracks->objects){
+            track->clipsRecreateSequencesNow();
+        }
+        preloadedSession = std::move(newPreloadedSession);
+        preloadedSessionStatus = PreloadedSessionStatus::ready;
+        DBG("Preloaded session from: " << sessionFile.getFullPathName());
+    });
 }
 
-int Sequencer::getIntPropertyFromSettingsFile(juce::String propertyName)
+void Sequencer::switchToPreloadedSession(int barsAhead, int sceneToPlay)
 {
-    int returnValue = -1;
-    juce::File backendSettingsLocation = getDataLocation().getChildFile("backendSettings").withFileExtension("json");
-    if (backendSettingsLocation.existsAsFile()){
-        juce::var parsedJson;
-        auto result = juce::JSON::parse(backendSettingsLocation.loadFileAsString(), parsedJson);
-        if (result.wasOk())
-        {
-            if (parsedJson.isObject()){
-                returnValue = (int)parsedJson.getProperty(propertyName, "");
+    // Request the RT thread to switch to the preloaded session at the start of the bar which is barsAhead bars ahead. If the
+    // global playhead is not playing, the switch will happen in the next slice. Optionally cue clips of a scene of the
+    // preloaded session to start playing right when the switch happens.
+    if (preloadedSessionStatus != PreloadedSessionStatus::ready){
+        DBG("No preloaded session ready to be switched");
+        return;
+    }
+    
+    if (musicalContext->playheadIsPlaying()){
+        switchToPreloadedSessionAtBeats = musicalContext->getNextQuantizedBarPosition() + (double)(juce::jmax(1, barsAhead) - 1) * (double)musicalContext->getMeter();
+    } else {
+        switchToPreloadedSessionAtBeats = -1.0;
+    }
+    
+    if (sceneToPlay > -1){
+        // Preloaded objects are not yet used by the RT thread so we can safely set cues here
+        double cueAtBeats = juce::jmax(0.0, switchToPreloadedSessionAtBeats);
+        for (auto track: preloadedSession->tracks->objects){
+            if (sceneToPlay < track->getNumberOfClips()){
+                auto clip = track->getClipAt(sceneToPlay);
+                if (!clip->hasZeroLength()){
+                    clip->playAt(cueAtBeats);
+                }
             }
         }
     }
-    return returnValue;
+    
+    preloadedSessionStatus = PreloadedSessionStatus::switchRequested;
 }
 
-std::vector<juce::String> Sequencer::getListStringPropertyFromSettingsFile(juce::String propertyName)
+void Sequencer::switchToPreloadedSessionInSlice()
 {
-    std::vector<juce::String> returnValue = {};
-    juce::File backendSettingsLocation = getDataLocation().getChildFile("backendSettings").withFileExtension("json");
-    if (backendSettingsLocation.existsAsFile()){
-        juce::var parsedJson;
-        auto result = juce::JSON::parse(backendSettingsLocation.loadFileAsString(), parsedJson);
-        if (result.wasOk())
-        {
-            if (parsedJson.isObject()){
-                juce::var rawElement = parsedJson.getProperty(propertyName, juce::var());
-                if (rawElement.isArray()){
-                
-                    juce::Array<juce::var>* deviceNames = rawElement.getArray();
-                    for (juce::var element: *deviceNames){
-                        returnValue.push_back(element.toString());
-                    }
-                }
-            }
+    // NOTE: this is called from the RT thread
+    // Stop all clips of the current session (rendering note offs in the current slice) and start using the preloaded tracks
+    // and musical context in the RT thread. Global transport position is kept so that the switch is seamless. The sequencer
+    // keeps owning the objects of the old session (which are still used by the other threads) until the message thread
+    // replaces them with the preloaded ones (see finalizePreloadedSessionSwitch).
+    int expectedStatus = PreloadedSessionStatus::switchRequested;
+    if (!preloadedSessionStatus.compare_exchange_strong(expectedStatus, PreloadedSessionStatus::switching)){
+        return;
+    }
+    
+    for (auto track: tracksForRTThread.load()->objects){
+        track->clipsRenderRemainingNoteOffsIntoMidiBuffer();
+        track->stopAllPlayingClips(true, true, false);
+        track->writeLastSliceMidiBufferToHardwareDeviceMidiBuffer();
+    }
+    
+    preloadedSession->musicalContext->continueTransportFrom(*musicalContextForRTThread.load());
+    musicalContextForRTThread = preloadedSession->musicalContext.get();
+    tracksForRTThread = preloadedSession->tracks.get();
+    clearMidiTrackBuffers();
+    shouldStartSendingPushMidiClockBurst = true;
+    
+    preloadedSessionStatus = PreloadedSessionStatus::switched;
+}
+
+void Sequencer::finalizePreloadedSessionSwitch()
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    // Once the RT thread has switched to the preloaded session, replace session in the state and the session objects (the
+    // objects of the old session are deleted). The status is checked again while holding the lock as a session could have
+    // been loaded in the meantime (see discardPreloadedSession).
+    const juce::ScopedLock sl (sessionObjectsLock);
+    if (preloadedSessionStatus != PreloadedSessionStatus::switched){
+        return;
+    }
+    state.removeListener(this);
+    if (state.getChildWithName(ShepherdIDs::SESSION).isValid()){
+        state.removeChild(state.getChildWithName(ShepherdIDs::SESSION), nullptr);
+    }
+    state.addChild(preloadedSession->sessionState, 0, nullptr);
+    bindState();
+    
+    replaceSessionObjects(std::move(preloadedSession->musicalContext), std::move(preloadedSession->tracks));
+    preloadedSession.reset();
+    preloadedSessionStatus = PreloadedSessionStatus::none;
+    
+    // Send message to frontend so it requests the new full state
+    sendMessageToController(juce::OSCMessage(ACTION_ADDRESS_STARTED_MESSAGE));
+}
+
+void Sequencer::discardPreloadedSession()
+{
+    // NOTE: this is called while holding sessionObjectsLock, right before the session objects are replaced
+    int expectedStatus = PreloadedSessionStatus::ready;
+    if (preloadedSessionStatus.compare_exchange_strong(expectedStatus, PreloadedSessionStatus::none)){
+        preloadedSession.reset();
+        return;
+    }
+    expectedStatus = PreloadedSessionStatus::switchRequested;
+    if (preloadedSessionStatus.compare_exchange_strong(expectedStatus, PreloadedSessionStatus::none)){
+        preloadedSession.reset();
+        return;
+    }
+    
+    // If the RT thread is switching to the preloaded session, wait until it finishes (this happens within one slice). Once
+    // switched, the preloaded objects are used by the RT thread, so these replace the objects of the old session (which
+    // are then deleted) and will be deleted when the session objects are replaced again.
+    while (preloadedSessionStatus == PreloadedSessionStatus::switching){
+        juce::Thread::yield();
+    }
+    if (preloadedSessionStatus == PreloadedSessionStatus::switched){
+        replaceSessionObjects(std::move(preloadedSession->musicalContext), std::move(preloadedSession->tracks));
+        preloadedSession.reset();
+        preloadedSessionStatus = PreloadedSessionStatus::none;
+    }
+}
+
+void Sequencer::applyBackendSettings()
+{
+    // Prepare the settings which are used in the RT thread so that these are swapped at the start of the next slice
+    // (see applyPendingMidiDeviceSettings). If previous pending settings have not been yet applied by the RT thread,
+    // try again later in the timer.
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    if (shouldApplyPendingMidiDeviceSettings){
+        return;
+    }
+    shouldApplyBackendSettings = false;
+    
+    BackendSettingsStruct settings = backendSettings.getSettings();
+    pendingSendMidiClockMidiDeviceHandles.clear();
+    for (auto& deviceName: settings.midiDevicesToSendClockTo){
+        pendingSendMidiClockMidiDeviceHandles.push_back(getMidiDeviceHandle(deviceName, HardwareDeviceType::output));
+    }
+    pendingSendMidiClockOffsetsMs = settings.midiClockOffsetsMs;
+    pendingMidiClockPPQN = settings.midiClockPPQN;
+    pendingSendMetronomeMidiDeviceHandle = getMidiDeviceHandle(settings.metronomeMidiDevice, HardwareDeviceType::output);
+    if (settings.pushClockDeviceName != ""){
+        pendingSendPushMidiClockDeviceHandles = {getMidiDeviceHandle(settings.pushClockDeviceName, HardwareDeviceType::output)};
+    } else {
+        pendingSendPushMidiClockDeviceHandles = {};
+    }
+    clipUndoLevels = settings.clipUndoLevels;
+    clipUndoMemoryBudgetBytes = settings.clipUndoMemoryBudgetBytes;
+    if (lookaheadRenderer == nullptr && settings.lookaheadRenderingBeats > 0.0){
+        lookaheadRenderer = std::make_unique<LookaheadRenderer>();
+        lookaheadRendererForRTThread = lookaheadRenderer.get();
+    }
+    if (lookaheadRenderer != nullptr){
+        lookaheadRenderer->setLookaheadBeats(settings.lookaheadRenderingBeats);
+    }
+    directMidiThru = settings.directMidiThru;
+    automationThinningValueTolerance = settings.automationThinningValueTolerance;
+    automationThinningTimeTolerance = settings.automationThinningTimeTolerance;
+    automationPointsPerSlice = settings.automationPointsPerSlice;
+    if (musicalContext != nullptr && settings.metronomeMidiChannel != -1){
+        musicalContext->setMetronomeMidiChannel(settings.metronomeMidiChannel);
+    }
+    shouldApplyPendingMidiDeviceSettings = true;
+    
+    if (sequencerInitialized){
+        // Initialize MIDI output devices that might be required by the new settings
+        initializeMIDIOutputs();
+    }
+}
+
+void Sequencer::applyPendingMidiDeviceSettings()
+{
+    // NOTE: this is called from the RT thread (or before the RT thread starts). Swapping the vectors does not allocate.
+    if (shouldApplyPendingMidiDeviceSettings){
+        std::swap(sendMidiClockMidiDeviceHandles, pendingSendMidiClockMidiDeviceHandles);
+        std::swap(sendMidiClockOffsetsMs, pendingSendMidiClockOffsetsMs);
+        midiClockPPQN = pendingMidiClockPPQN;
+        sendMetronomeMidiDeviceHandle = pendingSendMetronomeMidiDeviceHandle;
+        std::swap(sendPushMidiClockDeviceHandles, pendingSendPushMidiClockDeviceHandles);
+        if (!sendPushLikeMidiClockBursts && sendPushMidiClockDeviceHandles.size() > 0){
+            shouldStartSendingPushMidiClockBurst = true;
         }
+        sendPushLikeMidiClockBursts = sendPushMidiClockDeviceHandles.size() > 0;
+        shouldApplyPendingMidiDeviceSettings = false;
     }
-    return returnValue;
 }
 
 juce::String Sequencer::serliaizeOSCMessage(const juce::OSCMessage& message)
@@ -443,6 +665,9 @@ void Sequencer::initializeMIDIInputs()
                         if (midiInDevices[i]->identifier == initializedMidiDevice->identifier){
                             midiInDevices[i]->device->stop();
                             auto reinitializedMidiDeviceData = initializeMidiInputDevice(hwDevice->getMidiInputDeviceName());
+                            // Update the handle of the device before the previous device data is deleted
+                            int handle = getMidiDeviceHandle(hwDevice->getMidiInputDeviceName(), HardwareDeviceType::input);
+                            if (handle > -1) midiInDevicesByHandle[handle] = reinitializedMidiDeviceData;
                             midiInDevices.set(i, reinitializedMidiDeviceData);
                             break;
                         }
@@ -459,6 +684,8 @@ void Sequencer::initializeMIDIInputs()
         }
     }
     
+    publishMidiDeviceHandles();
+    
     for (auto device: midiInDevices){
         std::cout << "- " << device->name << std::endl;
     }
@@ -491,12 +718,17 @@ void Sequencer::initializeMIDIOutputs()
         }
     }
     
-    // Initialize midi output devices used for clock
-    for (auto midiDeviceName: sendMidiClockMidiDeviceNames){
-        if (!midiOutputDeviceAlreadyInitialized(midiDeviceName)){
+    // Initialize midi output devices used for clock, metronome and Push clock (used for sending clock messages to push and sync
+    // animations with Shepherd tempo)
+    BackendSettingsStruct settings = backendSettings.getSettings();
+    std::vector<juce::String> settingsMidiDeviceNames = settings.midiDevicesToSendClockTo;
+    settingsMidiDeviceNames.push_back(settings.metronomeMidiDevice);
+    settingsMidiDeviceNames.push_back(settings.pushClockDeviceName);
+    for (auto midiDeviceName: settingsMidiDeviceNames){
+        if (midiDeviceName != "" && !midiOutputDeviceAlreadyInitialized(midiDeviceName)){
             auto midiDeviceData = initializeMidiOutputDevice(midiDeviceName);
             if (midiDeviceData == nullptr) {
-                DBG("Failed to initialize midi device for clock: " << midiDeviceName);
+                DBG("Failed to initialize midi device for clock/metronome: " << midiDeviceName);
                 someFailedInitialization = true;
             } else {
                 midiOutDevices.add(midiDeviceData);
@@ -504,33 +736,6 @@ void Sequencer::initializeMIDIOutputs()
         }
     }
     
-    // Init metronome decice
-    if (!midiOutputDeviceAlreadyInitialized(sendMetronomeMidiDeviceName)){
-        auto midiDeviceData = initializeMidiOutputDevice(sendMetronomeMidiDeviceName);
-        if (midiDeviceData == nullptr) {
-            DBG("Failed to initialize midi device for metronome: " << sendMetronomeMidiDeviceName);
-            someFailedInitialization = true;
-        } else {
-            midiOutDevices.add(midiDeviceData);
-        }
-    }
-    
-    // Initialize Push midi output (used for sending clock messages to push and sync animations with Shepherd tempo)
-    juce::String pushMidiOutDeviceName = getStringPropertyFromSettingsFile("pushClockDeviceName");
-    if (pushMidiOutDeviceName != ""){
-        sendPushLikeMidiClockBursts = true;  // Enable sending of push-like midi clock bursts to device indicated
-        sendPushMidiClockDeviceNames = {pushMidiOutDeviceName};
-        if (!midiOutputDeviceAlreadyInitialized(pushMidiOutDeviceName)){
-            auto pushMidiDevice = initializeMidiOutputDevice(pushMidiOutDeviceName);
-            if (pushMidiDevice == nullptr) {
-                DBG("Failed to initialize push midi device: " << pushMidiOutDeviceName);
-                someFailedInitialization = true;
-            } else {
-                midiOutDevices.add(pushMidiDevice);
-            }
-        }
-    }
-    
     // Remove elements from midiOutDevices that could be remaining null pointers of previous sessions
     for (int i=midiOutDevices.size() - 1; i>0; i--){
         if (midiOutDevices[i] == nullptr){
@@ -538,6 +743,8 @@ void Sequencer::initializeMIDIOutputs()
         }
     }
     
+    publishMidiDeviceHandles();
+    
     for (auto device: midiOutDevices){
         std::cout << "- " << device->name << std::endl;
     }
@@ -545,6 +752,145 @@ void Sequencer::initializeMIDIOutputs()
     if (!someFailedInitialization) shouldTryInitializeMidiOutputs = false;
 }
 
+int Sequencer::getMidiDeviceHandle(const juce::String& deviceName, HardwareDeviceType type)
+{
+    // Return the handle of the MIDI device with the given name, or assign a new one if the device has no handle yet (even if
+    // the device is not initialized). Handles are never re-assigned so these remain valid when devices are (re)initialized.
+    // Returns -1 if no handle can be assigned.
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    if (deviceName == "") { return -1; }
+    juce::StringArray& handleNames = type == HardwareDeviceType::input ? midiInDeviceHandleNames : midiOutDeviceHandleNames;
+    int handle = handleNames.indexOf(deviceName);
+    if (handle == -1 && handleNames.size() < MAX_NUM_MIDI_DEVICES){
+        handleNames.add(deviceName);
+        handle = handleNames.size() - 1;
+    }
+    return handle;
+}
+
+void Sequencer::publishMidiDeviceHandles()
+{
+    // Update the tables used in the RT thread to get the device data of each handle with the currently initialized devices
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    for (int handle=0; handle<MAX_NUM_MIDI_DEVICES; handle++){
+        MidiInputDeviceData* inputDeviceData = nullptr;
+        if (handle < midiInDeviceHandleNames.size()){
+            for (auto deviceData: midiInDevices){
+                if (deviceData != nullptr && deviceData->name == midiInDeviceHandleNames[handle]){
+                    inputDeviceData = deviceData;
+                }
+            }
+        }
+        midiInDevicesByHandle[handle] = inputDeviceData;
+        
+        MidiOutputDeviceData* outputDeviceData = nullptr;
+        if (handle < midiOutDeviceHandleNames.size()){
+            for (auto deviceData: midiOutDevices){
+                if (deviceData != nullptr && deviceData->name == midiOutDeviceHandleNames[handle]){
+                    outputDeviceData = deviceData;
+                }
+            }
+        }
+        midiOutDevicesByHandle[handle] = outputDeviceData;
+    }
+}
+
+void Sequencer::updateMidiThruRoutes()
+{
+    // Update the routes used by the MIDI inputs to send monitored messages directly to the output devices (see
+    // MidiInputRing::sendThru). There is one route for each input hardware device and output device of the tracks with input
+    // monitoring enabled. This is called periodically from the timer, so it can take a few milliseconds until changes in
+    // input monitoring are reflected in the routes. The routes of all inputs are published as a single snapshot which is also
+    // used by the RT thread, and only if these changed.
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    juce::Array<HardwareDevice*> monitoredOutputDevices;
+    if (directMidiThru && sequencerInitialized){
+        for (auto track: tracks->objects){
+            if (track->sendsInputMonitoringDirectly()){
+                monitoredOutputDevices.addIfNotAlreadyThere(track->getOutputHardwareDevice());
+            }
+        }
+    }
+    
+    std::unique_ptr<MidiInputRing::ThruRoutes> routes;
+    if (monitoredOutputDevices.size() > 0){
+        routes = std::make_unique<MidiInputRing::ThruRoutes>();
+        for (auto outputDevice: monitoredOutputDevices){
+            // An output device only receives messages directly if it has routes from all input hardware devices, otherwise the
+            // RT thread must keep sending the monitored messages to it
+            int numRoutesBeforeOutputDevice = routes->numRoutes;
+            bool allRoutesAdded = true;
+            for (auto inputDevice: hardwareDevices->objects){
+                if (!inputDevice->isTypeInput() || !inputDevice->isMidiInitialized()) { continue; }
+                if (routes->numRoutes == MidiInputRing::maxNumThruRoutes){
+                    allRoutesAdded = false;
+                    break;
+                }
+                MidiInputRing::ThruRoute& route = routes->routes[routes->numRoutes];
+                route.input = inputDevice->getMidiInputDeviceData()->inputRing.get();
+                route.transformVersion = inputDevice->getInputTransformVersion();  // Read before the transform, see HardwareDevice::getInputTransform
+                route.transform = inputDevice->getInputTransform();
+                route.transformSource = inputDevice;
+                route.fixedVelocity = fixedVelocity.get();
+                route.output = outputDevice->getMidiOutputDeviceData();
+                route.midiChannel = outputDevice->getMidiOutputChannel();
+                routes->numRoutes += 1;
+            }
+            if (allRoutesAdded){
+                auto& outputHardwareDevices = routes->outputHardwareDevices;
+                outputHardwareDevices.devices[(size_t)outputHardwareDevices.numDevices] = outputDevice;
+                outputHardwareDevices.numDevices += 1;
+            } else {
+                routes->numRoutes = numRoutesBeforeOutputDevice;
+            }
+        }
+        if (routes->outputHardwareDevices.numDevices == 0){
+            routes = nullptr;
+        }
+    }
+    
+    if (routes == nullptr && ownedMidiThruRoutes == nullptr) { return; }
+    if (routes != nullptr && ownedMidiThruRoutes != nullptr && routes->isEquivalentTo(*ownedMidiThruRoutes)) { return; }
+    
+    // Once the new routes are published, wait until neither the MIDI input threads nor the RT thread are using the previous
+    // ones before deleting them (this should take no longer than processing a block)
+    midiThruRoutes = routes.get();
+    for (auto deviceData: midiInDevices){
+        while (deviceData != nullptr && deviceData->inputRing->isSendingThruMessages()){
+            juce::Thread::yield();
+        }
+    }
+    while (isProcessingBlock.load()){
+        juce::Thread::yield();
+    }
+    ownedMidiThruRoutes = std::move(routes);
+}
+
+void Sequencer::updateDirectThruOutputDevices()
+{
+    // NOTE: this is called from the RT thread at the start of every block, before retrieving the messages of the input rings
+    // Keep the output devices of the current and of the previous snapshot of the thru routes, see outputDeviceIsMonitoredDirectly
+    previousBlockDirectThruOutputDevices = directThruOutputDevices;
+    MidiInputRing::ThruRoutes* routes = midiThruRoutes.load();
+    if (routes != nullptr){
+        directThruOutputDevices = routes->outputHardwareDevices;
+    } else {
+        directThruOutputDevices.numDevices = 0;
+    }
+}
+
+bool Sequencer::outputDeviceIsMonitoredDirectly(const HardwareDevice* outputDevice)
+{
+    // NOTE: this is called from the RT thread
+    // Monitored messages sent to outputDevice by the RT thread are skipped only if the device received them directly with the
+    // routes of both the current and the previous block. When routes change, messages which were received before the new routes
+    // were published might still be retrieved from the input rings, so these might be sent twice but are never dropped.
+    return directThruOutputDevices.contains(outputDevice) && previousBlockDirectThruOutputDevices.contains(outputDevice);
+}
+
 MidiOutputDeviceData* Sequencer::initializeMidiOutputDevice(juce::String deviceName)
 {
     JUCE_ASSERT_MESSAGE_THREAD
@@ -569,6 +915,7 @@ MidiOutputDeviceData* Sequencer::initializeMidiOutputDevice(juce::String deviceN
     
     MidiOutputDeviceData* deviceData = new MidiOutputDeviceData();
     deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    deviceData->pendingBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
     deviceData->identifier = outDeviceIdentifier;
     deviceData->name = deviceName;
     deviceData->device = juce::MidiOutput::openDevice(outDeviceIdentifier);
@@ -585,19 +932,15 @@ MidiOutputDeviceData* Sequencer::initializeMidiOutputDevice(juce::String deviceN
     }
 }
 
-MidiOutputDeviceData* Sequencer::getMidiOutputDeviceData(juce::String deviceName)
+MidiOutputDeviceData* Sequencer::getMidiOutputDeviceData(int handle)
 {
-    for (auto deviceData: midiOutDevices){
-        if (deviceData != nullptr && deviceData->name == deviceName){
-            return deviceData;
-        }
+    MidiOutputDeviceData* deviceData = handle >= 0 ? midiOutDevicesByHandle[handle].load() : nullptr;
+    if (deviceData == nullptr && handle >= 0){
+        // If the requested output device has not yet been initialized, set a flag so the device gets initialized in the
+        // message thread and return null pointer.
+        shouldTryInitializeMidiOutputs = true;
     }
-    // If function did not yet return, it means the requested output device has not yet been initialized
-    // Set a flag so the device gets initialized in the message thread and return null pointer.
-    // NOTE: we could check if we're in the message thread and, if this is the case, initialize the device
-    // instead of setting a flag, but this optimization is probably not necessary.
-    shouldTryInitializeMidiOutputs = true;
-    return nullptr;
+    return deviceData;
 }
 
 MidiInputDeviceData* Sequencer::initializeMidiInputDevice(juce::String deviceName)
@@ -614,14 +957,15 @@ MidiInputDeviceData* Sequencer::initializeMidiInputDevice(juce::String deviceNam
     
     MidiInputDeviceData* deviceData = new MidiInputDeviceData();
     deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
-    deviceData->collector.ensureStorageAllocated(MIDI_BUFFER_MIN_BYTES);
+    deviceData->blockBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    deviceData->inputRing = std::make_unique<MidiInputRing>(midiThruRoutes);
     deviceData->identifier = inDeviceIdentifier;
     deviceData->name = deviceName;
-    deviceData->device = juce::MidiInput::openDevice(inDeviceIdentifier, &deviceData->collector);
     if (sampleRate > 0){
-        // If sample rate has already been set (this is a midi in device being initialized of late), then use if to reset collectpr
-        deviceData->collector.reset(sampleRate);
+        // If sample rate has already been set (this is a midi in device being initialized of late), then use if to reset the input ring
+        deviceData->inputRing->reset(sampleRate);
     }
+    deviceData->device = juce::MidiInput::openDevice(inDeviceIdentifier, deviceData->inputRing.get());
     
     if (deviceData->device != nullptr){
         deviceData->device->start();
@@ -652,20 +996,42 @@ MidiInputDeviceData* Sequencer::getMidiInputDeviceData(juce::String deviceName)
     return nullptr;
 }
 
-void Sequencer::collectorsRetrieveLatestBlockOfMessages(int sliceNumSamples)
+MidiInputDeviceData* Sequencer::getMidiInputDeviceData(int handle)
+{
+    // Same as getMidiInputDeviceData(juce::String) but using the device handle, this is what should be used in the RT thread
+    MidiInputDeviceData* deviceData = handle >= 0 ? midiInDevicesByHandle[handle].load() : nullptr;
+    if (deviceData == nullptr && handle >= 0){
+        shouldTryInitializeMidiInputs = true;
+    }
+    return deviceData;
+}
+
+void Sequencer::inputRingsRetrieveLatestBlockOfMessages(int blockNumSamples)
+{
+    for (auto deviceData: midiInDevices){
+        if (deviceData != nullptr){
+            deviceData->blockBuffer.clear();
+            deviceData->inputRing->removeNextBlockOfMessages (deviceData->blockBuffer, blockNumSamples);
+        }
+    }
+}
+
+void Sequencer::inputRingsGetMessagesForCurrentSlice(int sliceNumSamples)
 {
+    // Copy the messages of the current slice from the messages retrieved for the whole block, with positions relative to the slice
+    clearMidiDeviceInputBuffers();
     for (auto deviceData: midiInDevices){
         if (deviceData != nullptr){
-            deviceData->collector.removeNextBlockOfMessages (deviceData->buffer, sliceNumSamples);
+            deviceData->buffer.addEvents(deviceData->blockBuffer, currentSliceOffsetInBlock, sliceNumSamples, -currentSliceOffsetInBlock);
         }
     }
 }
 
-void Sequencer::resetMidiInCollectors(double sampleRate)
+void Sequencer::resetMidiInputRings(double sampleRate)
 {
     for (auto deviceData: midiInDevices){
         if (deviceData != nullptr){
-            deviceData->collector.reset(sampleRate);
+            deviceData->inputRing->reset(sampleRate);
         }
     }
 }
@@ -691,7 +1057,7 @@ void Sequencer::clearMidiDeviceOutputBuffers()
 
 void Sequencer::clearMidiTrackBuffers()
 {
-    for (auto track: tracks->objects){
+    for (auto track: tracksForRTThread.load()->objects){
         track->clearMidiBuffers();
     }
 }
@@ -699,23 +1065,64 @@ void Sequencer::clearMidiTrackBuffers()
 void Sequencer::sendMidiDeviceOutputBuffers()
 {
     for (auto deviceData: midiOutDevices){
-        if (deviceData != nullptr && deviceData->name != INTERNAL_OUTPUT_MIDI_DEVICE_NAME){
-            deviceData->device->sendBlockOfMessagesNow(deviceData->buffer);
+        if (deviceData != nullptr && deviceData->device != nullptr){
+            // NOTE: the internal output device has no MIDI device. The MIDI input threads can also send to the device (direct
+            // MIDI thru) while holding sendLock. The RT thread never waits for the lock: if it is held, the messages are kept
+            // in pendingBuffer (after the ones already pending, if any) and sent before the messages of the next block.
+            const juce::SpinLock::ScopedTryLockType sl (deviceData->sendLock);
+            if (sl.isLocked()){
+                if (deviceData->pendingBuffer.getNumEvents() > 0){
+                    deviceData->device->sendBlockOfMessagesNow(deviceData->pendingBuffer);
+                    deviceData->pendingBuffer.clear();
+                }
+                deviceData->device->sendBlockOfMessagesNow(deviceData->buffer);
+            } else if (deviceData->pendingBuffer.getNumEvents() == 0){
+                deviceData->pendingBuffer.swapWith(deviceData->buffer);
+            } else {
+                deviceData->pendingBuffer.addEvents(deviceData->buffer, 0, -1, deviceData->pendingBuffer.getLastEventTime() + 1);
+            }
         }
     }
 }
 
-void Sequencer::writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames)
+void Sequencer::writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, const std::vector<int>& midiOutDeviceHandles)
 {
-    for (auto deviceName: midiOutDeviceNames){
-        auto deviceData = getMidiOutputDeviceData(deviceName);
-        if (deviceData != nullptr){
-            auto bufferToWrite = &deviceData->buffer;
-            if (bufferToWrite != nullptr){
-                if (buffer.getNumEvents() > 0){
-                    bufferToWrite->addEvents(buffer, 0, samplesPerSlice, 0);
+    for (auto deviceHandle: midiOutDeviceHandles){
+        writeMidiToDeviceMidiBuffer(buffer, deviceHandle);
+    }
+}
+
+void Sequencer::writeMidiToDeviceMidiBuffer(juce::MidiBuffer& buffer, int midiOutDeviceHandle)
+{
+    auto deviceData = getMidiOutputDeviceData(midiOutDeviceHandle);
+    if (deviceData != nullptr){
+        auto bufferToWrite = &deviceData->buffer;
+        if (bufferToWrite != nullptr){
+            if (buffer.getNumEvents() > 0){
+                bufferToWrite->addEvents(buffer, 0, samplesPerSlice, currentSliceOffsetInBlock);
+            }
+        }
+    }
+}
+
+void Sequencer::writeMidiClockToDevicesMidiBuffers()
+{
+    // midiClockMessages contains the clock at the default resolution (24 PPQN) and with no offset (this is also the clock
+    // used for Push). Destinations with a different resolution or with an offset get their own rendering of the clock.
+    for (int i=0; i<sendMidiClockMidiDeviceHandles.size(); i++){
+        double offsetMs = i < sendMidiClockOffsetsMs.size() ? sendMidiClockOffsetsMs[i] : 0.0;
+        if (!sendMidiClock || (midiClockPPQN == ShepherdDefaults::midiClockPPQN && offsetMs == 0.0)){
+            writeMidiToDeviceMidiBuffer(midiClockMessages, sendMidiClockMidiDeviceHandles[i]);
+        } else {
+            // Keep start/stop messages and re-render the clock ticks
+            midiClockDestinationMessages.clear();
+            for (auto metadata: midiClockMessages){
+                if (!metadata.getMessage().isMidiClock()){
+                    midiClockDestinationMessages.addEvent(metadata.getMessage(), metadata.samplePosition);
                 }
             }
+            musicalContextForRTThread.load()->renderMidiClockInSlice(midiClockDestinationMessages, midiClockPPQN, offsetMs);
+            writeMidiToDeviceMidiBuffer(midiClockDestinationMessages, sendMidiClockMidiDeviceHandles[i]);
         }
     }
 }
@@ -766,6 +1173,7 @@ void Sequencer::initializeHardwareDevices()
                         bool allowChannelPressureMessages = (bool)deviceInfo.getProperty("allowChannelPressureMessages", ShepherdDefaults::allowChannelPressureMessages);
                         juce::String notesMapping = deviceInfo.getProperty("notesMapping", "").toString(); // Empty string will be standard 1-128 mapping
                         juce::String controlChangeMapping = deviceInfo.getProperty("controlChangeMapping", "").toString(); // Empty string will be standard 1-128 mapping
+                        juce::String velocityCurve = deviceInfo.getProperty("velocityCurve", "").toString(); // Empty string will be linear velocity curve
                         hardwareDevicesState.addChild(ShepherdHelpers::createInputHardwareDevice(name,
                                                                                          shortName,
                                                                                          midiInDeviceName,
@@ -777,7 +1185,8 @@ void Sequencer::initializeHardwareDevices()
                                                                                          allowAftertouchMessages,
                                                                                          allowChannelPressureMessages,
                                                                                          notesMapping,
-                                                                                         controlChangeMapping), -1, nullptr);
+                                                                                         controlChangeMapping,
+                                                                                         velocityCurve), -1, nullptr);
                     }
                 }
             }
@@ -804,8 +1213,9 @@ void Sequencer::initializeHardwareDevices()
     }
     state.addChild(hardwareDevicesState, -1, nullptr);
     hardwareDevices = std::make_unique<HardwareDeviceList>(state.getChildWithName(ShepherdIDs::HARDWARE_DEVICES),
-                                                           [this](juce::String deviceName){return getMidiOutputDeviceData(deviceName);},
-                                                           [this](juce::String deviceName){return getMidiInputDeviceData(deviceName);}
+                                                           [this](juce::String deviceName, HardwareDeviceType type){return getMidiDeviceHandle(deviceName, type);},
+                                                           [this](int handle){return getMidiOutputDeviceData(handle);},
+                                                           [this](int handle){return getMidiInputDeviceData(handle);}
                                                            );
     std::cout << "Output Hardware Devices initialized:" << std::endl;
     for (auto deviceName: hardwareDevices->getAvailableOutputHardwareDeviceNames()){
@@ -819,13 +1229,8 @@ void Sequencer::initializeHardwareDevices()
 
 HardwareDevice* Sequencer::getHardwareDeviceByName(juce::String name, HardwareDeviceType type)
 {
-    for (auto device: hardwareDevices->objects){
-        if ((device->getShortName() == name || device->getName() == name) && (type == device->getType())){
-            return device;
-        }
-    }
-    // If no hardware device is available with that name and for that type, simply return null pointer
-    return nullptr;
+    // If no hardware device is available with that name and for that type, this returns null pointer
+    return hardwareDevices->getObjectWithName(name, type);
 }
 
 Track* Sequencer::getTrackWithUUID(juce::String trackUUID)
@@ -836,38 +1241,84 @@ Track* Sequencer::getTrackWithUUID(juce::String trackUUID)
 //==============================================================================
 void Sequencer::prepareSequencer (int samplesPerBlockExpected, double _sampleRate)
 {
+    // Audio blocks are processed in internal "slices" of a fixed size (see getNextMIDIBlock) so that timing resolution does not
+    // depend on the block size of the audio device. If no slice size is configured (or it is bigger than the block size), each
+    // block is processed as a single slice.
     sampleRate = _sampleRate;
-    samplesPerSlice = samplesPerBlockExpected; // We store samplesPerBlockExpected calling it samplesPerSlice as in our MIDI sequencer context we call our processig blocks "slices"
-    resetMidiInCollectors (_sampleRate);
+    samplesPerBlock = samplesPerBlockExpected;
+    int configuredSliceSize = backendSettings.getSettings().sliceSizeInSamples;
+    samplesPerInternalSlice = configuredSliceSize > 0 ? juce::jmin(configuredSliceSize, samplesPerBlockExpected) : samplesPerBlockExpected;
+    samplesPerSlice = samplesPerInternalSlice;
+    resetMidiInputRings (_sampleRate);
 }
 
-/** Process each audio block (in our case, we call it "slice" and only process MIDI data), ask each track to provide notes to be triggered during that slice, handle MIDI input and global playhead transport.
-    @param bufferToFill                  JUCE's AudioSourceChannelInfo reference of audio buffer to fill (we don't use that as we don't genrate audio)
+/** Process each audio block by splitting it into slices of samplesPerInternalSlice samples (the last one might be shorter if
+ the block size is not a multiple of the slice size). MIDI input is collected once per block and distributed to the slices,
+ and MIDI output of all slices is merged into the hardware device buffers (with the sample offset of each slice), which
+ are sent at the end of the block.
+    @param blockNumSamples               Number of samples of the audio block
+*/
+void Sequencer::getNextMIDIBlock (int blockNumSamples)
+{
+    // Check if main component has been fully initialized, if not do not proceed with getNextMIDISlice as we might be referencing
+    // some objects which have not yet been fully initialized (Tracks, HardwareDevices...)
+    if (!sequencerInitialized){
+        return;
+    }
+    
+    // Clear the buffers which accumulate the MIDI of the whole block. Clearing the buffers does not free their pre-allocated memory,
+    // so this is fine in the RT thread.
+    isProcessingBlock = true;
+    clearMidiDeviceOutputBuffers();
+    monitoringNotesMidiBuffer.clear();
+    updateDirectThruOutputDevices();
+    inputRingsRetrieveLatestBlockOfMessages(blockNumSamples);
+    
+    int sliceSize = samplesPerInternalSlice > 0 ? samplesPerInternalSlice : blockNumSamples;
+    for (int sliceOffset = 0; sliceOffset < blockNumSamples; sliceOffset += sliceSize){
+        currentSliceOffsetInBlock = sliceOffset;
+        samplesPerSlice = juce::jmin(sliceSize, blockNumSamples - sliceOffset);
+        getNextMIDISlice(samplesPerSlice);
+    }
+    currentSliceOffsetInBlock = 0;
+    samplesPerSlice = sliceSize;
+    
+    // Send the actual messages added to each hardware device's MIDI buffer and the monitored track notes to the notes MIDI output
+    // (if any selected). The later is used by the Shepherd Controller to show feedback about notes being currently played.
+    sendMidiDeviceOutputBuffers();
+    if (notesMonitoringMidiOutput != nullptr && monitoringNotesMidiBuffer.getNumEvents() > 0){
+        notesMonitoringMidiOutput->sendBlockOfMessagesNow(monitoringNotesMidiBuffer);
+    }
+    isProcessingBlock = false;
+}
+
+/** Process each slice, ask each track to provide notes to be triggered during that slice, handle MIDI input and global playhead transport.
+    @param sliceNumSamples               Number of samples of the slice (see getNextMIDIBlock)
  
  The implementation of this method is
  struecutred as follows:
  
- 1) Check if main component has been fully initialized, if not do not proceed with getNextMIDISlice as we might be referencing some objects which have not yet been fully initialized (Tracks, HardwareDevices...)
+ 1) Get the MIDI messages of each MIDI input that fall in the current slice from the messages collected for the whole block
     
- 2) Clear all MIDI buffers so we can re-fill them with events corresponding to the current slice. These includes hardware device buffers, track buffers and other auxiliary buffers. Clearing the buffers does not free their pre-allocated memory, so this is fine in the RT thread.
+ 2) Clear all MIDI buffers so we can re-fill them with events corresponding to the current slice. These includes track buffers and other auxiliary buffers. Hardware device buffers are cleared at the start of the block as these accumulate the MIDI of all slices.
      
- 3) Check if tempo or meter should be updated and, in case we're doing a count in, check if count in finishes in this slice
+ 3) Check if a preloaded session should be switched in this slice, if tempo or meter should be updated and, in case we're doing a count in, check if count in finishes in this slice
      
  4) Update musical context bar counter
     
- 5) Get MIDI messages from MIDI inputs (external MIDI controller and Push's pads/encoders) and merge them into a single stream. Send that stream to the different tracks for input monitoring. Also, keep track of the last N played notes as this will be used to quantize events at the start of a recording.
+ 5) Get MIDI messages from MIDI inputs (external MIDI controller and Push's pads/encoders) and merge them into a single stream. Input messages are filtered and mapped once per input device, and then rendered once for each output device used by tracks that are input monitoring or recording (so relative CC values are only applied once). Send that stream to the different tracks for input monitoring. Also, keep track of the last N played notes as this will be used to quantize events at the start of a recording.
 
  6) Check if global playhead should be start/stopped and act accordingly
 
- 7) Process the current slice in each track: trigger playing clips' notes and, if needed, record incoming MIDI in clip(s)
+ 7) Process the current slice in each track: trigger playing clips' notes and, if needed, record incoming MIDI in clip(s). If enabled in the settings, tracks are processed in parallel using the TrackProcessingPool.
     
  8) Add generated MIDI buffers per track to the corresponding hardware device MIDI output buffer. Note that several tracks might be using the same hardware device (albeit using different MIDI channels) so at this point MIDI from several tracks might be merged in the hardware device MIDI buffers.
           
  9) Render metronome and clock MIDI messages into MIDI clock and metronome auxiliary buffers. Also render MIDI clock messages in Push's MIDI buffer, used to synchronize Push colour animations with Shepherd session tempo. Copy metronome and clock messages to the corresponding hardware device buffers according to Shepherd settings.
      
- 10) Send the actual messages added to each hardware device's MIDI buffer
+ 10) (Nothing to do here, hardware device buffers are sent at the end of the block, see getNextMIDIBlock)
      
- 11) Send monitored track notes to the notes MIDI output (if any selected). This is used by the Shepherd Controller to show feedback about notes being currently played.
+ 11) Add monitored track notes to the notes monitoring buffer (if any track selected). These are sent to the notes MIDI output at the end of the block.
 
  12) Update playhead position if global playhead is playing
  
@@ -877,129 +1328,163 @@ void Sequencer::prepareSequencer (int samplesPerBlockExpected, double _sampleRat
 void Sequencer::getNextMIDISlice (int sliceNumSamples)
 {
     // 1) -------------------------------------------------------------------------------------------------
-    if (!sequencerInitialized){
-        return;
-    }
+    
+    inputRingsGetMessagesForCurrentSlice(sliceNumSamples);
     
     // 2) -------------------------------------------------------------------------------------------------
     
-    clearMidiDeviceInputBuffers();
-    clearMidiDeviceOutputBuffers();
     clearMidiTrackBuffers();
     midiClockMessages.clear();
     midiMetronomeMessages.clear();
     pushMidiClockMessages.clear();
-    monitoringNotesMidiBuffer.clear();
     
     // 3) -------------------------------------------------------------------------------------------------
     
+    // Apply changes in clock/metronome devices from settings file (if any)
+    applyPendingMidiDeviceSettings();
+    
+    // Check if a preloaded session should be switched in this slice
+    if (preloadedSessionStatus == PreloadedSessionStatus::switchRequested){
+        MusicalContext* currentMusicalContext = musicalContextForRTThread.load();
+        if (!currentMusicalContext->playheadIsPlaying() || switchToPreloadedSessionAtBeats < currentMusicalContext->getSliceRangeInBeats().getEnd()){
+            switchToPreloadedSessionInSlice();
+        }
+    }
+    
+    // Session objects to process in this slice (these only change if a preloaded session has just been switched)
+    MusicalContext* activeMusicalContext = musicalContextForRTThread.load();
+    TrackList* activeTracks = tracksForRTThread.load();
+    
     // Check if tempo/meter should be updated
     if (nextBpm > 0.0){
-        musicalContext->setBpm(nextBpm);
+        activeMusicalContext->setBpm(nextBpm);
         shouldStartSendingPushMidiClockBurst = true;
         nextBpm = 0.0;
     }
     if (nextMeter > 0){
-        musicalContext->setMeter(nextMeter);
+        activeMusicalContext->setMeter(nextMeter);
         nextMeter = 0;
     }
-    double sliceLengthInBeats = musicalContext->getSliceLengthInBeats();
+    double sliceLengthInBeats = activeMusicalContext->getSliceLengthInBeats();
     
     // Check if count-in finished and global's playhead "is playing" state should be toggled
-    if (!musicalContext->playheadIsPlaying() && musicalContext->playheadIsDoingCountIn()){
-        if (musicalContext->getMeter() >= musicalContext->getCountInPlayheadPositionInBeats() && musicalContext->getMeter() < musicalContext->getCountInPlayheadPositionInBeats() + sliceLengthInBeats){
+    if (!activeMusicalContext->playheadIsPlaying() && activeMusicalContext->playheadIsDoingCountIn()){
+        if (activeMusicalContext->getMeter() >= activeMusicalContext->getCountInPlayheadPositionInBeats() && activeMusicalContext->getMeter() < activeMusicalContext->getCountInPlayheadPositionInBeats() + sliceLengthInBeats){
             // Count in finishes in the current slice (getNextMIDISlice)
             // Align global playhead position with coutin buffer offset so that it starts at correct offset
-            musicalContext->setPlayheadPosition(-(musicalContext->getMeter() - musicalContext->getCountInPlayheadPositionInBeats()));
+            activeMusicalContext->setPlayheadPosition(-(activeMusicalContext->getMeter() - activeMusicalContext->getCountInPlayheadPositionInBeats()));
             shouldToggleIsPlaying = true;
-            musicalContext->setPlayheadIsDoingCountIn(false);
-            musicalContext->setCountInPlayheadPosition(0.0);
+            activeMusicalContext->setPlayheadIsDoingCountIn(false);
+            activeMusicalContext->setCountInPlayheadPosition(0.0);
         }
     }
     
     // 4) -------------------------------------------------------------------------------------------------
     
     // This must be called before musicalContext.renderMetronomeInSlice to make sure metronome "high tone" is played when bar changes
-    musicalContext->updateBarsCounter(juce::Range<double>{musicalContext->getPlayheadPositionInBeats(), musicalContext->getPlayheadPositionInBeats() + sliceLengthInBeats});
+    activeMusicalContext->updateBarsCounter(activeMusicalContext->getSliceRangeInBeats());
     
     // 5) -------------------------------------------------------------------------------------------------
     
-    // Collect messages from different MIDI inputs and put them into a single buffer
-    collectorsRetrieveLatestBlockOfMessages(sliceNumSamples);
+    // Messages from the different MIDI inputs for the current slice have been put in each input device buffer in step 1.
+    // Input messages only need to be processed for the output devices of the tracks that will use them (tracks with input
+    // monitoring enabled or with clips cued to record/recording), so first collect these output devices
+    tracksReceivingInput.clearQuick();
+    outputDevicesReceivingInput.clearQuick();
+    for (auto track: activeTracks->objects){
+        if (track->acceptsInputMessages()){
+            tracksReceivingInput.add(track);
+            outputDevicesReceivingInput.addIfNotAlreadyThere(track->getOutputHardwareDevice());
+        }
+    }
+    for (auto outputDevice: outputDevicesReceivingInput){
+        outputDevice->getIncomingMidiBuffer().clear();
+    }
     
-    for (auto inputDevice: hardwareDevices->objects){
-        // NOTE: iterating hardwareDevices could be problematic without a lock if devices are
-        // added/removed. However this not something that will be happening as hw devices should
-        // not be created or removed...
+    if (outputDevicesReceivingInput.size() > 0){
+        for (auto inputDevice: hardwareDevices->objects){
+            // NOTE: iterating hardwareDevices could be problematic without a lock if devices are
+            // added/removed. However this not something that will be happening as hw devices should
+            // not be created or removed...
 
-        if (inputDevice->isTypeInput() && inputDevice->isMidiInitialized()){
-            auto inputDeviceData = getMidiInputDeviceData(inputDevice->getMidiInputDeviceName());
-            if (inputDeviceData == nullptr) { continue; }
-            juce::MidiBuffer& deviceLastBlockOfMessages = inputDeviceData->buffer;
-            
-            // Apply fixed velocity filter
-            for (const auto metadata: deviceLastBlockOfMessages){
-                auto msg = metadata.getMessage();
-                if (msg.isNoteOnOrOff() && fixedVelocity > -1){
-                    msg.setVelocity((float)fixedVelocity/127.0f);
+            if (inputDevice->isTypeInput() && inputDevice->isMidiInitialized()){
+                // Filter and map the messages of the input device once (this also applies the fixed velocity filter), then render
+                // them once for each output device (e.g. update control change values from relative controllers or change midi channel)
+                inputDevice->processIncomingMessagesForCurrentSlice(fixedVelocity.get());
+                for (auto outputDevice: outputDevicesReceivingInput){
+                    inputDevice->renderProcessedIncomingMessagesIntoBuffer(outputDevice->getIncomingMidiBuffer(), outputDevice);
                 }
             }
-            
-            // Iterate through all tracks and pass them the current input device to see if they want to do anything with it (if they have input monitoring enabled)
-            // and if they need to process it (e.g. update control change values from relative controllers or change midi notes). The processed messages will be stored
-            // in track's incomingMidiBuffer, and this will later be used by clips being played from that track
-            for (auto track: tracks->objects){
-                track->processInputMessagesFromInputHardwareDevice(inputDevice,
-                                                                   musicalContext->getSliceLengthInBeats(),
-                                                                   sliceNumSamples,
-                                                                   musicalContext->getCountInPlayheadPositionInBeats(),
-                                                                   musicalContext->getPlayheadPositionInBeats(),
-                                                                   musicalContext->getMeter(),
-                                                                   musicalContext->playheadIsDoingCountIn());
-            }
+        }
+        
+        // Pass the processed messages to the tracks. The messages will be stored in track's incomingMidiBuffer, and this will later be
+        // used by clips being played from that track (and copied to the track's output if input monitoring is enabled)
+        for (auto track: tracksReceivingInput){
+            track->processInputMessages(track->getOutputHardwareDevice()->getIncomingMidiBuffer(),
+                                        outputDeviceIsMonitoredDirectly(track->getOutputHardwareDevice()),
+                                        activeMusicalContext->getSliceLengthInBeats(),
+                                        sliceNumSamples,
+                                        activeMusicalContext->getCountInPlayheadPositionInBeats(),
+                                        activeMusicalContext->getPlayheadPositionInBeats(),
+                                        activeMusicalContext->getMeter(),
+                                        activeMusicalContext->playheadIsDoingCountIn());
         }
     }
     
     // 6) -------------------------------------------------------------------------------------------------
     
     if (shouldToggleIsPlaying){
-        if (musicalContext->playheadIsPlaying()){
+        if (activeMusicalContext->playheadIsPlaying()){
             // If global playhead is playing but it should be toggled, stop all tracks/clips and reset playhead and musical context
-            for (auto track: tracks->objects){
+            for (auto track: activeTracks->objects){
                 track->clipsRenderRemainingNoteOffsIntoMidiBuffer();
                 track->stopAllPlayingClips(true, true, true);
             }
-            musicalContext->setPlayheadIsPlaying(false);
-            musicalContext->setPlayheadPosition(0.0);
-            musicalContext->resetCounters();
-            musicalContext->renderMidiStopInSlice(midiClockMessages);
+            activeMusicalContext->setPlayheadIsPlaying(false);
+            activeMusicalContext->setPlayheadPosition(0.0);
+            activeMusicalContext->resetCounters();
+            activeMusicalContext->renderMidiStopInSlice(midiClockMessages);
         } else {
             // If global playhead is stopped but it should be toggled, set all tracks/clips to the start position and toggle to play
             // Also send MIDI start message for devices syncing to MIDI clock
-            for (auto track: tracks->objects){
+            for (auto track: activeTracks->objects){
                 track->clipsResetPlayheadPosition();
             }
-            musicalContext->setPlayheadIsPlaying(true);
-            musicalContext->renderMidiStartInSlice(midiClockMessages);
+            activeMusicalContext->setPlayheadIsPlaying(true);
+            activeMusicalContext->renderMidiStartInSlice(midiClockMessages);
         }
         shouldToggleIsPlaying = false;
     }
     
     // 7) -------------------------------------------------------------------------------------------------
     
-    for (auto track: tracks->objects){
-        track->clipsPrepareSlice();  // Pull sequences form the clip fifo
+    // Activate clips with cues due in this slice, then prepare active clips (pull sequences form the clip fifo)
+    if (activeTracks->uniqueId != cueSchedulerTracksId){
+        // Scheduled cues refer to clips of the tracks used until the previous slice, which are deleted once replaced
+        cueScheduler.clear();
+        cueSchedulerTracksId = activeTracks->uniqueId;
+    }
+    cueScheduler.popDueCues(activeMusicalContext->getSliceRangeInBeats().getEnd(), [](Track* track, Clip* clip){
+        track->activateClip(clip);
+    });
+    for (auto track: activeTracks->objects){
+        track->clipsPrepareSlice();
     }
     
-    if (musicalContext->playheadIsPlaying()){
-        for (auto track: tracks->objects){
-            track->clipsProcessSlice();  // No need to pass buffers here because Clip objects will retrieve them from its parent track object
+    if (activeMusicalContext->playheadIsPlaying()){
+        if (trackProcessingPool != nullptr){
+            // Process tracks in parallel (clips only write to the buffers of their track, which are merged in step 8)
+            trackProcessingPool->processItems(activeTracks->objects.size());
+        } else {
+            for (auto track: activeTracks->objects){
+                track->clipsProcessSlice();  // No need to pass buffers here because Clip objects will retrieve them from its parent track object
+            }
         }
     }
     
     // 8) -------------------------------------------------------------------------------------------------
     
-    for (auto track: tracks->objects){
+    for (auto track: activeTracks->objects){
         track->writeLastSliceMidiBufferToHardwareDeviceMidiBuffer();
     }
     
@@ -1015,25 +1500,25 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     
     // 9) -------------------------------------------------------------------------------------------------
     
-    musicalContext->renderMetronomeInSlice(midiMetronomeMessages);
+    activeMusicalContext->renderMetronomeInSlice(midiMetronomeMessages);
     if (sendMidiClock){
-        musicalContext->renderMidiClockInSlice(midiClockMessages);
+        activeMusicalContext->renderMidiClockInSlice(midiClockMessages, ShepherdDefaults::midiClockPPQN, 0.0);
     }
     
     if (sendPushLikeMidiClockBursts){
         // To sync Shepherd tempo with Push's button/pad animation tempo, a number of MIDI clock messages wrapped by a start and a stop
         // message should be sent to Push.
-        if ((shouldStartSendingPushMidiClockBurst) && (musicalContext->playheadIsPlaying())){
+        if ((shouldStartSendingPushMidiClockBurst) && (activeMusicalContext->playheadIsPlaying())){
             lastTimePushMidiClockBurstStarted = juce::Time::getMillisecondCounter();
             shouldStartSendingPushMidiClockBurst = false;
-            musicalContext->renderMidiStartInSlice(pushMidiClockMessages);
+            activeMusicalContext->renderMidiStartInSlice(pushMidiClockMessages);
         }
         if (lastTimePushMidiClockBurstStarted > -1.0){
             double timeNow = juce::Time::getMillisecondCounter();
             if (timeNow - lastTimePushMidiClockBurstStarted < PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS){
                 pushMidiClockMessages.addEvents(midiClockMessages, 0, sliceNumSamples, 0);
             } else if (timeNow - lastTimePushMidiClockBurstStarted > PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS){
-                musicalContext->renderMidiStopInSlice(pushMidiClockMessages);
+                activeMusicalContext->renderMidiStopInSlice(pushMidiClockMessages);
                 lastTimePushMidiClockBurstStarted = -1.0;
             }
         }
@@ -1041,43 +1526,48 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     
     // Add metronome and MIDI clock messages to the corresponding hardware device buffers according to settings
     // Also send MIDI clock message to Push
-    writeMidiToDevicesMidiBuffer(midiClockMessages, sendMidiClockMidiDeviceNames);
-    if (sendMetronomeMidiDeviceName != ""){
-        writeMidiToDevicesMidiBuffer(midiMetronomeMessages, {sendMetronomeMidiDeviceName});
+    writeMidiClockToDevicesMidiBuffers();
+    if (sendMetronomeMidiDeviceHandle > -1){
+        writeMidiToDeviceMidiBuffer(midiMetronomeMessages, sendMetronomeMidiDeviceHandle);
     }
     if (sendPushLikeMidiClockBursts){
-        writeMidiToDevicesMidiBuffer(pushMidiClockMessages, sendPushMidiClockDeviceNames);
+        writeMidiToDevicesMidiBuffer(pushMidiClockMessages, sendPushMidiClockDeviceHandles);
     }
     
     
-    // 10) -------------------------------------------------------------------------------------------------
-    
-    sendMidiDeviceOutputBuffers();
-    
     // 11) -------------------------------------------------------------------------------------------------
-    if ((notesMonitoringMidiOutput != nullptr) && (activeUiNotesMonitoringTrack != "")){
-        auto track = getTrackWithUUID(activeUiNotesMonitoringTrack);
+    if ((notesMonitoringMidiOutput != nullptr) && (!activeUiNotesMonitoringTrack.isNull())){
+        auto track = activeTracks->getObjectWithUUID(activeUiNotesMonitoringTrack);
         if (track != nullptr){
             auto buffer = track->getLastSliceMidiBuffer();
             if (buffer != nullptr){
                 for (auto event: *buffer){
                     auto msg = event.getMessage();
                     if (msg.isNoteOnOrOff() && msg.getChannel() == track->getMidiOutputChannel()){
-                        monitoringNotesMidiBuffer.addEvent(msg, event.samplePosition);
+                        monitoringNotesMidiBuffer.addEvent(msg, currentSliceOffsetInBlock + event.samplePosition);
+                    }
+                }
+            }
+            if (track->inputMonitoringEnabled() && outputDeviceIsMonitoredDirectly(track->getOutputHardwareDevice())){
+                // Monitored notes sent directly to the output device are not in the last slice buffer
+                for (auto event: *track->getIncomingMidiBuffer()){
+                    auto msg = event.getMessage();
+                    if (msg.isNoteOnOrOff()){
+                        monitoringNotesMidiBuffer.addEvent(msg, currentSliceOffsetInBlock + event.samplePosition);
                     }
                 }
-                notesMonitoringMidiOutput->sendBlockOfMessagesNow(monitoringNotesMidiBuffer);
             }
         }
     }
     
     // 12) -------------------------------------------------------------------------------------------------
     
-    if (musicalContext->playheadIsPlaying()){
-        musicalContext->setPlayheadPosition(musicalContext->getPlayheadPositionInBeats() + sliceLengthInBeats);
+    if (activeMusicalContext->playheadIsPlaying()){
+        // Global playhead position is derived from the sample clock so it does not accumulate rounding errors
+        activeMusicalContext->advancePlayheadBySlice();
     } else {
-        if (musicalContext->playheadIsDoingCountIn()) {
-            musicalContext->setCountInPlayheadPosition(musicalContext->getCountInPlayheadPositionInBeats() + sliceLengthInBeats);
+        if (activeMusicalContext->playheadIsDoingCountIn()) {
+            activeMusicalContext->setCountInPlayheadPosition(activeMusicalContext->getCountInPlayheadPositionInBeats() + sliceLengthInBeats);
         }
     }
 }
@@ -1090,13 +1580,159 @@ GlobalSettingsStruct Sequencer::getGlobalSettings()
     settings.fixedLengthRecordingBars = fixedLengthRecordingBars;
     settings.sampleRate = sampleRate;
     settings.samplesPerSlice = samplesPerSlice;
+    settings.sliceOffsetInBlock = currentSliceOffsetInBlock;
     settings.recordAutomationEnabled = recordAutomationEnabled;
+    settings.clipUndoLevels = clipUndoLevels;
+    settings.clipUndoMemoryBudgetBytes = clipUndoMemoryBudgetBytes;
+    LookaheadRenderer* renderer = lookaheadRendererForRTThread.load();
+    settings.lookaheadRenderer = (renderer != nullptr && renderer->isEnabled()) ? renderer : nullptr;
+    settings.directMidiThru = directMidiThru;
+    settings.automationThinningValueTolerance = automationThinningValueTolerance;
+    settings.automationThinningTimeTolerance = automationThinningTimeTolerance;
+    settings.automationPointsPerSlice = automationPointsPerSlice;
     return settings;
 }
 
+juce::var Sequencer::getStats()
+{
+    // Collect some internal stats for debugging and profiling purposes
+    const juce::ScopedLock sl (sessionObjectsLock);
+    juce::DynamicObject::Ptr compiledSequenceCacheStats = new juce::DynamicObject();
+    juce::SharedResourcePointer<ClipSequenceCache> compiledSequenceCache;
+    juce::int64 hits = compiledSequenceCache->getNumHits();
+    juce::int64 misses = compiledSequenceCache->getNumMisses();
+    compiledSequenceCacheStats->setProperty("entries", compiledSequenceCache->getNumEntries());
+    compiledSequenceCacheStats->setProperty("hits", hits);
+    compiledSequenceCacheStats->setProperty("misses", misses);
+    compiledSequenceCacheStats->setProperty("evictions", compiledSequenceCache->getNumEvictions());
+    compiledSequenceCacheStats->setProperty("hitRate", hits + misses > 0 ? (double)hits / (double)(hits + misses) : 0.0);
+    
+    juce::DynamicObject::Ptr cueSchedulerStats = new juce::DynamicObject();
+    cueSchedulerStats->setProperty("scheduledCues", cueScheduler.getNumScheduledCues());
+    cueSchedulerStats->setProperty("nextCueAtBeats", cueScheduler.getNextCueBeats());
+    
+    juce::DynamicObject::Ptr stats = new juce::DynamicObject();
+    stats->setProperty("compiledSequenceCache", compiledSequenceCacheStats.get());
+    stats->setProperty("cueScheduler", cueSchedulerStats.get());
+    stats->setProperty("residentMemoryBytes", ShepherdHelpers::getProcessResidentMemoryBytes());
+    if (lookaheadRenderer != nullptr){
+        stats->setProperty("lookaheadRenderer", lookaheadRenderer->getStats());
+    }
+    juce::DynamicObject::Ptr midiInputsStats = new juce::DynamicObject();
+    for (auto deviceData: midiInDevices){
+        if (deviceData != nullptr){
+            midiInputsStats->setProperty(deviceData->name, deviceData->inputRing->getStats());
+        }
+    }
+    stats->setProperty("midiInputs", midiInputsStats.get());
+    
+    juce::int64 numRecordedMessages = 0;
+    juce::int64 numDroppedRecordedMessages = 0;
+    int maxRecordingFifoUsage = 0;
+    juce::int64 numThinnedAutomationPoints = 0;
+    for (auto track: tracks->objects){
+        for (int i=0; i<track->getNumberOfClips(); i++){
+            auto clip = track->getClipAt(i);
+            numRecordedMessages += clip->getNumRecordedMessages();
+            numDroppedRecordedMessages += clip->getNumDroppedRecordedMessages();
+            maxRecordingFifoUsage = juce::jmax(maxRecordingFifoUsage, clip->getMaxRecordingFifoUsage());
+            numThinnedAutomationPoints += clip->getNumThinnedAutomationPoints();
+        }
+    }
+    juce::DynamicObject::Ptr recordingStats = new juce::DynamicObject();
+    recordingStats->setProperty("recorded", numRecordedMessages);
+    recordingStats->setProperty("dropped", numDroppedRecordedMessages);
+    recordingStats->setProperty("maxFifoUsage", maxRecordingFifoUsage);
+    recordingStats->setProperty("fifoSize", RECORDING_FIFO_SIZE);
+    recordingStats->setProperty("thinnedAutomationPoints", numThinnedAutomationPoints);
+    stats->setProperty("recording", recordingStats.get());
+    return stats.get();
+}
+
+juce::var Sequencer::runBenchmark(int numBlocks)
+{
+    // Load a session with the maximum number of tracks and scenes, add a short sequence to the first clip of each track,
+    // play the first scene and measure the time spent in getNextMIDIBlock and the memory used by the process. This is used
+    // to check that the cost of processing a block depends on the active content only (and not on the number of clips)
+    // and that the memory used by empty clips is bounded.
+    // NOTE: this calls getNextMIDIBlock from the message thread, it must only be used when no audio device is running and
+    // with a sequencer which is not connected to MIDI devices and controllers, so only the processing of the sequencer is measured
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    juce::int64 memoryBeforeLoading = ShepherdHelpers::getProcessResidentMemoryBytes();
+    loadNewEmptySession(MAX_NUM_TRACKS, MAX_NUM_SCENES);
+    juce::int64 memoryAfterLoading = ShepherdHelpers::getProcessResidentMemoryBytes();
+    
+    for (auto track: tracks->objects){
+        std::vector<SequenceEventRecord> records;
+        for (int i=0; i<16; i++){
+            SequenceEventRecord record;
+            record.uuid = UuidKey::createNew();
+            record.type = SequenceEventType::note;
+            record.timestamp = i * 0.25;
+            record.midiNote = 36 + i;
+            record.midiVelocity = 1.0f;
+            record.duration = 0.2;
+            records.push_back(record);
+        }
+        auto clip = track->getClipAt(0);
+        clip->replaceSequenceEvents(records, 4.0);
+        clip->recreateSequenceNow();
+    }
+    
+    if (samplesPerBlock == 0){
+        prepareSequencer(512, 44100.0);
+    }
+    shouldToggleIsPlaying = true;
+    playScene(0);
+    
+    // Clips and other objects are updated in the message thread as often as the timer would do it
+    const int blocksPerTimerCallback = juce::jmax(1, (int)(0.05 * sampleRate / samplesPerBlock));
+    double blockBudgetMs = 1000.0 * samplesPerBlock / sampleRate;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+    int blocksOverBudget = 0;
+    for (int i=0; i<numBlocks; i++){
+        juce::int64 startTicks = juce::Time::getHighResolutionTicks();
+        getNextMIDIBlock(samplesPerBlock);
+        double elapsedMs = 1000.0 * juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        totalMs += elapsedMs;
+        maxMs = juce::jmax(maxMs, elapsedMs);
+        if (elapsedMs > blockBudgetMs){
+            blocksOverBudget += 1;
+        }
+        if (i % blocksPerTimerCallback == 0){
+            timerCallback();
+        }
+    }
+    juce::int64 memoryAfterPlaying = ShepherdHelpers::getProcessResidentMemoryBytes();
+    
+    int numClips = MAX_NUM_TRACKS * MAX_NUM_SCENES;
+    juce::DynamicObject::Ptr results = new juce::DynamicObject();
+    results->setProperty("numTracks", tracks->objects.size());
+    results->setProperty("numScenes", tracks->objects.size() > 0 ? tracks->objects[0]->getNumberOfClips() : 0);
+    results->setProperty("numBlocks", numBlocks);
+    results->setProperty("samplesPerBlock", samplesPerBlock);
+    results->setProperty("samplesPerSlice", samplesPerInternalSlice);
+    results->setProperty("blockBudgetMs", blockBudgetMs);
+    results->setProperty("meanCallbackMs", numBlocks > 0 ? totalMs / numBlocks : 0.0);
+    results->setProperty("maxCallbackMs", maxMs);
+    results->setProperty("blocksOverBudget", blocksOverBudget);
+    results->setProperty("residentMemoryBytesBeforeLoading", memoryBeforeLoading);
+    results->setProperty("residentMemoryBytesAfterLoading", memoryAfterLoading);
+    results->setProperty("residentMemoryBytesAfterPlaying", memoryAfterPlaying);
+    if (memoryBeforeLoading > -1 && memoryAfterLoading > -1){
+        results->setProperty("residentMemoryBytesPerClip", (double)(memoryAfterLoading - memoryBeforeLoading) / numClips);
+    }
+    results->setProperty("stats", getStats());
+    return results.get();
+}
+
 //==============================================================================
 void Sequencer::timerCallback()
 {
+    const juce::ScopedLock sl (sessionObjectsLock);
+    
     if (shouldTryInitializeMidiOutputs){
         if (juce::Time::getMillisecondCounter() - lastTimeMidiOutputInitializationAttempted > 2000){
             // If at least one of the MIDI devices is not properly connected and 2 seconds have passed since last
@@ -1115,6 +1751,24 @@ void Sequencer::timerCallback()
     
     // Update musical context stateX members
     musicalContext->updateStateMemberVersions();
+    
+    // Add recorded notes, re-create sequences and update stateX members of clips that need it
+    for (auto track: tracks->objects){
+        track->clipsUpdateInMessageThread();
+    }
+    
+    // Update direct MIDI thru routes in case input monitoring, devices or settings changed
+    updateMidiThruRoutes();
+    
+    // Apply settings if settings file has changed
+    if (shouldApplyBackendSettings){
+        applyBackendSettings();
+    }
+    
+    // If RT thread switched to a preloaded session, finish the switch
+    if (preloadedSessionStatus == PreloadedSessionStatus::switched){
+        finalizePreloadedSessionSwitch();
+    }
 }
 
 //==============================================================================
@@ -1148,6 +1802,9 @@ void Sequencer::duplicateScene(int sceneN)
 
 void Sequencer::processMessageFromController (const juce::String action, juce::StringArray parameters)
 {
+    // NOTE: this is called from the WebSockets server thread
+    const juce::ScopedLock sl (sessionObjectsLock);
+    
     if (action.startsWith(ACTION_ADDRESS_CLIP)) {
         jassert(parameters.size() >= 2);
         juce::String trackUUID = parameters[0];
@@ -1156,6 +1813,17 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
         if (track != nullptr){
             auto* clip = track->getClipWithUUID(clipUUID);
             if (clip != nullptr){
+                // Actions that replace many sequence events at once send a single state update with the new clip contents
+                // instead of one update per added/removed event
+                bool coalesceStateUpdates = (action == ACTION_ADDRESS_CLIP_CLEAR ||
+                                             action == ACTION_ADDRESS_CLIP_DOUBLE ||
+                                             action == ACTION_ADDRESS_CLIP_UNDO ||
+                                             action == ACTION_ADDRESS_CLIP_REDO ||
+                                             action == ACTION_ADDRESS_CLIP_SET_SEQUENCE);
+                if (coalesceStateUpdates){
+                    beginCoalescingStateUpdates(clip->state);
+                }
+                
                 if (action == ACTION_ADDRESS_CLIP_PLAY){
                     if (!clip->isPlaying()){
                         track->stopAllPlayingClipsExceptFor(clipUUID, false, true, false);
@@ -1181,6 +1849,8 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
                     clip->doubleSequence();
                 } else if (action == ACTION_ADDRESS_CLIP_UNDO){
                     clip->undo();
+                } else if (action == ACTION_ADDRESS_CLIP_REDO){
+                    clip->redo();
                 } else if (action == ACTION_ADDRESS_CLIP_QUANTIZE){
                     jassert(parameters.size() == 3);
                     double quantizationStep = (double)parameters[2].getFloatValue();
@@ -1205,24 +1875,17 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
                        ]
                     }*/
                     juce::var sequenceData = juce::JSON::parse(parameters[2]);
-                    // Remove all existing notes from sequence and set length to new clip length
-                    clip->clearClipSequence();
-                    clip->setClipLength((double)sequenceData["clipLength"]);
-                    // Add new sequence events to the sequence
+                    // Replace all existing events of the sequence with the new ones and set length to new clip length
+                    std::vector<SequenceEventRecord> newSequenceEvents;
                     juce::Array<juce::var>* sequenceEvents = sequenceData["sequenceEvents"].getArray();
-                    for (juce::var eventData: *sequenceEvents){
-                        if ((int)eventData["type"] == SequenceEventType::note){
-                            double timestamp = (double)eventData["timestamp"];
-                            int midiNote = (int)eventData["midiNote"];
-                            float midiVelocity = (float)eventData["midiVelocity"];
-                            double duration = (double)eventData["duration"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(timestamp, midiNote, midiVelocity, duration), -1, nullptr);
-                        } else if ((int)eventData["type"] == SequenceEventType::midi){
-                            double timestamp = (double)eventData["timestamp"];
-                            juce::String eventMidiBytes = eventData["eventMidiBytes"].toString();
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventFromMidiBytesString(timestamp, eventMidiBytes), -1, nullptr);
+                    if (sequenceEvents != nullptr){
+                        for (juce::var eventData: *sequenceEvents){
+                            if ((int)eventData["type"] == SequenceEventType::note || (int)eventData["type"] == SequenceEventType::midi){
+                                newSequenceEvents.push_back(SequenceEventStore::createRecordFromJson(eventData));
+                            }
                         }
                     }
+                    clip->replaceSequenceEvents(newSequenceEvents, (double)sequenceData["clipLength"]);
                 } else if (action == ACTION_ADDRESS_CLIP_EDIT_SEQUENCE) {
                     // New sequence data is passed in JSON format, eg:
                     /*{
@@ -1235,62 +1898,53 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
                             ... // All the event properties that should be updated or "added" (in case of a new event)
                         }
                     }*/
+                    // Several edits can also be sent at once. These will be applied as a single transaction (either all
+                    // or none of them are applied), the UI will receive a single state update with the new clip contents,
+                    // and an ACTION_ADDRESS_CLIP_EDIT_SEQUENCE_ACK message will be sent with the resulting clip version:
+                    /*{
+                       "batchId": "a1b2c3",  // Optional, will be included in the acknowledgement message
+                       "edits": [
+                           {"action": "editEvent", "eventUUID": "356cbbdjgf...", "eventData": {"midiNote": 80}},
+                           {"action": "removeEvent", "eventUUID": "72bbc1a0d1..."},
+                           ...
+                       ]
+                    }*/
                     juce::var editSequenceData = juce::JSON::parse(parameters[2]);
-                    juce::String editAction = editSequenceData["action"].toString();
-                    if (editAction == "removeEvent"){
-                        clip->removeSequenceEventWithUUID(editSequenceData["eventUUID"]);
-                    } else if (editAction == "editEvent"){
-                        juce::ValueTree sequenceEvent = clip->getSequenceEventWithUUID(editSequenceData["eventUUID"]);
-                        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
-                            juce::var eventData = editSequenceData["eventData"];
-                            if (eventData.hasProperty("midiNote")) {
-                                sequenceEvent.setProperty(ShepherdIDs::midiNote, (int)eventData["midiNote"], nullptr);
-                            }
-                            if (eventData.hasProperty("midiVelocity")) {
-                                sequenceEvent.setProperty(ShepherdIDs::midiVelocity, (float)eventData["midiVelocity"], nullptr);
-                            }
-                            if (eventData.hasProperty("chance")) {
-                                sequenceEvent.setProperty(ShepherdIDs::chance, (float)eventData["chance"], nullptr);
-                            }
-                            if (eventData.hasProperty("timestamp")) {
-                                sequenceEvent.setProperty(ShepherdIDs::timestamp, (double)eventData["timestamp"], nullptr);
-                            }
-                            if (eventData.hasProperty("utime")) {
-                                sequenceEvent.setProperty(ShepherdIDs::uTime, (double)eventData["utime"], nullptr);
-                            }
-                            if (eventData.hasProperty("duration")) {
-                                sequenceEvent.setProperty(ShepherdIDs::duration, (double)eventData["duration"], nullptr);
-                            }
-                        } else if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::midi){
-                            juce::var eventData = editSequenceData["eventData"];
-                            if (eventData.hasProperty("timestamp")) {
-                                sequenceEvent.setProperty(ShepherdIDs::timestamp, (double)eventData["timestamp"], nullptr);
-                            }
-                            if (eventData.hasProperty("utime")) {
-                                sequenceEvent.setProperty(ShepherdIDs::uTime, (double)eventData["utime"], nullptr);
-                            }
-                            if (eventData.hasProperty("eventMidiBytes")) {
-                                sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, (float)eventData["eventMidiBytes"], nullptr);
-                            }
-                        }
-                    } else if (editAction == "addEvent") {
-                        // Create new sequence event
-                        juce::var eventData = editSequenceData["eventData"];
-                        if ((int)eventData["type"] == SequenceEventType::note){
-                            double timestamp = (double)eventData["timestamp"];
-                            int midiNote = (int)eventData["midiNote"];
-                            float midiVelocity = (float)eventData["midiVelocity"];
-                            double duration = (double)eventData["duration"];
-                            double utime = (double)eventData["utime"];
-                            float chance = (float)eventData["chance"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(timestamp, midiNote, midiVelocity, duration, utime, chance), -1, nullptr);
-                        } else if ((int)eventData["type"] == SequenceEventType::midi){
-                            double timestamp = (double)eventData["timestamp"];
-                            juce::String eventMidiBytes = eventData["eventMidiBytes"].toString();
-                            double utime = (double)eventData["utime"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventFromMidiBytesString(timestamp, eventMidiBytes, utime), -1, nullptr);
-                        }
+                    juce::Array<juce::var>* edits = editSequenceData["edits"].getArray();
+                    if (edits != nullptr){
+                        beginCoalescingStateUpdates(clip->state);
+                        bool editsApplied = clip->applySequenceEdits(*edits);
+                        endCoalescingStateUpdates();
+                        
+                        juce::OSCMessage returnMessage = juce::OSCMessage(ACTION_ADDRESS_CLIP_EDIT_SEQUENCE_ACK);
+                        returnMessage.addString(trackUUID);
+                        returnMessage.addString(clipUUID);
+                        returnMessage.addString(editSequenceData["batchId"].toString());
+                        returnMessage.addInt32(clip->getSequenceVersion());
+                        returnMessage.addInt32(editsApplied ? 1 : 0);
+                        sendMessageToController(returnMessage);
+                    } else {
+                        // Single edit
+                        juce::Array<juce::var> singleEdit;
+                        singleEdit.add(editSequenceData);
+                        clip->applySequenceEdits(singleEdit);
                     }
+                } else if (action == ACTION_ADDRESS_CLIP_SET_AUTOMATION_LANE) {
+                    // Automation lane data is passed in JSON format, eg:
+                    /*{
+                       "uuid": "356cbbdjgf...",  // Optional, if set and a lane with that UUID exists it will be replaced
+                       "controllerNumber": 74,  // -1 for pitch wheel
+                       "breakpoints": [[0.0, 0.0, 0.0], [2.0, 1.0, -3.0], [4.0, 0.5]]  // [beats, value (0.0-1.0), curve (optional, 0.0 = linear, -20.0 to 20.0)]
+                    }*/
+                    jassert(parameters.size() == 3);
+                    clip->setAutomationLane(juce::JSON::parse(parameters[2]));
+                } else if (action == ACTION_ADDRESS_CLIP_REMOVE_AUTOMATION_LANE) {
+                    jassert(parameters.size() == 3);
+                    clip->removeAutomationLaneWithUUID(parameters[2]);
+                }
+                
+                if (coalesceStateUpdates){
+                    endCoalescingStateUpdates();
                 }
             }
         }
@@ -1305,7 +1959,7 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
                 bool trueFalse = parameters[1].getIntValue() == 1;
                 track->setInputMonitoring(trueFalse);
             } else if (action == ACTION_ADDRESS_TRACK_SET_ACTIVE_UI_NOTES_MONITORING_TRACK){
-                activeUiNotesMonitoringTrack = trackUUID;
+                activeUiNotesMonitoringTrack = UuidKey::fromString(trackUUID);
             } else if (action == ACTION_ADDRESS_TRACK_SET_HARDWARE_DEVICE){
                 jassert(parameters.size() == 2);
                 juce::String deviceName = parameters[1];
@@ -1345,6 +1999,12 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
             if (device == nullptr) return;
             juce::String serializedMapping = parameters[1];  // 128 ints serialized into string, separated by comas
             device->setControlChangeMapping(serializedMapping);
+        } else if (action == ACTION_ADDRESS_DEVICE_SET_VELOCITY_CURVE){
+            jassert(parameters.size() == 2);
+            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::input);
+            if (device == nullptr) return;
+            juce::String serializedVelocityCurve = parameters[1];  // 128 ints serialized into string, separated by comas
+            device->setVelocityCurve(serializedVelocityCurve);
         }
     
     } else if (action.startsWith(ACTION_ADDRESS_SCENE)) {
@@ -1448,6 +2108,17 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
             int numScenes = parameters[1].getIntValue();
             loadNewEmptySession(numTracks, numScenes);
             
+        } else if (action == ACTION_ADDRESS_SETTINGS_PRELOAD_SESSION){
+            jassert(parameters.size() == 1);
+            juce::String filePath = parameters[0];
+            preloadSessionFromFile(filePath);
+            
+        } else if (action == ACTION_ADDRESS_SETTINGS_SWITCH_TO_PRELOADED_SESSION){
+            jassert(parameters.size() == 2);
+            int barsAhead = parameters[0].getIntValue();
+            int sceneToPlay = parameters[1].getIntValue();
+            switchToPreloadedSession(barsAhead, sceneToPlay);
+            
         } else if (action == ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY){
             jassert(parameters.size() == 1);
             fixedVelocity = parameters[0].getIntValue();
@@ -1483,6 +2154,10 @@ void Sequencer::processMessageFromController (const juce::String action, juce::S
             returnMessage.addString(state.toXmlString(juce::XmlElement::TextFormat().singleLine()));
             sendMessageToController(returnMessage);
         }
+    } else if (action == ACTION_ADDRESS_GET_STATS) {
+        juce::OSCMessage returnMessage = juce::OSCMessage(ACTION_ADDRESS_STATS);
+        returnMessage.addString(juce::JSON::toString(getStats(), true));
+        sendMessageToController(returnMessage);
     } else if (action == ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY) {
         jassert(parameters.size() == 0);
         // Set midi in connection to false so the method to initialize midi in is retrieggered at next timer call
@@ -1506,6 +2181,10 @@ void Sequencer::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasC
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
+    if (shouldCoalesceStateUpdate(treeWhosePropertyHasChanged)){
+        return;
+    }
+    
     // Send state update to UI
     juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
     message.addString("propertyChanged");
@@ -1523,6 +2202,10 @@ void Sequencer::valueTreeChildAdded (juce::ValueTree& parentTree, juce::ValueTre
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
+    if (shouldCoalesceStateUpdate(parentTree)){
+        return;
+    }
+    
     // Send state update to UI
     juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
     message.addString("addedChild");
@@ -1540,6 +2223,10 @@ void Sequencer::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueT
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
+    if (shouldCoalesceStateUpdate(parentTree)){
+        return;
+    }
+    
     // Send state update to UI
     juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
     message.addString("removedChild");
@@ -1550,6 +2237,46 @@ void Sequencer::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueT
     stateUpdateID += 1;
 }
 
+void Sequencer::beginCoalescingStateUpdates(const juce::ValueTree& tree)
+{
+    jassert(!coalescedStateUpdatesTree.isValid());  // Nested coalescing is not supported
+    coalescedStateUpdatesTree = tree;
+    coalescedStateUpdatesPending = false;
+    coalescingThreadId = juce::Thread::getCurrentThreadId();
+}
+
+void Sequencer::endCoalescingStateUpdates()
+{
+    // If any state update was skipped while coalescing, send a single update with the full contents of the coalesced tree
+    if (coalescedStateUpdatesPending){
+        juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
+        message.addString("replacedTree");
+        message.addInt32(stateUpdateID);
+        message.addString(coalescedStateUpdatesTree[ShepherdIDs::uuid].toString());
+        message.addString(coalescedStateUpdatesTree.getType().toString());
+        message.addString(coalescedStateUpdatesTree.toXmlString(juce::XmlElement::TextFormat().singleLine()));
+        sendMessageToController(message);
+        stateUpdateID += 1;
+    }
+    coalescingThreadId = nullptr;
+    coalescedStateUpdatesTree = juce::ValueTree();
+    coalescedStateUpdatesPending = false;
+}
+
+bool Sequencer::shouldCoalesceStateUpdate(const juce::ValueTree& tree)
+{
+    // Only changes made by the thread which is coalescing are coalesced (e.g. recorded events added in the message thread while
+    // the WebSockets thread is coalescing the changes of an action are sent individually)
+    if (coalescingThreadId.load() != juce::Thread::getCurrentThreadId()){
+        return false;
+    }
+    if (coalescedStateUpdatesTree.isValid() && (tree == coalescedStateUpdatesTree || tree.isAChildOf(coalescedStateUpdatesTree))){
+        coalescedStateUpdatesPending = true;
+        return true;
+    }
+    return false;
+}
+
 void Sequencer::valueTreeChildOrderChanged (juce::ValueTree& parentTree, int oldIndex, int newIndex)
 {
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
@@ -18,6 +18,10 @@
 #include "Playhead.h"
 #include "Clip.h"
 #include "Track.h"
+#include "BackendSettings.h"
+#include "LookaheadRenderer.h"
+#include "MidiInputRing.h"
+#include "TrackProcessingPool.h"
 #if USE_WS_SERVER
 #include "server_ws.hpp"
 #endif
@@ -59,20 +63,32 @@ public:
 };
 
 
+enum PreloadedSessionStatus { none, loading, ready, switchRequested, switching, switched };
+
+struct PreloadedSession {
+    // Session which has been loaded and compiled in a background thread and which is waiting to be switched in by the RT thread.
+    // After the switch, the message thread moves these objects to the sequencer (see Sequencer::finalizePreloadedSessionSwitch).
+    juce::ValueTree sessionState;
+    std::unique_ptr<MusicalContext> musicalContext;
+    std::unique_ptr<TrackList> tracks;
+};
+
+
 class Sequencer: private juce::Timer,
                  protected juce::ValueTree::Listener,
                  public juce::ActionBroadcaster
 
 {
 public:
-    Sequencer();
+    Sequencer(bool connectToDevicesAndController = true);
     ~Sequencer();
     
     void prepareSequencer (int samplesPerBlockExpected, double sampleRate);
-    void getNextMIDISlice (int sliceNumSamples);
+    void getNextMIDIBlock (int blockNumSamples);
     
     // Some public functions used for testing
     void debugState();
+    juce::var runBenchmark(int numBlocks);
     
     // Public method for receiving WS messages
     void wsMessageReceived  (const juce::String& serializedMessage);
@@ -94,21 +110,58 @@ protected:
     void valueTreeParentChanged (juce::ValueTree&) override;
 
 private:
+    void getNextMIDISlice (int sliceNumSamples);
     GlobalSettingsStruct getGlobalSettings();
+    juce::var getStats();
     
     bool sequencerInitialized = false;
     
+    // Lookahead rendering (declared before the sessions so it is destroyed after the clips which might use its slots)
+    // The renderer is only created the first time lookahead rendering is enabled
+    std::unique_ptr<LookaheadRenderer> lookaheadRenderer;
+    std::atomic<LookaheadRenderer*> lookaheadRendererForRTThread { nullptr };
+    std::atomic<bool> directMidiThru { false };
+    std::atomic<int> automationThinningValueTolerance { 0 };
+    std::atomic<double> automationThinningTimeTolerance { 0.0 };
+    std::atomic<int> automationPointsPerSlice { ShepherdDefaults::automationPointsPerSlice };
+    
+    // Parallel processing of tracks (only created at startup if enabled in the settings)
+    std::unique_ptr<TrackProcessingPool> trackProcessingPool;
+    
     // Save/load
     void loadSession(juce::ValueTree& stateToLoad);
     void loadNewEmptySession(int numTracks, int numScenes);
     void loadSessionFromFile(juce::String filePath);
     bool validateAndUpdateStateToLoad(juce::ValueTree& state);
     void saveCurrentSessionToFile(juce::String filePath);
+    juce::File getSessionFile(juce::String filePath);
+    std::unique_ptr<MusicalContext> createMusicalContext(const juce::ValueTree& sessionState);
+    std::unique_ptr<TrackList> createTracks(const juce::ValueTree& sessionState, MusicalContext* sessionMusicalContext);
+    void replaceSessionObjects(std::unique_ptr<MusicalContext> newMusicalContext, std::unique_ptr<TrackList> newTracks);
+    CueScheduler cueScheduler;
+    juce::int64 cueSchedulerTracksId = 0;  // uniqueId of the tracks whose clips have scheduled cues, only used in the RT thread
+    
+    // Session preloading
+    void preloadSessionFromFile(juce::String filePath);
+    void switchToPreloadedSession(int barsAhead, int sceneToPlay);
+    void switchToPreloadedSessionInSlice();
+    void finalizePreloadedSessionSwitch();
+    void discardPreloadedSession();
+    std::unique_ptr<PreloadedSession> preloadedSession;
+    std::atomic<int> preloadedSessionStatus {PreloadedSessionStatus::none};
+    double switchToPreloadedSessionAtBeats = -1.0;
 
     // Settings file
-    juce::String getStringPropertyFromSettingsFile(juce::String propertyName);
-    int getIntPropertyFromSettingsFile(juce::String propertyName);
-    std::vector<juce::String> getListStringPropertyFromSettingsFile(juce::String propertyName);
+    BackendSettings backendSettings;
+    void applyBackendSettings();
+    void applyPendingMidiDeviceSettings();
+    bool shouldApplyBackendSettings = false;
+    std::atomic<bool> shouldApplyPendingMidiDeviceSettings {false};
+    int pendingSendMetronomeMidiDeviceHandle = -1;
+    std::vector<int> pendingSendMidiClockMidiDeviceHandles = {};
+    std::vector<double> pendingSendMidiClockOffsetsMs = {};
+    int pendingMidiClockPPQN = ShepherdDefaults::midiClockPPQN;
+    std::vector<int> pendingSendPushMidiClockDeviceHandles = {};
     
     // Communication with controller
     ShepherdWebSocketsServer wsServer;
@@ -121,35 +174,65 @@ private:
     void processMessageFromController (const juce::String action, juce::StringArray parameters);
     int stateUpdateID = 0;
     
+    // While coalescing, state updates affecting "coalescedStateUpdatesTree" (or its children) are not sent individually
+    // and a single "replacedTree" update with the full contents of the tree is sent when coalescing ends. Only updates
+    // caused by the thread that started coalescing are coalesced, the other members are only used by that thread.
+    void beginCoalescingStateUpdates(const juce::ValueTree& tree);
+    void endCoalescingStateUpdates();
+    bool shouldCoalesceStateUpdate(const juce::ValueTree& tree);
+    std::atomic<juce::Thread::ThreadID> coalescingThreadId { nullptr };
+    juce::ValueTree coalescedStateUpdatesTree;
+    bool coalescedStateUpdatesPending = false;
+    
     // Midi devices and other midi stuff
     bool midiOutputDeviceAlreadyInitialized(const juce::String& deviceName);
     bool midiInputDeviceAlreadyInitialized(const juce::String& deviceName);
     
+    // MIDI devices are referred to by a stable integer handle in the RT thread so no device names need to be compared
+    int getMidiDeviceHandle(const juce::String& deviceName, HardwareDeviceType type);
+    void publishMidiDeviceHandles();
+    void updateMidiThruRoutes();
+    void updateDirectThruOutputDevices();
+    bool outputDeviceIsMonitoredDirectly(const HardwareDevice* outputDevice);
+    std::unique_ptr<MidiInputRing::ThruRoutes> ownedMidiThruRoutes;  // Only used in the message thread
+    std::atomic<MidiInputRing::ThruRoutes*> midiThruRoutes { nullptr };  // Shared by all input rings and the RT thread
+    MidiInputRing::ThruOutputHardwareDevices directThruOutputDevices;  // Only used in the RT thread
+    MidiInputRing::ThruOutputHardwareDevices previousBlockDirectThruOutputDevices;
+    juce::StringArray midiInDeviceHandleNames;  // Device name of each handle, only used in the message thread
+    juce::StringArray midiOutDeviceHandleNames;
+    std::array<std::atomic<MidiInputDeviceData*>, MAX_NUM_MIDI_DEVICES> midiInDevicesByHandle;  // Initialized device of each handle
+    std::array<std::atomic<MidiOutputDeviceData*>, MAX_NUM_MIDI_DEVICES> midiOutDevicesByHandle;
+    
     void initializeMIDIInputs();
     bool shouldTryInitializeMidiInputs = false;
     juce::int64 lastTimeMidiInputInitializationAttempted = 0;
     juce::OwnedArray<MidiInputDeviceData> midiInDevices = {};
     MidiInputDeviceData* initializeMidiInputDevice(juce::String deviceName);
     MidiInputDeviceData* getMidiInputDeviceData(juce::String deviceName);
+    MidiInputDeviceData* getMidiInputDeviceData(int handle);
     void clearMidiDeviceInputBuffers();
-    void collectorsRetrieveLatestBlockOfMessages(int sliceNumSamples);
-    void resetMidiInCollectors(double sampleRate);
+    void inputRingsRetrieveLatestBlockOfMessages(int blockNumSamples);
+    void inputRingsGetMessagesForCurrentSlice(int sliceNumSamples);
+    void resetMidiInputRings(double sampleRate);
     
     void initializeMIDIOutputs();
     bool shouldTryInitializeMidiOutputs = false;
     juce::int64 lastTimeMidiOutputInitializationAttempted = 0;
     juce::OwnedArray<MidiOutputDeviceData> midiOutDevices = {};
     MidiOutputDeviceData* initializeMidiOutputDevice(juce::String deviceName);
-    MidiOutputDeviceData* getMidiOutputDeviceData(juce::String deviceName);
+    MidiOutputDeviceData* getMidiOutputDeviceData(int handle);
     void clearMidiDeviceOutputBuffers();
     void clearMidiTrackBuffers();
     void sendMidiDeviceOutputBuffers();
-    void writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames);
+    void writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, const std::vector<int>& midiOutDeviceHandles);
+    void writeMidiToDeviceMidiBuffer(juce::MidiBuffer& buffer, int midiOutDeviceHandle);
+    void writeMidiClockToDevicesMidiBuffers();
     std::unique_ptr<juce::MidiOutput> notesMonitoringMidiOutput;
         
     // Aux MIDI buffers
     // We call .ensure_size for these buffers to make sure we don't to allocations in the RT thread
     juce::MidiBuffer midiClockMessages;
+    juce::MidiBuffer midiClockDestinationMessages;  // Used to render the clock of destinations with a custom resolution or offset
     juce::MidiBuffer midiMetronomeMessages;
     juce::MidiBuffer pushMidiClockMessages;
     juce::MidiBuffer monitoringNotesMidiBuffer;
@@ -158,18 +241,33 @@ private:
     std::unique_ptr<HardwareDeviceList> hardwareDevices;
     void initializeHardwareDevices();
     HardwareDevice* getHardwareDeviceByName(juce::String name, HardwareDeviceType type);
+    juce::Array<Track*> tracksReceivingInput;  // Tracks which process input messages in the current slice
+    juce::Array<HardwareDevice*> outputDevicesReceivingInput;  // Output devices of the tracks which process input messages in the current slice
     
     // Transport and basic settings
     double sampleRate = 0.0;
     int samplesPerSlice = 0;
+    int samplesPerBlock = 0;
+    int samplesPerInternalSlice = 0;  // Slice size configured in prepareSequencer, samplesPerSlice can be shorter for the last slice of a block
+    int currentSliceOffsetInBlock = 0;
     bool shouldToggleIsPlaying = false;
     juce::CachedValue<juce::String> name;
     juce::CachedValue<int> fixedLengthRecordingBars;
     juce::CachedValue<bool> recordAutomationEnabled;
     juce::CachedValue<int> fixedVelocity;
+    int clipUndoLevels = ShepherdDefaults::clipUndoLevels;
+    int clipUndoMemoryBudgetBytes = ShepherdDefaults::clipUndoMemoryBudgetBytes;
+    
+    // Session objects. The unique_ptrs own the objects and are only replaced while holding sessionObjectsLock, which the
+    // non-RT threads hold while using them. The RT thread uses the ...ForRTThread pointers instead, which it can switch
+    // itself to the objects of a preloaded session (see switchToPreloadedSessionInSlice). Replaced objects are only deleted
+    // once the RT thread is not processing a block (see replaceSessionObjects).
+    juce::CriticalSection sessionObjectsLock;
+    std::atomic<bool> isProcessingBlock { false };
     
     // Musical context
     std::unique_ptr<MusicalContext> musicalContext;
+    std::atomic<MusicalContext*> musicalContextForRTThread { nullptr };
     double nextBpm = 0.0;
     int nextMeter = 0;
     bool sendMidiClock = true;
@@ -177,13 +275,16 @@ private:
     bool shouldStartSendingPushMidiClockBurst = true;
     double lastTimePushMidiClockBurstStarted = -1.0;
     int metronomeMidiChannel = 0;
-    juce::String sendMetronomeMidiDeviceName = "";
-    std::vector<juce::String> sendMidiClockMidiDeviceNames = {};
-    std::vector<juce::String> sendPushMidiClockDeviceNames = {};
+    int sendMetronomeMidiDeviceHandle = -1;
+    std::vector<int> sendMidiClockMidiDeviceHandles = {};
+    std::vector<double> sendMidiClockOffsetsMs = {};
+    int midiClockPPQN = ShepherdDefaults::midiClockPPQN;
+    std::vector<int> sendPushMidiClockDeviceHandles = {};
 
     // Tracks
     std::unique_ptr<TrackList> tracks;
-    juce::String activeUiNotesMonitoringTrack = "";
+    std::atomic<TrackList*> tracksForRTThread { nullptr };
+    UuidKey activeUiNotesMonitoringTrack;
     Track* getTrackWithUUID(juce::String trackUUID);
     
     // Scenes
@@ -196,6 +297,9 @@ private:
     // Other testing/debugging stuff
     juce::CachedValue<bool> renderWithInternalSynth;
     
+    // Background tasks (declared last so it is destroyed first and running jobs can still use the other members)
+    juce::ThreadPool backgroundTasksPool {1};
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Sequencer)
 };
 
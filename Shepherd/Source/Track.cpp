@@ -15,10 +15,11 @@ Track::Track(const juce::ValueTree& _state,
              std::function<GlobalSettingsStruct()> globalSettingsGetter,
              std::function<MusicalContext*()> musicalContextGetter,
              std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> hardwareDeviceGetter,
-             std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter
+             std::function<CueScheduler*()> cueSchedulerGetter
              ): state(_state)
 {
     lastMidiNoteOnMessages.ensureStorageAllocated(MIDI_BUFFER_MIN_BYTES);
+    activeClips.reserve(MAX_NUM_SCENES);
     lastSliceMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
     incomingMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
     
@@ -26,7 +27,7 @@ Track::Track(const juce::ValueTree& _state,
     getGlobalSettings = globalSettingsGetter;
     getMusicalContext = musicalContextGetter;
     getHardwareDeviceByName = hardwareDeviceGetter;
-    getMidiOutputDeviceData = midiOutputDeviceDataGetter;
+    getCueScheduler = cueSchedulerGetter;
     bindState();
     
     if (hardwareDeviceName != ""){
@@ -72,7 +73,7 @@ juce::MidiBuffer* Track::getMidiOutputDeviceBufferIfDevice()
         // If device is null pointer, it means no hardware device is yet assinged and no therefore no corresponding MIDI buffer
         return nullptr;
     }
-    auto midiOutputDeviceData = getMidiOutputDeviceData(outputHwDevice->getMidiOutputDeviceName());
+    auto midiOutputDeviceData = outputHwDevice->getMidiOutputDeviceData();
     if (midiOutputDeviceData == nullptr) { return nullptr; }
     juce::MidiBuffer* bufferToFill = &midiOutputDeviceData->buffer;
     if (bufferToFill == nullptr){
@@ -112,7 +113,11 @@ void Track::prepareClips()
                                            settings.outputHwDevice = getOutputHardwareDevice();
                                            return settings;
                                        },
-                                       getMusicalContext);
+                                       getMusicalContext,
+                                       [this]{
+                                           shouldUpdateActiveClips = true;
+                                       });
+    shouldUpdateActiveClips = true;
 }
 
 int Track::getNumberOfClips()
@@ -120,21 +125,26 @@ int Track::getNumberOfClips()
     return clips->objects.size();
 }
 
-void Track::processInputMessagesFromInputHardwareDevice(HardwareDevice* inputDevice,
-                                                        double sliceLengthInBeats,
-                                                        int sliceNumSamples,
-                                                        double countInPlayheadPositionInBeats,
-                                                        double playheadPositionInBeats,
-                                                        int meter,
-                                                        bool playheadIsDoingCountIn)
+bool Track::acceptsInputMessages()
 {
-    if (inputDevice->isTypeOutput()) {return;}  // Provided device is not of type input
-    if (getOutputHardwareDevice() == nullptr){return;} // Track's output device has not been initialized
-    if (!hasClipsCuedToRecordOrRecording() && !inputMonitoringEnabled()) {return;}  // If track has no clips cued to record/recording and is not input monitoring, don't handle input data
-    
-    // Process the incoming messages from the input device according to the track's output device (e.g. change midi channel,
-    // change CC values if CC input is relative, etc...)
-    inputDevice->processAndRenderIncomingMessagesIntoBuffer(incomingMidiBuffer, getOutputHardwareDevice());
+    if (getOutputHardwareDevice() == nullptr){return false;} // Track's output device has not been initialized
+    return hasClipsCuedToRecordOrRecording() || inputMonitoringEnabled();  // If track has no clips cued to record/recording and is not input monitoring, don't handle input data
+}
+
+void Track::processInputMessages(const juce::MidiBuffer& processedInputMessages,
+                                 bool inputMonitoringSentDirectly,
+                                 double sliceLengthInBeats,
+                                 int sliceNumSamples,
+                                 double countInPlayheadPositionInBeats,
+                                 double playheadPositionInBeats,
+                                 int meter,
+                                 bool playheadIsDoingCountIn)
+{
+    // processedInputMessages contains the messages of all input devices for the current slice, already processed according to the
+    // track's output device (e.g. change midi channel, change CC values if CC input is relative, etc...)
+    for (auto metadata: processedInputMessages){
+        incomingMidiBuffer.addEvent(metadata.getMessage(), metadata.samplePosition);
+    }
     
     // store the lastMidiNoteOnMessages as this is needed when processing slice in Clip to account for notes that should be recorded with timestamp "0"
     for (auto metadata: incomingMidiBuffer){
@@ -160,23 +170,74 @@ void Track::processInputMessagesFromInputHardwareDevice(HardwareDevice* inputDev
     // Copy notes to output buffer if inpur monitoring is enabled
     if (inputMonitoringEnabled()){
         // If input monitoring is enabled, copy the processed contents of incomingMidiBuffer to the lastSliceMidiBuffer so these get passed
+        // to the output device. If messages are sent directly to the output device (inputMonitoringSentDirectly, see
+        // Sequencer::outputDeviceIsMonitoredDirectly), only controller messages need to be copied.
         //lastSliceMidiBuffer.addEvents(incomingMidiBuffer, 0, sliceNumSamples, 0);
+        bool onlyControllers = inputMonitoringSentDirectly;
         for (const auto metadata : incomingMidiBuffer){
-            lastSliceMidiBuffer.addEvent(metadata.getMessage(), metadata.samplePosition);
+            if (!onlyControllers || (metadata.data[0] & 0xF0) == 0xB0){
+                lastSliceMidiBuffer.addEvent(metadata.getMessage(), metadata.samplePosition);
+            }
         }
     }
 }
 
-void Track::clipsProcessSlice()
+void Track::updateActiveClips()
 {
+    // NOTE: this is called from the RT thread
+    // Add clips that need processing to the active clips list. This only iterates all clips when a clip has notified that
+    // its state changed (e.g. it was cued to play or record, or it has a new sequence), and not in every slice.
+    // Clips cued to play in a later slice are added to the CueScheduler instead, and will be activated when the cue is due.
+    if (!shouldUpdateActiveClips.exchange(false)){
+        return;
+    }
     for (auto clip: clips->objects){
+        if (std::find(activeClips.begin(), activeClips.end(), clip) != activeClips.end()){
+            continue;
+        }
+        if (clip->needsProcessing()){
+            activeClips.push_back(clip);
+        } else if (clip->isCuedToPlay() && clip->getPlayAtCueBeats() != clip->cueScheduledAtBeats){
+            if (getCueScheduler()->schedule(clip->getPlayAtCueBeats(), this, clip)){
+                clip->cueScheduledAtBeats = clip->getPlayAtCueBeats();
+            } else {
+                // If the scheduler is full, keep the clip active so it checks its cue in every slice
+                activeClips.push_back(clip);
+            }
+        }
+    }
+}
+
+void Track::activateClip(Clip* clip)
+{
+    // NOTE: this is called from the RT thread when a cue scheduled for the clip is due (see CueScheduler)
+    // If the cue was cleared or moved since it was scheduled, the clip might not need processing yet
+    clip->cueScheduledAtBeats = -1.0;
+    if (std::find(activeClips.begin(), activeClips.end(), clip) != activeClips.end()){
+        return;
+    }
+    if (clip->needsProcessing()){
+        activeClips.push_back(clip);
+    } else if (clip->isCuedToPlay()){
+        // Cue was moved to a later position, schedule it again
+        shouldUpdateActiveClips = true;
+    }
+}
+
+void Track::clipsProcessSlice()
+{
+    for (auto clip: activeClips){
         clip->processSlice(incomingMidiBuffer, &lastSliceMidiBuffer, lastMidiNoteOnMessages);
     }
+    
+    // Remove clips which became idle after processing this slice
+    activeClips.erase(std::remove_if(activeClips.begin(), activeClips.end(), [](Clip* clip){ return !clip->needsProcessing(); }), activeClips.end());
 }
 
 void Track::clipsPrepareSlice()
 {
-    for (auto clip: clips->objects){
+    updateActiveClips();
+    for (auto clip: activeClips){
         clip->prepareSlice();
     }
 }
@@ -195,6 +256,20 @@ void Track::clipsResetPlayheadPosition()
     }
 }
 
+void Track::clipsRecreateSequencesNow()
+{
+    for (auto clip: clips->objects){
+        clip->recreateSequenceNow();
+    }
+}
+
+void Track::clipsUpdateInMessageThread()
+{
+    for (auto clip: clips->objects){
+        clip->updateInMessageThread();
+    }
+}
+
 Clip* Track::getClipAt(int clipN)
 {
     jassert(clipN < clips->objects.size());
@@ -294,12 +369,11 @@ void Track::duplicateClipAt(int clipN)
 {
     if ((clipN >= 0) && (clipN < clips->objects.size() - 2)){
         // Don't try to duplicate last clip as there's no more space for it
-        juce::ValueTree previousClipState = clips->objects[clipN]->state.createCopy();
-        for (int i=clipN + 1; i<clips->objects.size(); i++){
-            juce::ValueTree previousClipStateAux = clips->objects[i]->state.createCopy();
+        // Shift clips starting from the end so each clip can directly load the contents of the previous one (no
+        // state copies needed). Clip contents are shared copy-on-write between clips (see Clip::loadContentsFromOtherClip)
+        for (int i=clips->objects.size() - 1; i>clipN; i--){
             bool replaceSequenceEventUUIDs = i == (clipN + 1);  // For the duplicated clip, change UUIDs of sequence events to avoid their repetitions
-            clips->objects[i]->loadStateFromOtherClipState(previousClipState, replaceSequenceEventUUIDs);
-            previousClipState = previousClipStateAux;
+            clips->objects[i]->loadContentsFromOtherClip(*clips->objects[i - 1], replaceSequenceEventUUIDs);
         }
     }
 }
@@ -316,7 +390,10 @@ bool Track::hasClipsCuedToRecord()
 
 bool Track::hasClipsCuedToRecordOrRecording()
 {
-    for (auto clip: clips->objects){
+    // NOTE: this is called from the RT thread
+    // Clips cued to record or recording are always in the active clips list, so there is no need to check all clips
+    updateActiveClips();
+    for (auto clip: activeClips){
         if (clip->isCuedToStartRecording() || clip->isRecording()){
             return true;
         }
@@ -329,6 +406,18 @@ bool Track::inputMonitoringEnabled()
     return inputMonitoring == true;
 }
 
+bool Track::sendsInputMonitoringDirectly()
+{
+    // With direct MIDI thru, monitored input messages (except controllers) are sent to the output device from the MIDI input
+    // thread (see Sequencer::updateMidiThruRoutes). This is not possible if the output device has no MIDI device (internal output).
+    // NOTE: this is only used in the message thread to build the routes, the RT thread uses the published routes instead
+    if (!inputMonitoringEnabled() || outputHwDevice == nullptr || !getGlobalSettings().directMidiThru){
+        return false;
+    }
+    auto midiOutputDeviceData = outputHwDevice->getMidiOutputDeviceData();
+    return midiOutputDeviceData != nullptr && midiOutputDeviceData->device != nullptr;
+}
+
 void Track::setInputMonitoring(bool enabled)
 {
     inputMonitoring = enabled;
@@ -345,10 +434,25 @@ juce::MidiBuffer* Track::getLastSliceMidiBuffer()
     return &lastSliceMidiBuffer;
 }
 
+juce::MidiBuffer* Track::getIncomingMidiBuffer()
+{
+    return &incomingMidiBuffer;
+}
+
 void Track::writeLastSliceMidiBufferToHardwareDeviceMidiBuffer()
 {
+    // NOTE: this is called for every track in track order (and never in parallel), so it is also used to update the internal
+    // stored state of the controllers of the output device with the controller messages sent by the track's clips
     juce::MidiBuffer* hardwareDeviceMidiBuffer = getMidiOutputDeviceBufferIfDevice();
     if (hardwareDeviceMidiBuffer != nullptr){
-        hardwareDeviceMidiBuffer->addEvents(lastSliceMidiBuffer, 0, getGlobalSettings().samplesPerSlice, 0);
+        hardwareDeviceMidiBuffer->addEvents(lastSliceMidiBuffer, 0, getGlobalSettings().samplesPerSlice, getGlobalSettings().sliceOffsetInBlock);
+    }
+    if (outputHwDevice != nullptr){
+        for (const auto metadata: lastSliceMidiBuffer){
+            auto msg = metadata.getMessage();
+            if (msg.isController()){
+                outputHwDevice->setMidiCCParameterValue(msg.getControllerNumber(), msg.getControllerValue());
+            }
+        }
     }
 }
@@ -15,6 +15,7 @@
 #include "Clip.h"
 #include "MusicalContext.h"
 #include "HardwareDevice.h"
+#include "CueScheduler.h"
 
 
 class Track
@@ -25,7 +26,7 @@ public:
           std::function<GlobalSettingsStruct()> globalSettingsGetter,
           std::function<MusicalContext*()> musicalContextGetter,
           std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> hardwareDeviceGetter,
-          std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter
+          std::function<CueScheduler*()> cueSchedulerGetter
           );
     void bindState();
     juce::ValueTree state;
@@ -42,18 +43,23 @@ public:
     void prepareClips();
     int getNumberOfClips();
     
-    void processInputMessagesFromInputHardwareDevice(HardwareDevice* inputDevice,
-                                                     double sliceLengthInBeats,
-                                                     int sliceNumSamples,
-                                                     double countInPlayheadPositionInBeats,
-                                                     double playheadPositionInBeats,
-                                                     int meter,
-                                                     bool playheadIsDoingCountIn);
+    bool acceptsInputMessages();
+    void processInputMessages(const juce::MidiBuffer& processedInputMessages,
+                              bool inputMonitoringSentDirectly,
+                              double sliceLengthInBeats,
+                              int sliceNumSamples,
+                              double countInPlayheadPositionInBeats,
+                              double playheadPositionInBeats,
+                              int meter,
+                              bool playheadIsDoingCountIn);
     
     void clipsProcessSlice();
     void clipsPrepareSlice();
     void clipsRenderRemainingNoteOffsIntoMidiBuffer();
     void clipsResetPlayheadPosition();
+    void clipsRecreateSequencesNow();
+    void clipsUpdateInMessageThread();
+    void activateClip(Clip* clip);
     
     Clip* getClipAt(int clipN);
     Clip* getClipWithUUID(juce::String clipUUID);
@@ -66,11 +72,13 @@ public:
     bool hasClipsCuedToRecord();
     bool hasClipsCuedToRecordOrRecording();
     bool inputMonitoringEnabled();
+    bool sendsInputMonitoringDirectly();
     
     void setInputMonitoring(bool enabled);
     
     void clearMidiBuffers();
     juce::MidiBuffer* getLastSliceMidiBuffer();
+    juce::MidiBuffer* getIncomingMidiBuffer();
     void writeLastSliceMidiBufferToHardwareDeviceMidiBuffer();
 
 private:
@@ -95,11 +103,19 @@ private:
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<MusicalContext*()> getMusicalContext;
     std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> getHardwareDeviceByName;
-    std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
+    std::function<CueScheduler*()> getCueScheduler;
     juce::MidiBuffer* getMidiOutputDeviceBufferIfDevice();
     
     std::unique_ptr<ClipList> clips;
     
+    // Clips which need to be processed in the RT thread (playing, cued, recording, with pending note offs, etc). Clips
+    // that are idle are not in this list so that per-slice work does not depend on the total number of clips. Clips
+    // notify the track when their state changes (from any thread) and the RT thread then checks which clips need to be
+    // added to the list. Idle clips are removed after processing each slice.
+    std::vector<Clip*> activeClips;
+    std::atomic<bool> shouldUpdateActiveClips { true };
+    void updateActiveClips();
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Track)
 };
 
@@ -110,15 +126,18 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
                std::function<GlobalSettingsStruct()> globalSettingsGetter,
                std::function<MusicalContext*()> musicalContextGetter,
                std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> hardwareDeviceGetter,
-               std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter)
+               std::function<CueScheduler*()> cueSchedulerGetter)
     : drow::ValueTreeObjectList<Track> (v)
     {
         getPlayheadParentSlice = playheadParentSliceGetter;
         getGlobalSettings = globalSettingsGetter;
         getMusicalContext = musicalContextGetter;
         getHardwareDeviceByName = hardwareDeviceGetter;
-        getMidiOutputDeviceData = midiOutputDeviceDataGetter;
+        getCueScheduler = cueSchedulerGetter;
         rebuildObjects();
+        for (auto* object: objects){
+            newObjectAdded(object);
+        }
     }
 
     ~TrackList()
@@ -126,6 +145,9 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
         freeObjects();
     }
 
+    // Identifies the list even after it is deleted (unlike its address, which can be reused by a new list)
+    const juce::int64 uniqueId = getNextUniqueId();
+
     bool isSuitableType (const juce::ValueTree& v) const override
     {
         return v.hasType (ShepherdIDs::TRACK);
@@ -138,7 +160,7 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
                           getGlobalSettings,
                           getMusicalContext,
                           getHardwareDeviceByName,
-                          getMidiOutputDeviceData);
+                          getCueScheduler);
     }
 
     void deleteObject (Track* c) override
@@ -146,22 +168,45 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
         delete c;
     }
 
-    void newObjectAdded (Track*) override    {}
-    void objectRemoved (Track*) override     {}
+    void newObjectAdded (Track* object) override
+    {
+        objectsByUuid[UuidKey::fromString(object->getUUID())] = object;
+    }
+    
+    void objectRemoved (Track* object) override
+    {
+        objectsByUuid.erase(UuidKey::fromString(object->getUUID()));
+    }
+    
     void objectOrderChanged() override       {}
     
     Track* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
+        auto* object = getObjectWithUUID(UuidKey::fromString(uuid));
+        if (object != nullptr && object->getUUID() == uuid){
+            return object;
+        }
+        return nullptr;
+    }
+    
+    Track* getObjectWithUUID(const UuidKey& uuid) {
+        auto it = objectsByUuid.find(uuid);
+        if (it != objectsByUuid.end()){
+            return it->second;
         }
         return nullptr;
     }
     
+    static juce::int64 getNextUniqueId()
+    {
+        static std::atomic<juce::int64> nextUniqueId { 0 };
+        return ++nextUniqueId;
+    }
+    
+    std::unordered_map<UuidKey, Track*, UuidKeyHash> objectsByUuid;  // Kept in sync with "objects" in newObjectAdded/objectRemoved
+    
     std::function<juce::Range<double>()> getPlayheadParentSlice;
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<MusicalContext*()> getMusicalContext;
     std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> getHardwareDeviceByName;
-    std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
+    std::function<CueScheduler*()> getCueScheduler;
 };
@@ -0,0 +1,144 @@
+/*
+  ==============================================================================
+
+    TrackProcessingPool.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+/** Pool of worker threads used to process the items of a job in parallel with the RT thread (e.g. the tracks of a slice,
+ see Sequencer::getNextMIDISlice). The RT thread starts a job with processItems, and the RT thread and the workers then
+ take the next unprocessed item (using an atomic counter) until all items have been processed, so that faster threads
+ process more items. processItems returns when all items have been processed, results should be merged by the caller.
+ Workers are pinned to their own core, run with real-time priority and spin-wait for new jobs (yielding to other threads)
+ so they can start processing items with no delay. After some time without jobs (e.g. audio device stopped), workers
+ sleep instead. As the RT thread waits for the items claimed by the workers, a worker without real-time priority could be
+ preempted and stall the RT thread, so if the priority of any worker can't be set all items are processed in the RT thread.
+ NOTE: processItem is called concurrently from several threads and must not write to state shared between items
+ */
+class TrackProcessingPool
+{
+public:
+    TrackProcessingPool(int numWorkerThreads, std::function<void(int itemIndex)> itemProcessor)
+    {
+        processItem = itemProcessor;
+        int numCpus = juce::SystemStats::getNumCpus();
+        for (int i=0; i<numWorkerThreads; i++){
+            // Pin workers to all cores except the first one, which is left to other threads (the RT thread is not pinned)
+            int cpu = numCpus > 1 ? 1 + i % (numCpus - 1) : 0;
+            workers.add(new Worker(*this, cpu));
+        }
+        for (auto worker: workers){
+            worker->startThread(realtimePriority);
+        }
+    }
+
+    ~TrackProcessingPool()
+    {
+        for (auto worker: workers){
+            worker->signalThreadShouldExit();
+        }
+        for (auto worker: workers){
+            worker->stopThread(2000);
+        }
+    }
+
+    void processItems(int numItemsToProcess)
+    {
+        // Called from the RT thread, processes all items and returns when these have been processed (by any thread)
+        jassert(numItemsToProcess <= 0xFFFF);
+        if (numWorkersWithoutRealtimePriority.load() > 0){
+            for (int i=0; i<numItemsToProcess; i++){
+                processItem(i);
+            }
+            return;
+        }
+        numItemsProcessed = 0;
+        jobNumber += 1;
+        jobState = ((juce::uint64)jobNumber << 32) | ((juce::uint64)numItemsToProcess << 16);
+        processAvailableItems();
+        while (numItemsProcessed.load() < numItemsToProcess){
+            // Wait for the items being processed by the workers
+        }
+    }
+
+    int getNumWorkerThreads() const
+    {
+        return workers.size();
+    }
+
+private:
+    class Worker: public juce::Thread
+    {
+    public:
+        Worker(TrackProcessingPool& _pool, int _cpu): juce::Thread ("TrackProcessingWorker"), pool(_pool), cpu(_cpu)
+        {
+        }
+
+        void run() override
+        {
+            juce::Thread::setCurrentThreadAffinityMask((juce::uint32)1 << cpu);
+            if (!setPriority(realtimePriority)){
+                // Real-time scheduling is not allowed (e.g. missing rtprio limits), don't take part in jobs
+                DBG("WARNING, could not set real-time priority of track processing worker, tracks will be processed in the RT thread");
+                pool.numWorkersWithoutRealtimePriority += 1;
+                return;
+            }
+            juce::uint32 lastJobNumber = (juce::uint32)(pool.jobState.load() >> 32);
+            juce::uint32 lastJobTime = juce::Time::getMillisecondCounter();
+            while (!threadShouldExit()){
+                juce::uint32 currentJobNumber = (juce::uint32)(pool.jobState.load() >> 32);
+                if (currentJobNumber != lastJobNumber){
+                    lastJobNumber = currentJobNumber;
+                    lastJobTime = juce::Time::getMillisecondCounter();
+                    pool.processAvailableItems();
+                } else if (juce::Time::getMillisecondCounter() - lastJobTime < maxSpinTimeMs){
+                    juce::Thread::yield();
+                } else {
+                    wait(1);
+                }
+            }
+        }
+
+    private:
+        TrackProcessingPool& pool;
+        int cpu;
+        static constexpr juce::uint32 maxSpinTimeMs = 500;
+    };
+
+    // Highest JUCE thread priority, which uses real-time scheduling (SCHED_RR on Linux) if the process is allowed to
+    static constexpr int realtimePriority = 10;
+    std::function<void(int itemIndex)> processItem;
+    juce::OwnedArray<Worker> workers;
+    std::atomic<int> numWorkersWithoutRealtimePriority { 0 };
+    juce::uint32 jobNumber = 0;  // Only used in the RT thread
+    std::atomic<juce::uint64> jobState { 0 };  // Job number (32 bits), number of items (16 bits) and next item to process (16 bits)
+    std::atomic<int> numItemsProcessed { 0 };
+
+    void processAvailableItems()
+    {
+        // Items are claimed by atomically incrementing the next item of the current job state. As the job number is part of
+        // the state, threads which are late to claim items of a previous job can never claim items of the next one.
+        juce::uint64 state = jobState.load();
+        while (true){
+            int numItems = (int)((state >> 16) & 0xFFFF);
+            int itemIndex = (int)(state & 0xFFFF);
+            if (itemIndex >= numItems){
+                return;
+            }
+            if (jobState.compare_exchange_weak(state, state + 1)){
+                processItem(itemIndex);
+                numItemsProcessed += 1;
+                state = jobState.load();
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TrackProcessingPool)
+};
@@ -0,0 +1,46 @@
+/*
+  ==============================================================================
+
+    TripleBuffer.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/** Passes the latest value written by one thread to another thread without locks. Unlike Fifo, writing never fails: if the
+ reader does not pull a value before a new one is written, the old value is skipped and only the latest one is pulled.
+ There must be a single writer thread and a single reader thread. Values are copied, so T should be copyable without
+ allocating memory if the reader is the RT thread.
+ */
+template<typename T>
+struct TripleBuffer
+{
+    void push(const T& t)
+    {
+        // Write the value in the back buffer and swap it with the middle one, flagging it as new
+        buffers[(size_t)backIndex] = t;
+        backIndex = middle.exchange(backIndex | newValueFlag) & indexMask;
+    }
+
+    bool pull(T& t)
+    {
+        // If a new value was pushed since the last call, swap the front buffer with the middle one and copy the new value
+        if ((middle.load() & newValueFlag) == 0){
+            return false;
+        }
+        frontIndex = middle.exchange(frontIndex) & indexMask;
+        t = buffers[(size_t)frontIndex];
+        return true;
+    }
+
+private:
+    static constexpr int newValueFlag = 4;
+    static constexpr int indexMask = 3;
+    std::array<T, 3> buffers;
+    std::atomic<int> middle { 1 };
+    int backIndex = 0;  // Only used by the writer thread
+    int frontIndex = 2;  // Only used by the reader thread
+};
@@ -44,10 +44,14 @@
 #define ACTION_ADDRESS_CLIP_DOUBLE "/clip/double"
 #define ACTION_ADDRESS_CLIP_QUANTIZE "/clip/quantize"
 #define ACTION_ADDRESS_CLIP_UNDO "/clip/undo"
+#define ACTION_ADDRESS_CLIP_REDO "/clip/redo"
 #define ACTION_ADDRESS_CLIP_SET_LENGTH "/clip/setLength"
 #define ACTION_ADDRESS_CLIP_SET_BPM_MULTIPLIER "/clip/setBpmMultiplier"
 #define ACTION_ADDRESS_CLIP_SET_SEQUENCE "/clip/setSequence"
 #define ACTION_ADDRESS_CLIP_EDIT_SEQUENCE "/clip/editSequence"
+#define ACTION_ADDRESS_CLIP_EDIT_SEQUENCE_ACK "/clip/editSequenceAck"
+#define ACTION_ADDRESS_CLIP_SET_AUTOMATION_LANE "/clip/setAutomationLane"
+#define ACTION_ADDRESS_CLIP_REMOVE_AUTOMATION_LANE "/clip/removeAutomationLane"
 
 #define ACTION_ADDRESS_TRACK "/track"
 #define ACTION_ADDRESS_TRACK_SET_INPUT_MONITORING "/track/setInputMonitoring"
@@ -60,6 +64,7 @@
 #define ACTION_ADDRESS_DEVICE_SEND_MIDI "/device/sendMidi"
 #define ACTION_ADDRESS_DEVICE_SET_NOTES_MAPPING "/device/setNotesMapping"
 #define ACTION_ADDRESS_DEVICE_SET_CC_MAPPING "/device/setCCMapping"
+#define ACTION_ADDRESS_DEVICE_SET_VELOCITY_CURVE "/device/setVelocityCurve"
 
 #define ACTION_ADDRESS_SCENE "/scene"
 #define ACTION_ADDRESS_SCENE_DUPLICATE "/scene/duplicate"
@@ -74,6 +79,8 @@
 #define ACTION_ADDRESS_SETTINGS_LOAD_SESSION "/settings/load"
 #define ACTION_ADDRESS_SETTINGS_SAVE_SESSION "/settings/save"
 #define ACTION_ADDRESS_SETTINGS_NEW_SESSION "/settings/new"
+#define ACTION_ADDRESS_SETTINGS_PRELOAD_SESSION "/settings/preload"
+#define ACTION_ADDRESS_SETTINGS_SWITCH_TO_PRELOADED_SESSION "/settings/switchToPreloaded"
 #define ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY "/settings/fixedVelocity"
 #define ACTION_ADDRESS_SETTINGS_FIXED_LENGTH "/settings/fixedLength"
 #define ACTION_ADDRESS_TRANSPORT_RECORD_AUTOMATION "/settings/toggleRecordAutomation"
@@ -82,6 +89,8 @@
 #define ACTION_ADDRESS_GET_STATE "/get_state"
 #define ACTION_ADDRESS_FULL_STATE "/full_state"
 #define ACTION_ADDRESS_STATE_UPDATE "/state_update"
+#define ACTION_ADDRESS_GET_STATS "/get_stats"
+#define ACTION_ADDRESS_STATS "/stats"
 
 #define ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY "/shepherdControllerReady"
 #define ACTION_ADDRESS_ALIVE_MESSAGE "/alive"
@@ -95,14 +104,23 @@
 
 #define DEFAULT_NUM_SCENES 8
 #define DEFAULT_NUM_TRACKS 8
-#define MAX_NUM_TRACKS 16
-#define MAX_NUM_SCENES 32
+#define MAX_NUM_TRACKS 128
+#define MAX_NUM_MIDI_DEVICES 64
+#define MAX_NUM_SCENES 256
+#define MAX_NUM_AUTOMATION_LANES 16  // Per clip
+
+// Size of the fifo used to pass recorded MIDI messages of a clip from the RT thread to the message thread. A saturated MIDI DIN
+// input sends ~1000 messages per second (e.g. polyphonic aftertouch or fast CC sweeps), so this holds ~4 seconds of messages
+// which should be enough even if the message thread is blocked for several timer ticks
+#define RECORDING_FIFO_SIZE 4096
 
 #define MIDI_SUSTAIN_PEDAL_CC 64
 #define MIDI_BANK_CHANGE_CC 0
 
 #define MIDI_BUFFER_MIN_BYTES 512
 
+#define TIMELINE_TICKS_PER_BEAT 960000  // Resolution used to store positions in the master timeline (see MusicalContext)
+
 #define SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME "ShepherdBackendNotesMonitoring"
 
 #define PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS 500
@@ -136,6 +154,16 @@ inline double uTime = 0.0;
 inline juce::String eventType = "midi";
 inline juce::String eventMidiBytes = "128,64,64";
 inline float chance = 1.0;
+inline int clipUndoLevels = 200;
+inline int clipUndoMemoryBudgetBytes = 2 * 1024 * 1024;  // Per clip
+inline int midiClockPPQN = 24;
+inline int sliceSizeInSamples = 64;  // 0 = process each audio block as a single slice
+inline double lookaheadRenderingBeats = 0.0;  // 0 = lookahead rendering disabled
+inline int trackProcessingThreads = 0;  // 0 = tracks are processed in the RT thread only
+inline bool directMidiThru = false;
+inline int automationThinningValueTolerance = 0;  // 0 = automation thinning disabled
+inline double automationThinningTimeTolerance = 0.0;
+inline int automationPointsPerSlice = 1;
 inline bool renderWithInternalSynth = true;
 inline int allowedMidiInputChannel = 0; // 0 = all
 inline bool allowNoteMessages = true;
@@ -156,6 +184,7 @@ DECLARE_ID (DEVICE)
 DECLARE_ID (TRACK)
 DECLARE_ID (CLIP)
 DECLARE_ID (SEQUENCE_EVENT)
+DECLARE_ID (AUTOMATION_LANE)
 DECLARE_ID (HARDWARE_DEVICES)
 DECLARE_ID (HARDWARE_DEVICE)
 
@@ -198,6 +227,8 @@ DECLARE_ID (duration)
 DECLARE_ID (renderedStartTimestamp)
 DECLARE_ID (renderedEndTimestamp)
 DECLARE_ID (chance)
+DECLARE_ID (controllerNumber)
+DECLARE_ID (breakpoints)
 DECLARE_ID (dataLocation)
 DECLARE_ID (midiOutputDeviceName)
 DECLARE_ID (midiInputDeviceName)
@@ -212,6 +243,7 @@ DECLARE_ID (allowAftertouchMessages)
 DECLARE_ID (allowChannelPressureMessages)
 DECLARE_ID (controlChangeMapping)
 DECLARE_ID (notesMapping)
+DECLARE_ID (velocityCurve)
 DECLARE_ID (controlChangeMessagesAreRelative)
 
 #undef DECLARE_ID
@@ -226,25 +258,85 @@ struct MidiOutputDeviceData {
     juce::String name;
     std::unique_ptr<juce::MidiOutput> device;
     juce::MidiBuffer buffer;
+    juce::MidiBuffer pendingBuffer;  // Messages the RT thread could not send because sendLock was held, sent in the next block
+    juce::SpinLock sendLock;  // Held while sending to device, which is done from the RT thread and from MIDI input threads (direct MIDI thru)
 };
 
+class MidiInputRing;  // Forward declaration, see MidiInputRing.h
+
 struct MidiInputDeviceData {
     juce::String identifier;
     juce::String name;
+    std::unique_ptr<MidiInputRing> inputRing;  // NOTE: declared before device so that device is stopped before the ring is deleted
     std::unique_ptr<juce::MidiInput> device;
-    juce::MidiMessageCollector collector;
-    juce::MidiBuffer buffer; // to store results of removeNextBlockOfMessages
+    juce::MidiBuffer blockBuffer; // to store results of removeNextBlockOfMessages (for the whole audio block)
+    juce::MidiBuffer buffer; // messages of blockBuffer that fall in the current slice
 };
 
+class LookaheadRenderer;  // Forward declaration, see LookaheadRenderer.h
+
 struct GlobalSettingsStruct {
     double sampleRate;
     int samplesPerSlice;
+    int sliceOffsetInBlock;
     int fixedLengthRecordingBars;
     double playheadPositionInBeats;
     double countInPlayheadPositionInBeats;
     bool isPlaying;
     bool doingCountIn;
     bool recordAutomationEnabled;
+    int clipUndoLevels;
+    int clipUndoMemoryBudgetBytes;
+    LookaheadRenderer* lookaheadRenderer;  // nullptr if lookahead rendering is disabled
+    bool directMidiThru;
+    int automationThinningValueTolerance;
+    double automationThinningTimeTolerance;
+    int automationPointsPerSlice;
+};
+
+
+struct UuidKey {
+    // 128-bit numeric version of the UUIDs used in the state, so these can be compared and hashed without string operations
+    juce::uint64 hi = 0;
+    juce::uint64 lo = 0;
+
+    static UuidKey fromUuid(const juce::Uuid& uuid)
+    {
+        UuidKey key;
+        const juce::uint8* bytes = uuid.getRawData();
+        for (int i=0; i<8; i++){
+            key.hi = (key.hi << 8) | bytes[i];
+            key.lo = (key.lo << 8) | bytes[i + 8];
+        }
+        return key;
+    }
+
+    static UuidKey fromString(const juce::String& uuidString) { return fromUuid(juce::Uuid(uuidString)); }
+    static UuidKey createNew() { return fromUuid(juce::Uuid()); }
+
+    juce::Uuid toUuid() const
+    {
+        juce::uint8 bytes[16];
+        for (int i=0; i<8; i++){
+            bytes[7 - i] = (juce::uint8)(hi >> (8 * i));
+            bytes[15 - i] = (juce::uint8)(lo >> (8 * i));
+        }
+        return juce::Uuid(bytes);
+    }
+
+    juce::String toString() const { return toUuid().toString(); }
+    bool isNull() const { return hi == 0 && lo == 0; }
+    bool operator== (const UuidKey& other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!= (const UuidKey& other) const { return !(*this == other); }
+};
+
+struct UuidKeyHash {
+    size_t operator() (const UuidKey& key) const { return (size_t)(key.hi ^ (key.lo * 0x9E3779B97F4A7C15ULL)); }
+};
+
+struct StringHash {
+    // Allows using juce::String as key of std::unordered_map (eg: to index hardware devices by name)
+    size_t operator() (const juce::String& s) const { return (size_t)s.hashCode64(); }
 };
 
 
@@ -14,6 +14,12 @@
 #include "defines_shepherd.h"
 #include "drow_ValueTreeObjectList.h"
 
+#if JUCE_MAC
+#include <mach/mach.h>
+#elif JUCE_LINUX
+#include <unistd.h>
+#endif
+
 namespace ShepherdHelpers
 {
 
@@ -148,7 +154,8 @@ namespace ShepherdHelpers
                                                      bool allowAftertouchMessages,
                                                      bool allowChannelPressureMessages,
                                                      juce::String notesMapping,
-                                                     juce::String controlChangeMapping)
+                                                     juce::String controlChangeMapping,
+                                                     juce::String velocityCurve)
     {
         juce::ValueTree device {ShepherdIDs::HARDWARE_DEVICE};
         ShepherdHelpers::createUuidProperty (device);
@@ -164,106 +171,11 @@ namespace ShepherdHelpers
         device.setProperty(ShepherdIDs::allowChannelPressureMessages, allowChannelPressureMessages, nullptr);
         device.setProperty(ShepherdIDs::notesMapping, notesMapping, nullptr);
         device.setProperty(ShepherdIDs::controlChangeMapping, controlChangeMapping, nullptr);
+        device.setProperty(ShepherdIDs::velocityCurve, velocityCurve, nullptr);
         device.setProperty(ShepherdIDs::controlChangeMessagesAreRelative, controlChangeMessagesAreRelative, nullptr);
         return device;
     }
 
-    inline juce::ValueTree createSequenceEventFromMidiMessage(juce::MidiMessage msg)
-    {
-        juce::ValueTree sequenceEvent {ShepherdIDs::SEQUENCE_EVENT};
-        ShepherdHelpers::createUuidProperty (sequenceEvent);
-        sequenceEvent.setProperty(ShepherdIDs::type, SequenceEventType::midi, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::timestamp, msg.getTimeStamp(), nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::uTime, ShepherdDefaults::uTime, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, -1.0, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, -1.0, nullptr);
-        juce::StringArray bytes = {};
-        for (int i=0; i<msg.getRawDataSize(); i++){
-            bytes.add(juce::String(msg.getRawData()[i]));
-        }
-        sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, bytes.joinIntoString(","), nullptr);
-        return sequenceEvent;
-    }
-
-    inline juce::ValueTree createSequenceEventFromMidiBytesString(double timestamp, const juce::String& eventMidiBytes, double utime)
-    {
-        // eventMidiBytes = comma separated byte values, eg: 127,75,12
-        juce::ValueTree sequenceEvent {ShepherdIDs::SEQUENCE_EVENT};
-        ShepherdHelpers::createUuidProperty (sequenceEvent);
-        sequenceEvent.setProperty(ShepherdIDs::type, SequenceEventType::midi, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::timestamp, timestamp, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::uTime, utime, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, -1.0, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, -1.0, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, eventMidiBytes, nullptr);
-        return sequenceEvent;
-    }
-
-    inline juce::ValueTree createSequenceEventFromMidiBytesString(double timestamp, const juce::String& eventMidiBytes)
-    {
-        return createSequenceEventFromMidiBytesString(timestamp, eventMidiBytes, ShepherdDefaults::uTime);
-    }
-
-    inline juce::ValueTree createSequenceEventOfTypeNote(double timestamp, int note, float velocity, double duration, double utime, float chance)
-    {
-        juce::ValueTree sequenceEvent {ShepherdIDs::SEQUENCE_EVENT};
-        ShepherdHelpers::createUuidProperty (sequenceEvent);
-        sequenceEvent.setProperty(ShepherdIDs::type, SequenceEventType::note, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::timestamp, timestamp, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::uTime, utime, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, -1.0, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, -1.0, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::midiNote, note, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::midiVelocity, velocity, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::duration, duration, nullptr);
-        sequenceEvent.setProperty(ShepherdIDs::chance, chance, nullptr);
-        return sequenceEvent;
-    }
-
-    inline juce::ValueTree createSequenceEventOfTypeNote(double timestamp, int note, float velocity, double duration)
-    {
-        return createSequenceEventOfTypeNote(timestamp, note, velocity, duration, ShepherdDefaults::uTime, ShepherdDefaults::chance);
-    }
-
-    inline std::vector<juce::MidiMessage> eventValueTreeToMidiMessages(juce::ValueTree& sequenceEvent)
-    {
-        std::vector<juce::MidiMessage> messages = {};
-        
-        // NOTE: don't care about MIDI channel here as they will be replaced when sending the notes to the appropriate output device
-        int midiChannel = 1;
-        
-        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::midi) {
-            juce::String bytesString = sequenceEvent.getProperty(ShepherdIDs::eventMidiBytes, ShepherdDefaults::eventMidiBytes);
-            juce::StringArray bytes;
-            bytes.addTokens(bytesString, ",", "");
-            juce::MidiMessage msg;
-            if (bytes.size() == 2){
-                msg = juce::MidiMessage(bytes[0].getIntValue(), bytes[1].getIntValue());
-            } else if (bytes.size() == 3){
-                msg = juce::MidiMessage(bytes[0].getIntValue(), bytes[1].getIntValue(), bytes[2].getIntValue());
-            }
-            msg.setChannel(midiChannel);
-            msg.setTimeStamp(sequenceEvent.getProperty(ShepherdIDs::renderedStartTimestamp));
-            messages.push_back(msg);
-            
-        } else if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note) {
-           
-            int midiNote = (int)sequenceEvent.getProperty(ShepherdIDs::midiNote);
-            float midiVelocity = (float)sequenceEvent.getProperty(ShepherdIDs::midiVelocity);
-            double noteOnTimestamp = (double)sequenceEvent.getProperty(ShepherdIDs::renderedStartTimestamp);
-            double noteOffTimestamp = (double)sequenceEvent.getProperty(ShepherdIDs::renderedEndTimestamp);
-            
-            juce::MidiMessage msgNoteOn = juce::MidiMessage::noteOn(midiChannel, midiNote, midiVelocity);
-            msgNoteOn.setTimeStamp(noteOnTimestamp);
-            messages.push_back(msgNoteOn);
-            
-            juce::MidiMessage msgNoteOff = juce::MidiMessage::noteOff(midiChannel, midiNote, 0.0f);
-            msgNoteOff.setTimeStamp(noteOffTimestamp);
-            messages.push_back(msgNoteOff);
-        }
-        return messages;
-    }
-
     inline juce::String serialize128IntArray(std::array<int, 128> array)
     {
         juce::StringArray splittedValues;
@@ -293,4 +205,25 @@ namespace ShepherdHelpers
         jassert(array.size() == 128);
         return array;
     }
+
+    inline juce::int64 getProcessResidentMemoryBytes()
+    {
+        // Returns the amount of physical memory currently used by the process (or -1 if not available in this platform)
+        #if JUCE_LINUX
+        juce::StringArray statm = juce::StringArray::fromTokens(juce::File("/proc/self/statm").loadFileAsString(), " ", "");
+        if (statm.size() > 1){
+            return statm[1].getLargeIntValue() * (juce::int64)sysconf(_SC_PAGESIZE);
+        }
+        return -1;
+        #elif JUCE_MAC
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS){
+            return (juce::int64)info.resident_size;
+        }
+        return -1;
+        #else
+        return -1;
+        #endif
+    }
 }
@@ -22,10 +22,12 @@ parameters_data = {
     'barcount': (int, "bar_count"),
     'bpm': (float, "bpm"),
     'bpmmultiplier': (float, "bpm_multiplier"),
+    'breakpoints': (str, "breakpoints"),
     'chance': (float, "chance"),
     'cliplengthinbeats': (float, "clip_length_in_beats"),
     'controlchangemapping': (str, "control_change_mapping"),
     'controlchangemessagesarerelative': (bool, "control_change_messages_are_relative"),
+    'controllernumber': (int, "controller_number"),  # -1 = pitch wheel
     'countinplayheadpositioninbeats': (float, "count_in_playhead_position_in_beats"),
     'currentquantizationstep': (float, "current_quantization_step"),
     'datalocation': (str, "data_location"),
@@ -60,6 +62,7 @@ parameters_data = {
     'type': (int, "type"),  # SequenceEventType {midi=0, note=1} or HardwareDeviceType {input=0, output=1}
     'utime': (float, "utime"),
     'uuid': (str, "uuid"),
+    'velocitycurve': (str, "velocity_curve"),
     'version': (str, "version"),
     'willplayat': (float, "will_play_at"),
     'willstartrecordingat': (float, "will_start_recording_at"),
@@ -183,6 +186,10 @@ class State(BaseShepherdClass):
                         text += '      * SEQUENCE_EVENT {}\n'.format(sequence_event.uuid)
                         if include_attributes:
                             text += sequence_event.render_object_attributes(num_spaces_offset=8)
+                    for automation_lane in clip.automation_lanes:
+                        text += '      * AUTOMATION_LANE {}\n'.format(automation_lane.uuid)
+                        if include_attributes:
+                            text += automation_lane.render_object_attributes(num_spaces_offset=8)
 
         if self.hardware_devices:
             text += '* HARDWARE DEVICES ({})\n'.format(len(self.hardware_devices))
@@ -277,6 +284,12 @@ class Session(BaseShepherdClass):
     def new(self, num_tracks, num_scenes):
         self._send_msg_to_app('/settings/new', [num_tracks, num_scenes])
 
+    def preload(self, load_session_name):
+        self._send_msg_to_app('/settings/preload', [load_session_name])
+
+    def switch_to_preloaded(self, bars_ahead=1, scene_number=-1):
+        self._send_msg_to_app('/settings/switchToPreloaded', [bars_ahead, scene_number])
+
     def scene_play(self, scene_number):
         self._send_msg_to_app('/scene/play', [scene_number])
 
@@ -352,6 +365,7 @@ class Track(BaseShepherdClass):
 
 class Clip(BaseShepherdClass):
     sequence_events: List[SequenceEvent] = []
+    automation_lanes: List[AutomationLane] = []
 
     bpm_multiplier: float
     clip_length_in_beats: float
@@ -372,6 +386,7 @@ class Clip(BaseShepherdClass):
 
     def __init__(self, *args, **kwargs):
         self.sequence_events = []
+        self.automation_lanes = []
         super().__init__(*args, **kwargs)
 
     def _add_sequence_event(self, sequence_event: SequenceEvent, position=None):
@@ -388,6 +403,17 @@ class Clip(BaseShepherdClass):
         self.sequence_events = [sequence_event for sequence_event in self.sequence_events
                                 if sequence_event.uuid != sequence_event_uuid]
 
+    def _add_automation_lane(self, automation_lane: AutomationLane):
+        # Note this method adds an AutomationLane object in the local Clip object but does not create an automation
+        # lane in the backend
+        self.automation_lanes.append(automation_lane)
+
+    def _remove_automation_lane_with_uuid(self, automation_lane_uuid):
+        # Note this method removes an AutomationLane object from the local Clip object but does not remove an
+        # automation lane from the backend
+        self.automation_lanes = [automation_lane for automation_lane in self.automation_lanes
+                                 if automation_lane.uuid != automation_lane_uuid]
+
     def get_status(self) -> str:
         CLIP_STATUS_PLAYING = "p"
         CLIP_STATUS_STOPPED = "s"
@@ -451,6 +477,9 @@ class Clip(BaseShepherdClass):
     def undo(self):
         self._send_msg_to_app('/clip/undo', [self.track.uuid, self.uuid])
 
+    def redo(self):
+        self._send_msg_to_app('/clip/redo', [self.track.uuid, self.uuid])
+
     def set_length(self, new_length):
         self._send_msg_to_app('/clip/setLength', [self.track.uuid, self.uuid, new_length])
 
@@ -486,6 +515,17 @@ class Clip(BaseShepherdClass):
         """
         self._send_msg_to_app("/clip/editSequence", [self.track.uuid, self.uuid, json.dumps(edit_sequence_data)])
 
+    def edit_sequence_batch(self, edits, batch_id=''):
+        """edits should be a list of dictionaries with the same form as the one passed to "edit_sequence". All edits
+        are applied in the backend at once (if one of them fails, none is applied) and a single state update is
+        received with the new contents of the clip. When edits have been applied, the app's "on_edit_sequence_ack"
+        method will be called with batch_id, the resulting clip version and whether the edits were applied.
+        """
+        self._send_msg_to_app("/clip/editSequence", [self.track.uuid, self.uuid, json.dumps({
+            'batchId': batch_id,
+            'edits': edits,
+        })])
+
     def remove_sequence_event(self, event_uuid):
         self.edit_sequence({
             'action': 'removeEvent',
@@ -540,6 +580,23 @@ class Clip(BaseShepherdClass):
             'eventData': event_data, 
         })
 
+    def set_automation_lane(self, controller_number, breakpoints, automation_lane_uuid=None):
+        """Adds an automation lane to the clip (or replaces the one with automation_lane_uuid if it exists).
+        controller_number is the MIDI CC number to automate (-1 for pitch wheel) and breakpoints is a list of
+        (beats, value, curve) tuples where value goes from 0.0 to 1.0 and curve is the curvature of the segment that
+        goes to the next breakpoint (0.0 = linear, optional).
+        """
+        lane_data = {
+            'controllerNumber': controller_number,
+            'breakpoints': [list(breakpoint) for breakpoint in breakpoints],
+        }
+        if automation_lane_uuid is not None:
+            lane_data['uuid'] = automation_lane_uuid
+        self._send_msg_to_app('/clip/setAutomationLane', [self.track.uuid, self.uuid, json.dumps(lane_data)])
+
+    def remove_automation_lane(self, automation_lane_uuid):
+        self._send_msg_to_app('/clip/removeAutomationLane', [self.track.uuid, self.uuid, automation_lane_uuid])
+
 
 class SequenceEvent(BaseShepherdClass):
 
@@ -591,6 +648,29 @@ class SequenceEvent(BaseShepherdClass):
             self.clip.edit_sequence_event(self.uuid, midi_bytes=midi_bytes)
 
 
+class AutomationLane(BaseShepherdClass):
+
+    breakpoints: str
+    controller_number: int
+
+    @property
+    def clip(self) -> Clip:
+        return self._parent
+
+    def is_pitch_wheel(self):
+        return self.controller_number < 0
+
+    def get_breakpoints(self):
+        # Breakpoints are serialized as "beats,value,curve" triplets separated by ";"
+        return [tuple(float(field) for field in token.split(',')) for token in self.breakpoints.split(';') if token]
+
+    def set_breakpoints(self, breakpoints):
+        self.clip.set_automation_lane(self.controller_number, breakpoints, automation_lane_uuid=self.uuid)
+
+    def remove(self):
+        self.clip.remove_automation_lane(self.uuid)
+
+
 class HardwareDevice(BaseShepherdClass):
 
     allow_aftertouch_messages: bool
@@ -609,6 +689,7 @@ class HardwareDevice(BaseShepherdClass):
     notes_mapping: str
     short_name: str
     type: int
+    velocity_curve: str
 
     _midi_cc_parameter_values_list_used_for_splitting = None
     _midi_cc_parameter_values_list_splitted = []
@@ -640,6 +721,9 @@ class HardwareDevice(BaseShepherdClass):
     def set_control_change_mapping(self, mapping):
         self._send_msg_to_app('/device/setCCMapping', [self.name, ",".join([str(item) for item in mapping])])
 
+    def set_velocity_curve(self, curve):
+        self._send_msg_to_app('/device/setVelocityCurve', [self.name, ",".join([str(item) for item in curve])])
+
 
 class ShepherdBackendInterface(StateSynchronizer):
 
@@ -738,6 +822,10 @@ class ShepherdBackendInterface(StateSynchronizer):
                         added_tree_element = SequenceEvent(child_soup, self, parent=parent_tree_element)
                         parent_tree_element._add_sequence_event(added_tree_element, position=index_in_parent_childs)
                         self._add_element_to_uuid_map(added_tree_element)
+                    elif child_soup.name == 'AUTOMATION_LANE'.lower():
+                        added_tree_element = AutomationLane(child_soup, self, parent=parent_tree_element)
+                        parent_tree_element._add_automation_lane(added_tree_element)
+                        self._add_element_to_uuid_map(added_tree_element)
                     elif child_soup.name == 'HARDWARE_DEVICE'.lower():
                         # NOTE: this should never be reached because hardware devices can't be created dynamically
                         # in Shepherd backend
@@ -760,6 +848,44 @@ class ShepherdBackendInterface(StateSynchronizer):
                     self.should_request_full_state = True
                     raise e
             
+            elif update_type == "replacedTree":
+                tree_uuid = update_data[0]
+                try:
+                    tree_element = self.get_element_with_uuid(tree_uuid)
+                    tree_soup = next(BeautifulSoup(update_data[2], "lxml").find("body").children)
+                    if isinstance(tree_element, Clip):
+                        # Update clip properties and re-create all its sequence events
+                        for attr_name, value in tree_soup.attrs.items():
+                            setattr(tree_element, modified_prop_name(attr_name), backend_value_to_python_value(attr_name, value))
+                        for sequence_event in tree_element.sequence_events:
+                            self._remove_element_from_uuid_map(sequence_event.uuid)
+                        tree_element.sequence_events = []
+                        for sequence_event_soup in tree_soup.findAll("sequence_event"):
+                            sequence_event = SequenceEvent(sequence_event_soup, self, parent=tree_element)
+                            tree_element._add_sequence_event(sequence_event)
+                            self._add_element_to_uuid_map(sequence_event)
+                        for automation_lane in tree_element.automation_lanes:
+                            self._remove_element_from_uuid_map(automation_lane.uuid)
+                        tree_element.automation_lanes = []
+                        for automation_lane_soup in tree_soup.findAll("automation_lane"):
+                            automation_lane = AutomationLane(automation_lane_soup, self, parent=tree_element)
+                            tree_element._add_automation_lane(automation_lane)
+                            self._add_element_to_uuid_map(automation_lane)
+                    else:
+                        if self.verbose_level >= 1:
+                            print('WARNING: trying to replace tree of a type that can\'t be handled: {}'
+                                  .format(tree_element))
+                        self.should_request_full_state = True
+                    app_notification_data = {
+                        'updateType': update_type,
+                        'affectedElement': tree_element,
+                    }
+                except KeyError as e:
+                    if self.verbose_level >= 1:
+                        print('WARNING: trying to replace tree that does not exist: {} ({})'
+                              .format(update_data, e))
+                    self.should_request_full_state = True
+
             elif update_type == "removedChild":
                 child_to_remove_tree_uuid = update_data[0]
                 try:
@@ -778,6 +904,10 @@ class ShepherdBackendInterface(StateSynchronizer):
                         parent_tree_element = tree_element.clip
                         removed_element_type = SequenceEvent
                         tree_element.clip._remove_sequence_event_with_uuid(child_to_remove_tree_uuid)
+                    elif isinstance(tree_element, AutomationLane):
+                        parent_tree_element = tree_element.clip
+                        removed_element_type = AutomationLane
+                        tree_element.clip._remove_automation_lane_with_uuid(child_to_remove_tree_uuid)
                     elif isinstance(tree_element, HardwareDevice):
                         parent_tree_element = self.state
                         removed_element_type = HardwareDevice
@@ -803,6 +933,14 @@ class ShepherdBackendInterface(StateSynchronizer):
             if self.app is not None:
                 self.app.on_state_update_received(app_notification_data)
 
+    def on_edit_sequence_ack(self, track_uuid, clip_uuid, batch_id, clip_version, ok):
+        if self.app is not None:
+            self.app.on_edit_sequence_ack(track_uuid, clip_uuid, batch_id, clip_version, ok)
+
+    def on_stats(self, stats):
+        if self.app is not None:
+            self.app.on_stats_received(stats)
+
     def on_full_state_received(self, full_state_soup):
         if self.state is not None:
             old_session_uuid = self.state.session.uuid
@@ -853,6 +991,10 @@ class ShepherdBackendInterface(StateSynchronizer):
                     sequence_event = SequenceEvent(sequence_event_soup, self, parent=clip)
                     clip._add_sequence_event(sequence_event)
                     self._add_element_to_uuid_map(sequence_event)
+                for automation_lane_soup in clip_soup.findAll("automation_lane"):
+                    automation_lane = AutomationLane(automation_lane_soup, self, parent=clip)
+                    clip._add_automation_lane(automation_lane)
+                    self._add_element_to_uuid_map(automation_lane)
                 track._add_clip(clip)
             session._add_track(track)
         self.state.session = session
@@ -903,3 +1045,15 @@ class ShepherdBackendControllerApp(object):
 
     def on_new_session_loaded(self):
         pass
+
+    def on_edit_sequence_ack(self, track_uuid, clip_uuid, batch_id, clip_version, ok):
+        pass
+
+    def request_stats(self):
+        """Asks the backend for some internal stats (eg: compiled sequence cache hit rate). Stats are received as a
+        dictionary in "on_stats_received".
+        """
+        self.shepherd_interface.send_msg_to_app('/get_stats', [])
+
+    def on_stats_received(self, stats):
+        pass
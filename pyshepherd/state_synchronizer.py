@@ -1,4 +1,5 @@
 import asyncio
+import json
 import ssl
 import threading
 import time
@@ -47,9 +48,21 @@ def ws_on_message(ws, message):
         elif update_type == "addedChild":
             # Can't directly use split by ; because the XML state portion might contain ; characters inside, need to be careful
             update_data = [data_parts[2], data_parts[3], data_parts[4], ';'.join(data_parts[5:])]
+        elif update_type == "replacedTree":
+            # Same as above, XML state portion might contain ; characters
+            update_data = [data_parts[2], data_parts[3], ';'.join(data_parts[4:])]
         args = [update_type, update_id] + update_data
         state_update_handler(*args)
 
+    elif address == '/clip/editSequenceAck':
+        data_parts = data.split(';')
+        if ss_instance is not None:
+            ss_instance.on_edit_sequence_ack(data_parts[0], data_parts[1], data_parts[2], int(data_parts[3]), data_parts[4] == '1')
+
+    elif address == '/stats':
+        if ss_instance is not None:
+            ss_instance.on_stats(json.loads(data))
+
     elif address == '/full_state':
         # Split data at first ocurrence of ; instead of all ocurrences of ; as character ; might be in XML state portion
         split_at = data.find(';')
@@ -233,3 +246,6 @@ class StateSynchronizer(object):
     def on_full_state_received(self, full_state_soup):
         pass
 
+    def on_edit_sequence_ack(self, track_uuid, clip_uuid, batch_id, clip_version, ok):
+        pass
+